@@ -0,0 +1,157 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "block_order.h"
+#include "trace.h"
+
+// Points the arrays into one allocation holding count blocks
+static void layout(BlockOrder *b, uint32_t *memory, size_t count) {
+    b->starts = memory;
+    b->offsets = memory + count + 1;
+    b->sequence = memory + 2 * (count + 1);
+    b->slots = b->sequence + count;
+    b->count = count;
+    b->bytes = (4 * count + 2) * sizeof(uint32_t);
+}
+
+// Recomputes the slot and order position of every block from the sequence
+static void placeBlocks(BlockOrder *b) {
+    uint32_t pos = 0;
+    for (size_t s = 0; s < b->count; s++) {
+        uint32_t block = b->sequence[s];
+        b->slots[block] = (uint32_t)s;
+        b->offsets[s] = pos;
+        pos += b->starts[block + 1] - b->starts[block];
+    }
+    b->offsets[b->count] = pos;
+}
+
+// Index of the last entry of a sorted array not above value
+static size_t floorIndex(const uint32_t *sorted, size_t count, size_t value) {
+    size_t low = 0;
+    size_t high = count;
+    while (high - low > 1) {
+        size_t mid = low + (high - low) / 2;
+        if (sorted[mid] <= value) low = mid; else high = mid;
+    }
+    return low;
+}
+
+int block_order_build(BlockOrder *b, const int *base, size_t length, const uint32_t *keys) {
+    memset(b, 0, sizeof(*b));
+    if (length == 0) return 0;
+    if (length > UINT32_MAX) {
+        trace_error("Order too long for a block order\n");
+        return -1;
+    }
+    size_t count = 1;
+    for (size_t i = 1; i < length; i++) {
+        if (keys[base[i]] != keys[base[i - 1]]) count++;
+    }
+    uint32_t *memory = malloc((4 * count + 2) * sizeof(uint32_t));
+    if (!memory) {
+        trace_error("Memory allocation failed in block_order_build\n");
+        return -1;
+    }
+    layout(b, memory, count);
+
+    size_t block = 0;
+    b->starts[0] = 0;
+    for (size_t i = 1; i < length; i++) {
+        if (keys[base[i]] != keys[base[i - 1]]) b->starts[++block] = (uint32_t)i;
+    }
+    b->starts[count] = (uint32_t)length;
+    for (size_t k = 0; k < count; k++) {
+        b->sequence[k] = (uint32_t)k;
+    }
+    placeBlocks(b);
+    return 0;
+}
+
+int block_order_split(BlockOrder *b, const int *starts, size_t count, size_t length) {
+    memset(b, 0, sizeof(*b));
+    if (count == 0 || length == 0) return 0;
+    if (length > UINT32_MAX || starts[0] != 0) return -1;
+    for (size_t k = 1; k < count; k++) {
+        if (starts[k] <= starts[k - 1] || (size_t)starts[k] >= length) return -1;
+    }
+    uint32_t *memory = malloc((4 * count + 2) * sizeof(uint32_t));
+    if (!memory) {
+        trace_error("Memory allocation failed in block_order_split\n");
+        return -1;
+    }
+    layout(b, memory, count);
+    for (size_t k = 0; k < count; k++) {
+        b->starts[k] = (uint32_t)starts[k];
+        b->sequence[k] = (uint32_t)k;
+    }
+    b->starts[count] = (uint32_t)length;
+    placeBlocks(b);
+    return 0;
+}
+
+// Fisher-Yates over the blocks; the entries themselves never move
+void block_order_shuffle(BlockOrder *b, Rng *rng) {
+    if (b->count <= 1) return;
+    for (size_t i = b->count - 1; i > 0; i--) {
+        size_t j = (size_t)rng_bounded(rng, (uint64_t)i + 1);
+        uint32_t temp = b->sequence[i];
+        b->sequence[i] = b->sequence[j];
+        b->sequence[j] = temp;
+    }
+    placeBlocks(b);
+}
+
+size_t block_order_base(const BlockOrder *b, size_t pos) {
+    size_t slot = floorIndex(b->offsets, b->count, pos);
+    uint32_t block = b->sequence[slot];
+    return b->starts[block] + (pos - b->offsets[slot]);
+}
+
+size_t block_order_position(const BlockOrder *b, size_t base) {
+    size_t block = floorIndex(b->starts, b->count, base);
+    return b->offsets[b->slots[block]] + (base - b->starts[block]);
+}
+
+void block_order_expand(const BlockOrder *b, const int *base, int *out) {
+    for (size_t s = 0; s < b->count; s++) {
+        uint32_t block = b->sequence[s];
+        size_t length = b->starts[block + 1] - b->starts[block];
+        memcpy(out + b->offsets[s], base + b->starts[block], length * sizeof(int));
+    }
+}
+
+int block_order_copy(BlockOrder *dst, const BlockOrder *src) {
+    memset(dst, 0, sizeof(*dst));
+    if (src->count == 0) return 0;
+    uint32_t *memory = malloc(src->bytes);
+    if (!memory) {
+        trace_error("Memory allocation failed in block_order_copy\n");
+        return -1;
+    }
+    memcpy(memory, src->starts, src->bytes);
+    layout(dst, memory, src->count);
+    return 0;
+}
+
+void block_order_free(BlockOrder *b) {
+    free(b->starts);
+    memset(b, 0, sizeof(*b));
+}
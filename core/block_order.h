@@ -0,0 +1,67 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    Order made of blocks: runs of consecutive entries of a base order that
+    share a key, such as the tracks of one album, stay contiguous and keep
+    their order while only the list of blocks is permuted. Shuffling costs
+    O(blocks) and mapping a position either way a binary search, with the
+    base order left untouched.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef BLOCK_ORDER_H
+#define BLOCK_ORDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "rng.h"
+
+typedef struct {
+    uint32_t *starts;       // Base position of every block, then the base length
+    uint32_t *offsets;      // Order position of every slot, then the base length
+    uint32_t *sequence;     // Block played in every slot
+    uint32_t *slots;        // Slot of every block, the inverse of sequence
+    size_t count;           // Number of blocks, 0 without a block order
+    size_t bytes;           // Memory held by the arrays
+} BlockOrder;
+
+// Splits a base order of track indices into blocks wherever the key of
+// the track changes, in base order. Returns 0 on success, -1 on failure.
+int block_order_build(BlockOrder *b, const int *base, size_t length, const uint32_t *keys);
+
+// Splits an order of length entries into count blocks starting at the
+// given ascending positions, in order, as written by block_order_expand.
+// Returns 0 on success, -1 on failure or positions that do not fit.
+int block_order_split(BlockOrder *b, const int *starts, size_t count, size_t length);
+
+// Permutes the blocks
+void block_order_shuffle(BlockOrder *b, Rng *rng);
+
+// Maps an order position to its base position
+size_t block_order_base(const BlockOrder *b, size_t pos);
+
+// Maps a base position to its order position
+size_t block_order_position(const BlockOrder *b, size_t base);
+
+// Writes the base order in block order to out, which holds the base length
+void block_order_expand(const BlockOrder *b, const int *base, int *out);
+
+// Returns 0 on success, -1 on failure
+int block_order_copy(BlockOrder *dst, const BlockOrder *src);
+
+void block_order_free(BlockOrder *b);
+
+#endif
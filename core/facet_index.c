@@ -0,0 +1,215 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "facet_index.h"
+#include "string_pool.h"
+#include "trace.h"
+
+#define INITIAL_GROUP_TRACKS 4
+
+static void freeTable(FacetTable *t) {
+    for (size_t g = 0; g < t->group_count; g++) {
+        free(t->groups[g].tracks);
+    }
+    free(t->groups);
+    free(t->group_of_key);
+    free(t->group_of);
+    memset(t, 0, sizeof(*t));
+}
+
+// Makes room for key ids below count in the id to group table
+static int reserveKeys(FacetTable *t, size_t count) {
+    if (count <= t->key_count) return 0;
+    size_t size = t->key_count * 2 > count ? t->key_count * 2 : count;
+    int *group_of_key = realloc(t->group_of_key, size * sizeof(int));
+    if (!group_of_key) return -1;
+    memset(group_of_key + t->key_count, 0xff, (size - t->key_count) * sizeof(int));
+    t->group_of_key = group_of_key;
+    t->key_count = size;
+    return 0;
+}
+
+// Returns the group of a key id, creating an empty one if needed; -1 on
+// allocation failure
+static int findOrAddGroup(FacetTable *t, uint32_t key) {
+    if (reserveKeys(t, (size_t)key + 1) != 0) return -1;
+    if (t->group_of_key[key] >= 0) return t->group_of_key[key];
+
+    if (t->group_count == t->group_capacity) {
+        size_t capacity = t->group_capacity ? t->group_capacity * 2 : 32;
+        FacetGroup *groups = realloc(t->groups, capacity * sizeof(FacetGroup));
+        if (!groups) return -1;
+        t->groups = groups;
+        t->group_capacity = capacity;
+    }
+    FacetGroup *group = &t->groups[t->group_count];
+    memset(group, 0, sizeof(*group));
+    group->key = key;
+    t->group_of_key[key] = (int)t->group_count;
+    return (int)t->group_count++;
+}
+
+// Inserts a track keeping the group ascending; appending is the common case
+static int addTrack(FacetGroup *group, int track) {
+    if (group->count == group->capacity) {
+        size_t capacity = group->capacity ? group->capacity * 2 : INITIAL_GROUP_TRACKS;
+        int *tracks = realloc(group->tracks, capacity * sizeof(int));
+        if (!tracks) return -1;
+        group->tracks = tracks;
+        group->capacity = capacity;
+    }
+    size_t at = group->count;
+    if (at > 0 && group->tracks[at - 1] > track) {
+        size_t lo = 0, hi = at;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (group->tracks[mid] < track) lo = mid + 1; else hi = mid;
+        }
+        at = lo;
+        memmove(&group->tracks[at + 1], &group->tracks[at], (group->count - at) * sizeof(int));
+    }
+    group->tracks[at] = track;
+    group->count++;
+    return 0;
+}
+
+static int compareInts(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// Fills one facet in two passes: the first finds the group of every track
+// and counts the group sizes, the second files the tracks into groups
+// allocated at their final size
+static int buildTable(FacetTable *t, const uint32_t *keys, size_t track_count, size_t key_count) {
+    t->group_of = malloc((track_count ? track_count : 1) * sizeof(int));
+    if (!t->group_of || reserveKeys(t, key_count ? key_count : 1) != 0) return -1;
+    for (size_t i = 0; i < track_count; i++) {
+        int g = -1;
+        if (keys[i] != STRING_POOL_EMPTY) {
+            g = findOrAddGroup(t, keys[i]);
+            if (g < 0) return -1;
+            t->groups[g].capacity++;
+        }
+        t->group_of[i] = g;
+    }
+    for (size_t g = 0; g < t->group_count; g++) {
+        t->groups[g].tracks = malloc(t->groups[g].capacity * sizeof(int));
+        if (!t->groups[g].tracks) return -1;
+    }
+    for (size_t i = 0; i < track_count; i++) {
+        int g = t->group_of[i];
+        if (g >= 0) {
+            t->groups[g].tracks[t->groups[g].count++] = (int)i;
+        }
+    }
+    return 0;
+}
+
+// Builds the index from the key ids of every track, one column per facet.
+// Returns 0 on success, -1 on allocation failure (the index stays invalid).
+int facet_index_build(FacetIndex *idx, uint32_t playlist, const uint32_t *const keys[FACET_COUNT],
+                      size_t track_count, size_t key_count) {
+    CHECK_NULL_RET(idx, "Null index in facet_index_build", -1);
+    facet_index_free(idx);
+    for (int f = 0; f < FACET_COUNT; f++) {
+        if (buildTable(&idx->tables[f], keys[f], track_count, key_count) != 0) {
+            trace_error("Memory allocation failed in facet_index_build\n");
+            facet_index_free(idx);
+            return -1;
+        }
+    }
+    idx->track_count = track_count;
+    idx->playlist = playlist;
+    idx->valid = 1;
+    return 0;
+}
+
+// Files a track under a key id; STRING_POOL_EMPTY leaves it out. Tracks
+// added in ascending order are appended, others are inserted in place.
+int facet_index_add(FacetIndex *idx, FacetKind facet, int track, uint32_t key) {
+    if (!idx->valid || track < 0 || (size_t)track >= idx->track_count) return -1;
+    if (key == STRING_POOL_EMPTY) return 0;
+    FacetTable *t = &idx->tables[facet];
+    int g = findOrAddGroup(t, key);
+    if (g < 0 || addTrack(&t->groups[g], track) != 0) {
+        trace_error("Memory allocation failed in facet_index_add\n");
+        facet_index_free(idx);
+        return -1;
+    }
+    t->group_of[track] = g;
+    return 0;
+}
+
+// Group of the track in a facet, NULL if the track has no key
+const FacetGroup *facet_index_group_of(const FacetIndex *idx, FacetKind facet, int track) {
+    if (!idx->valid || track < 0 || (size_t)track >= idx->track_count) return NULL;
+    const FacetTable *t = &idx->tables[facet];
+    int g = t->group_of[track];
+    return g >= 0 ? &t->groups[g] : NULL;
+}
+
+// Carries the index over a playlist change: surviving tracks are remapped,
+// removed ones dropped. Inserted tracks have no key until they are added.
+int facet_index_patch(FacetIndex *idx, const PlaylistDiff *diff) {
+    if (!idx->valid || diff->old_count != idx->track_count) return -1;
+    size_t count = diff->new_count;
+    for (int f = 0; f < FACET_COUNT; f++) {
+        FacetTable *t = &idx->tables[f];
+        int *group_of = malloc((count ? count : 1) * sizeof(int));
+        if (!group_of) {
+            trace_error("Memory allocation failed in facet_index_patch\n");
+            facet_index_free(idx);
+            return -1;
+        }
+        memset(group_of, 0xff, (count ? count : 1) * sizeof(int));
+        for (size_t g = 0; g < t->group_count; g++) {
+            FacetGroup *group = &t->groups[g];
+            size_t kept = 0;
+            int sorted = 1;
+            for (size_t i = 0; i < group->count; i++) {
+                int mapped = playlist_diff_map(diff, group->tracks[i]);
+                if (mapped < 0) continue;
+                if (kept > 0 && group->tracks[kept - 1] > mapped) sorted = 0;
+                group->tracks[kept++] = mapped;
+                group_of[mapped] = (int)g;
+            }
+            group->count = kept;
+            if (!sorted) {
+                qsort(group->tracks, group->count, sizeof(int), compareInts);
+            }
+        }
+        free(t->group_of);
+        t->group_of = group_of;
+    }
+    idx->track_count = count;
+    return 0;
+}
+
+// Releases the index and marks it invalid
+void facet_index_free(FacetIndex *idx) {
+    if (!idx) return;
+    for (int f = 0; f < FACET_COUNT; f++) {
+        freeTable(&idx->tables[f]);
+    }
+    idx->track_count = 0;
+    idx->playlist = 0;
+    idx->valid = 0;
+}
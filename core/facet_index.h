@@ -0,0 +1,84 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    Facet index of a playlist: for album, artist, genre and year it maps
+    every distinct key to the ascending indices of the tracks carrying it,
+    so the tracks sharing a key with the playing one are found without
+    scanning the playlist. Keys are string pool ids, so the index is
+    built without hashing or copying any string.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef FACET_INDEX_H
+#define FACET_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "playlist_diff.h"
+
+typedef enum {
+    FACET_ALBUM = 0,
+    FACET_ARTIST,
+    FACET_GENRE,
+    FACET_YEAR,
+    FACET_COUNT
+} FacetKind;
+
+// Tracks sharing one key
+typedef struct {
+    uint32_t key;           // String pool id of the key
+    int *tracks;            // Ascending track indices
+    size_t count;
+    size_t capacity;
+} FacetGroup;
+
+typedef struct {
+    FacetGroup *groups;
+    size_t group_count;
+    size_t group_capacity;
+    int *group_of_key;      // Group of every key id, -1 = no track has it
+    size_t key_count;
+    int *group_of;          // Group of every track, -1 = track has no key
+} FacetTable;
+
+typedef struct {
+    FacetTable tables[FACET_COUNT];
+    size_t track_count;
+    uint32_t playlist;      // Identity of the playlist the index describes
+    int valid;
+} FacetIndex;
+
+// Builds the index from the key ids of every track, one column per facet;
+// ids are below key_count. Returns 0 on success, -1 on allocation failure
+// (the index stays invalid).
+int facet_index_build(FacetIndex *idx, uint32_t playlist, const uint32_t *const keys[FACET_COUNT],
+                      size_t track_count, size_t key_count);
+
+// Files a track under a key id; STRING_POOL_EMPTY leaves it out. Tracks
+// added in ascending order are appended, others are inserted in place.
+int facet_index_add(FacetIndex *idx, FacetKind facet, int track, uint32_t key);
+
+// Group of the track in a facet, NULL if the track has no key
+const FacetGroup *facet_index_group_of(const FacetIndex *idx, FacetKind facet, int track);
+
+// Carries the index over a playlist change: surviving tracks are remapped,
+// removed ones dropped. Inserted tracks have no key until they are added.
+int facet_index_patch(FacetIndex *idx, const PlaylistDiff *diff);
+
+// Releases the index and marks it invalid
+void facet_index_free(FacetIndex *idx);
+
+#endif
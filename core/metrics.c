@@ -0,0 +1,147 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "metrics.h"
+#include "trace.h"
+
+#define METRICS_JSON_INITIAL 4096
+
+// Monotonic clock in nanoseconds
+uint64_t metrics_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+// Adds a duration; safe to call from any thread
+void metrics_record(MetricsHistogram *h, uint64_t ns) {
+    uint64_t us = ns / 1000;
+    unsigned bucket = us ? 64 - (unsigned)__builtin_clzll(us) : 0;
+    if (bucket >= METRICS_BUCKETS) bucket = METRICS_BUCKETS - 1;
+    __atomic_add_fetch(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->total_ns, ns, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->buckets[bucket], 1, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&h->max_ns, &max, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+// Upper bound of the bucket holding the given fraction of the durations,
+// in microseconds and at most the maximum; 0 if nothing was recorded
+uint64_t metrics_percentile_us(const MetricsHistogram *h, double fraction) {
+    uint64_t count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+    if (count == 0) return 0;
+    uint64_t wanted = (uint64_t)(fraction * (double)count + 0.5);
+    if (wanted == 0) wanted = 1;
+    // Bucket bounds are powers of two, so they are cut to the largest duration
+    uint64_t max_us = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED) / 1000;
+    uint64_t seen = 0;
+    unsigned b = 0;
+    for (; b < METRICS_BUCKETS - 1; b++) {
+        seen += __atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+        if (seen >= wanted) break;
+    }
+    uint64_t bound = 1ULL << b;
+    return bound < max_us ? bound : max_us;
+}
+
+void metrics_json_init(MetricsJson *j) {
+    memset(j, 0, sizeof(*j));
+    j->first = 1;
+}
+
+// Appends formatted text, growing the buffer as needed
+static void append(MetricsJson *j, const char *fmt, ...) {
+    if (j->failed) return;
+    for (;;) {
+        size_t room = j->capacity - j->length;
+        va_list args;
+        va_start(args, fmt);
+        int needed = j->data ? vsnprintf(j->data + j->length, room, fmt, args) : -1;
+        va_end(args);
+        if (needed >= 0 && (size_t)needed < room) {
+            j->length += (size_t)needed;
+            return;
+        }
+        size_t capacity = j->capacity ? j->capacity * 2 : METRICS_JSON_INITIAL;
+        while (needed >= 0 && capacity - j->length <= (size_t)needed) capacity *= 2;
+        char *grown = realloc(j->data, capacity);
+        if (!grown) {
+            trace_error("Memory reallocation failed in metrics_json append\n");
+            j->failed = 1;
+            return;
+        }
+        j->data = grown;
+        j->capacity = capacity;
+    }
+}
+
+// Writes the separator and key of the next member
+static void member(MetricsJson *j, const char *key) {
+    if (!j->first) append(j, ",");
+    j->first = 0;
+    if (key) append(j, "\"%s\":", key);
+}
+
+// Opens an object; key is NULL for the outermost one
+void metrics_json_open(MetricsJson *j, const char *key) {
+    member(j, key);
+    append(j, "{");
+    j->first = 1;
+}
+
+void metrics_json_close(MetricsJson *j) {
+    append(j, "}");
+    j->first = 0;
+}
+
+void metrics_json_uint(MetricsJson *j, const char *key, uint64_t value) {
+    member(j, key);
+    append(j, "%llu", (unsigned long long)value);
+}
+
+// Writes count, mean, percentiles and maximum of a histogram as an object
+void metrics_json_histogram(MetricsJson *j, const char *key, const MetricsHistogram *h) {
+    uint64_t count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+    uint64_t total = __atomic_load_n(&h->total_ns, __ATOMIC_RELAXED);
+    metrics_json_open(j, key);
+    metrics_json_uint(j, "count", count);
+    metrics_json_uint(j, "mean_us", count ? total / count / 1000 : 0);
+    metrics_json_uint(j, "p50_us", metrics_percentile_us(h, 0.5));
+    metrics_json_uint(j, "p90_us", metrics_percentile_us(h, 0.9));
+    metrics_json_uint(j, "p99_us", metrics_percentile_us(h, 0.99));
+    metrics_json_uint(j, "max_us", __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED) / 1000);
+    metrics_json_close(j);
+}
+
+// Returns the text, which the caller frees, or NULL if writing failed
+char *metrics_json_finish(MetricsJson *j) {
+    if (j->failed) {
+        free(j->data);
+        j->data = NULL;
+    }
+    char *text = j->data;
+    j->data = NULL;
+    j->length = j->capacity = 0;
+    return text;
+}
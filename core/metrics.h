@@ -0,0 +1,72 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    Building blocks for run-time metrics: latency histograms that any
+    thread updates without locking, and a small JSON writer for the
+    diagnostics snapshot.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define METRICS_BUCKETS 32      // Bucket b counts durations below 2^b microseconds
+
+typedef struct {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[METRICS_BUCKETS];
+} MetricsHistogram;
+
+// Builds JSON text into a growing buffer; errors are sticky
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+    int first;              // No member written yet in the open object
+    int failed;
+} MetricsJson;
+
+// Monotonic clock in nanoseconds
+uint64_t metrics_now_ns(void);
+
+// Adds a duration; safe to call from any thread
+void metrics_record(MetricsHistogram *h, uint64_t ns);
+
+// Upper bound of the bucket holding the given fraction of the durations,
+// in microseconds and at most the maximum; 0 if nothing was recorded
+uint64_t metrics_percentile_us(const MetricsHistogram *h, double fraction);
+
+void metrics_json_init(MetricsJson *j);
+
+// Opens an object; key is NULL for the outermost one
+void metrics_json_open(MetricsJson *j, const char *key);
+
+void metrics_json_close(MetricsJson *j);
+
+void metrics_json_uint(MetricsJson *j, const char *key, uint64_t value);
+
+// Writes count, mean, percentiles and maximum of a histogram as an object
+void metrics_json_histogram(MetricsJson *j, const char *key, const MetricsHistogram *h);
+
+// Returns the text, which the caller frees, or NULL if writing failed
+char *metrics_json_finish(MetricsJson *j);
+
+#endif
@@ -0,0 +1,205 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "order_cache.h"
+#include "trace.h"
+
+#define INITIAL_BUCKETS 16
+
+struct OrderCacheEntry {
+    uint32_t key;
+    size_t bytes;
+    void *value;
+    OrderCacheEntry *chain;         // Next entry in the same bucket
+    OrderCacheEntry *newer;
+    OrderCacheEntry *older;
+};
+
+static size_t bucketOf(const OrderCache *cache, uint32_t key) {
+    uint32_t h = key * 0x9e3779b1u;
+    return (size_t)(h ^ (h >> 16)) & (cache->bucket_count - 1);
+}
+
+static OrderCacheEntry *findEntry(const OrderCache *cache, uint32_t key) {
+    OrderCacheEntry *e = cache->buckets[bucketOf(cache, key)];
+    while (e && e->key != key) {
+        e = e->chain;
+    }
+    return e;
+}
+
+static void unlinkLru(OrderCache *cache, OrderCacheEntry *e) {
+    if (e->newer) e->newer->older = e->older; else cache->newest = e->older;
+    if (e->older) e->older->newer = e->newer; else cache->oldest = e->newer;
+    e->newer = e->older = NULL;
+}
+
+static void pushNewest(OrderCache *cache, OrderCacheEntry *e) {
+    e->newer = NULL;
+    e->older = cache->newest;
+    if (cache->newest) cache->newest->newer = e; else cache->oldest = e;
+    cache->newest = e;
+}
+
+// Unlinks an entry from its bucket and the LRU list and frees it
+static void dropEntry(OrderCache *cache, OrderCacheEntry *e) {
+    OrderCacheEntry **link = &cache->buckets[bucketOf(cache, e->key)];
+    while (*link != e) {
+        link = &(*link)->chain;
+    }
+    *link = e->chain;
+    unlinkLru(cache, e);
+    cache->entries--;
+    cache->bytes -= e->bytes;
+    if (cache->free_value) cache->free_value(e->value);
+    free(e);
+}
+
+// Doubles the table once it is three quarters full
+static void growBuckets(OrderCache *cache) {
+    if (cache->entries * 4 < cache->bucket_count * 3) return;
+    size_t count = cache->bucket_count * 2;
+    OrderCacheEntry **buckets = calloc(count, sizeof(OrderCacheEntry *));
+    if (!buckets) return;
+    OrderCacheEntry **old = cache->buckets;
+    size_t old_count = cache->bucket_count;
+    cache->buckets = buckets;
+    cache->bucket_count = count;
+    for (size_t i = 0; i < old_count; i++) {
+        OrderCacheEntry *e = old[i];
+        while (e) {
+            OrderCacheEntry *next = e->chain;
+            size_t b = bucketOf(cache, e->key);
+            e->chain = buckets[b];
+            buckets[b] = e;
+            e = next;
+        }
+    }
+    free(old);
+}
+
+// Evicts least recently used entries until the budget holds; keep is
+// never evicted, so a single order larger than the budget still caches
+static void enforceBudget(OrderCache *cache, const OrderCacheEntry *keep) {
+    while (cache->budget > 0 && cache->bytes > cache->budget && cache->oldest && cache->oldest != keep) {
+        trace("Evicting cached order %u (%zu bytes)\n", cache->oldest->key, cache->oldest->bytes);
+        dropEntry(cache, cache->oldest);
+        cache->evictions++;
+    }
+}
+
+// Sets up an empty cache; free_value releases evicted or replaced values
+int order_cache_init(OrderCache *cache, size_t budget, void (*free_value)(void *value)) {
+    CHECK_NULL_RET(cache, "Null cache in order_cache_init", -1);
+    memset(cache, 0, sizeof(*cache));
+    cache->buckets = calloc(INITIAL_BUCKETS, sizeof(OrderCacheEntry *));
+    if (!cache->buckets) {
+        trace_error("Memory allocation failed in order_cache_init\n");
+        return -1;
+    }
+    cache->bucket_count = INITIAL_BUCKETS;
+    cache->budget = budget;
+    cache->free_value = free_value;
+    return 0;
+}
+
+// Looks up a value and marks it as recently used; counts a hit or a miss
+void *order_cache_get(OrderCache *cache, uint32_t key) {
+    if (!cache->buckets) return NULL;
+    OrderCacheEntry *e = findEntry(cache, key);
+    if (!e) {
+        cache->misses++;
+        return NULL;
+    }
+    cache->hits++;
+    if (cache->newest != e) {
+        unlinkLru(cache, e);
+        pushNewest(cache, e);
+    }
+    return e->value;
+}
+
+// Stores a value of the given size, replacing any value under the same key,
+// then evicts old entries until the budget holds. Returns 0 on success.
+int order_cache_put(OrderCache *cache, uint32_t key, void *value, size_t bytes) {
+    if (!cache->buckets) return -1;
+    OrderCacheEntry *e = findEntry(cache, key);
+    if (e) {
+        if (cache->free_value && e->value != value) cache->free_value(e->value);
+        cache->bytes = cache->bytes - e->bytes + bytes;
+        e->value = value;
+        e->bytes = bytes;
+        unlinkLru(cache, e);
+    } else {
+        e = calloc(1, sizeof(OrderCacheEntry));
+        if (!e) {
+            trace_error("Memory allocation failed in order_cache_put\n");
+            return -1;
+        }
+        e->key = key;
+        e->value = value;
+        e->bytes = bytes;
+        size_t b = bucketOf(cache, key);
+        e->chain = cache->buckets[b];
+        cache->buckets[b] = e;
+        cache->entries++;
+        cache->bytes += bytes;
+        growBuckets(cache);
+    }
+    pushNewest(cache, e);
+    enforceBudget(cache, e);
+    return 0;
+}
+
+// Drops the value stored under key, if any
+void order_cache_remove(OrderCache *cache, uint32_t key) {
+    if (!cache->buckets) return;
+    OrderCacheEntry *e = findEntry(cache, key);
+    if (e) {
+        dropEntry(cache, e);
+    }
+}
+
+// Changes the byte ceiling, evicting entries if the cache is over it
+void order_cache_set_budget(OrderCache *cache, size_t budget) {
+    cache->budget = budget;
+    enforceBudget(cache, cache->newest);
+}
+
+// Calls visit for every entry from the least to the most recently used,
+// without changing their order
+void order_cache_each(const OrderCache *cache, void (*visit)(uint32_t key, void *value, void *data), void *data) {
+    CHECK_NULL(cache, "Null cache in order_cache_each");
+    CHECK_NULL(visit, "Null visitor in order_cache_each");
+    for (OrderCacheEntry *e = cache->oldest; e; e = e->newer) {
+        visit(e->key, e->value, data);
+    }
+}
+
+// Releases all entries and the table
+void order_cache_free(OrderCache *cache) {
+    if (!cache || !cache->buckets) return;
+    while (cache->oldest) {
+        dropEntry(cache, cache->oldest);
+    }
+    free(cache->buckets);
+    cache->buckets = NULL;
+    cache->bucket_count = 0;
+}
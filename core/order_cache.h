@@ -0,0 +1,69 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    Memory-budgeted cache of saved play orders. Entries are found through
+    a hash table keyed by a stable playlist identity and kept in LRU order;
+    when the cached orders exceed the budget, the least recently used ones
+    are evicted and rebuilt on demand.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef ORDER_CACHE_H
+#define ORDER_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct OrderCacheEntry OrderCacheEntry;
+
+typedef struct {
+    OrderCacheEntry **buckets;
+    size_t bucket_count;
+    OrderCacheEntry *newest;        // Head of the LRU list
+    OrderCacheEntry *oldest;        // Tail of the LRU list, evicted first
+    size_t entries;
+    size_t bytes;                   // Sum of the sizes reported on insertion
+    size_t budget;                  // Byte ceiling, 0 = unlimited
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    void (*free_value)(void *value);
+} OrderCache;
+
+// Sets up an empty cache; free_value releases evicted or replaced values
+int order_cache_init(OrderCache *cache, size_t budget, void (*free_value)(void *value));
+
+// Looks up a value and marks it as recently used; counts a hit or a miss
+void *order_cache_get(OrderCache *cache, uint32_t key);
+
+// Stores a value of the given size, replacing any value under the same key,
+// then evicts old entries until the budget holds. Returns 0 on success.
+int order_cache_put(OrderCache *cache, uint32_t key, void *value, size_t bytes);
+
+// Drops the value stored under key, if any
+void order_cache_remove(OrderCache *cache, uint32_t key);
+
+// Changes the byte ceiling, evicting entries if the cache is over it
+void order_cache_set_budget(OrderCache *cache, size_t budget);
+
+// Calls visit for every entry from the least to the most recently used,
+// without changing their order
+void order_cache_each(const OrderCache *cache, void (*visit)(uint32_t key, void *value, void *data), void *data);
+
+// Releases all entries and the table
+void order_cache_free(OrderCache *cache);
+
+#endif
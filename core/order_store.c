@@ -0,0 +1,388 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "order_store.h"
+#include "trace.h"
+
+#define STORE_MAGIC "PBORDERS"
+#define STORE_VERSION 2            // 2 added the flagged sections after a record
+#define STORE_BYTE_ORDER 0x01020304u
+
+// File header; the payload of records follows it
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;        // Files of another byte order are rejected
+    uint32_t record_count;
+    uint32_t played_count;      // Played sets after the records; 0 in older files
+    uint64_t payload_bytes;
+    uint64_t checksum;          // Over the payload
+} StoreHeader;
+
+// Record as laid out in the file, followed by the tables of the order,
+// each padded to eight bytes
+typedef struct {
+    uint32_t playlist;
+    uint32_t play_mode;
+    uint32_t track_count;
+    uint32_t flags;
+    int32_t cursor;
+    uint32_t kind;
+    uint32_t width;
+    uint32_t universe;
+    uint64_t order_seed;
+    uint64_t fingerprint;
+    uint64_t lazy_seed;
+    uint64_t count;
+    uint64_t word_count;
+    uint64_t rank_count;
+    uint64_t gap_bytes;
+    uint64_t block_count;
+} StoreRecord;
+
+// Packed order of a flagged section as laid out in the file, followed by
+// its tables
+typedef struct {
+    uint32_t kind;
+    uint32_t width;
+    uint32_t universe;
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t word_count;
+    uint64_t rank_count;
+    uint64_t gap_bytes;
+    uint64_t block_count;
+} StorePacked;
+
+// Played set as laid out in the file, followed by its words
+typedef struct {
+    uint32_t playlist;
+    uint32_t track_count;
+    uint64_t word_count;
+} StorePlayedRecord;
+
+typedef struct {
+    FILE *file;
+    uint64_t checksum;
+    uint64_t bytes;
+    int failed;
+} StoreWriter;
+
+static size_t padded(size_t bytes) {
+    return (bytes + 7) & ~(size_t)7;
+}
+
+// Folds eight-byte words into the checksum; a short tail counts as zero
+// padded, so blocks hashed one by one match the padded file as a whole
+static uint64_t checksumUpdate(uint64_t h, const void *data, size_t bytes) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < bytes; i += 8) {
+        uint64_t word = 0;
+        memcpy(&word, p + i, bytes - i < 8 ? bytes - i : 8);
+        h = (h ^ word) * 0x100000001b3ULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+// Writes a block padded to eight bytes and adds it to the checksum
+static void writeBlock(StoreWriter *w, const void *data, size_t bytes) {
+    static const char zeros[8] = { 0 };
+    if (w->failed || bytes == 0) return;
+    size_t pad = padded(bytes) - bytes;
+    if (fwrite(data, 1, bytes, w->file) != bytes || fwrite(zeros, 1, pad, w->file) != pad) {
+        w->failed = 1;
+        return;
+    }
+    w->checksum = checksumUpdate(w->checksum, data, bytes);
+    w->bytes += bytes + pad;
+}
+
+// Writes the tables of a packed order
+static void writeTables(StoreWriter *w, const PackedOrder *o) {
+    writeBlock(w, o->words, (o->words ? o->word_count : 0) * sizeof(uint64_t));
+    writeBlock(w, o->ranks, (o->ranks ? o->rank_count : 0) * sizeof(uint32_t));
+    writeBlock(w, o->gaps, o->gaps ? o->gap_bytes : 0);
+    writeBlock(w, o->blocks, (o->blocks ? o->block_count : 0) * 2 * sizeof(uint32_t));
+}
+
+// Writes a packed order of a flagged section with its tables
+static void writePacked(StoreWriter *w, const PackedOrder *o) {
+    StorePacked rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.kind = (uint32_t)o->kind;
+    rec.width = o->width;
+    rec.universe = o->universe;
+    rec.count = o->count;
+    rec.word_count = o->words ? o->word_count : 0;
+    rec.rank_count = o->ranks ? o->rank_count : 0;
+    rec.gap_bytes = o->gaps ? o->gap_bytes : 0;
+    rec.block_count = o->blocks ? o->block_count : 0;
+    writeBlock(w, &rec, sizeof(rec));
+    writeTables(w, o);
+}
+
+static void writeRecord(StoreWriter *w, const StoredOrder *r) {
+    const PackedOrder *o = &r->order;
+    StoreRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.playlist = r->playlist;
+    rec.play_mode = r->play_mode;
+    rec.track_count = r->track_count;
+    rec.flags = r->flags;
+    rec.cursor = r->cursor;
+    rec.kind = (uint32_t)o->kind;
+    rec.width = o->width;
+    rec.universe = o->universe;
+    rec.order_seed = r->order_seed;
+    rec.fingerprint = r->fingerprint;
+    rec.lazy_seed = r->lazy_seed;
+    rec.count = o->count;
+    rec.word_count = o->words ? o->word_count : 0;
+    rec.rank_count = o->ranks ? o->rank_count : 0;
+    rec.gap_bytes = o->gaps ? o->gap_bytes : 0;
+    rec.block_count = o->blocks ? o->block_count : 0;
+    writeBlock(w, &rec, sizeof(rec));
+    writeTables(w, o);
+    if (r->flags & ORDER_STORE_BLOCKS) {
+        writePacked(w, &r->blocks);
+    }
+    if (r->flags & ORDER_STORE_CRITERIA) {
+        // Written with its terminator, so readers can use it in place
+        uint64_t bytes = strlen(r->criteria_key) + 1;
+        writeBlock(w, &bytes, sizeof(bytes));
+        writeBlock(w, r->criteria_key, (size_t)bytes);
+    }
+}
+
+static void writePlayed(StoreWriter *w, const StoredPlayed *p) {
+    StorePlayedRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.playlist = p->playlist;
+    rec.track_count = p->track_count;
+    rec.word_count = ((uint64_t)p->track_count + 63) / 64;
+    writeBlock(w, &rec, sizeof(rec));
+    writeBlock(w, p->words, rec.word_count * sizeof(uint64_t));
+}
+
+// Writes the records and played sets to path through a temporary file that
+// replaces it. Returns 0 on success, -1 on failure.
+int order_store_write(const char *path, const StoredOrder *records, size_t count,
+                      const StoredPlayed *played, size_t played_count) {
+    CHECK_NULL_RET(path, "Null path in order_store_write", -1);
+    char tmp[4096];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) return -1;
+
+    StoreWriter w = { .file = fopen(tmp, "wb"), .checksum = 0xcbf29ce484222325ULL };
+    if (!w.file) {
+        trace_error("Cannot create order file %s\n", tmp);
+        return -1;
+    }
+    StoreHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, STORE_MAGIC, sizeof(header.magic));
+    header.version = STORE_VERSION;
+    header.byte_order = STORE_BYTE_ORDER;
+    header.record_count = (uint32_t)count;
+    header.played_count = (uint32_t)played_count;
+
+    // The header is rewritten with the checksum once the payload is known
+    if (fwrite(&header, sizeof(header), 1, w.file) != 1) w.failed = 1;
+    for (size_t i = 0; i < count && !w.failed; i++) {
+        writeRecord(&w, &records[i]);
+    }
+    for (size_t i = 0; i < played_count && !w.failed; i++) {
+        writePlayed(&w, &played[i]);
+    }
+    header.payload_bytes = w.bytes;
+    header.checksum = w.checksum;
+    if (!w.failed && (fseek(w.file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, w.file) != 1)) {
+        w.failed = 1;
+    }
+    if (fclose(w.file) != 0) w.failed = 1;
+    if (w.failed || rename(tmp, path) != 0) {
+        trace_error("Failed to write order file %s\n", path);
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// Points a table of the order at the next block of the payload
+static const void *takeBlock(const unsigned char **cursor, const unsigned char *end, uint64_t bytes) {
+    if (bytes == 0) return NULL;
+    if (bytes > (uint64_t)(end - *cursor) || padded((size_t)bytes) > (size_t)(end - *cursor)) {
+        return NULL;
+    }
+    const void *block = *cursor;
+    *cursor += padded((size_t)bytes);
+    return block;
+}
+
+// Points a packed order at its tables in the payload; returns -1 if they
+// do not fit it or do not form a valid order
+static int takeTables(const unsigned char **cursor, const unsigned char *end, const StorePacked *rec, PackedOrder *o) {
+    // Table sizes are bounded by the file before they are multiplied
+    uint64_t limit = (uint64_t)(end - *cursor);
+    if (rec->word_count > limit / sizeof(uint64_t) || rec->rank_count > limit / sizeof(uint32_t) ||
+        rec->gap_bytes > limit || rec->block_count > limit / (2 * sizeof(uint32_t))) {
+        return -1;
+    }
+    memset(o, 0, sizeof(*o));
+    o->kind = (PackedKind)rec->kind;
+    o->width = rec->width;
+    o->universe = rec->universe;
+    o->count = (size_t)rec->count;
+    o->word_count = (size_t)rec->word_count;
+    o->rank_count = (size_t)rec->rank_count;
+    o->gap_bytes = (size_t)rec->gap_bytes;
+    o->block_count = (size_t)rec->block_count;
+    o->words = (uint64_t *)takeBlock(cursor, end, rec->word_count * sizeof(uint64_t));
+    o->ranks = (uint32_t *)takeBlock(cursor, end, rec->rank_count * sizeof(uint32_t));
+    o->gaps = (uint8_t *)takeBlock(cursor, end, rec->gap_bytes);
+    o->blocks = (uint32_t *)takeBlock(cursor, end, rec->block_count * 2 * sizeof(uint32_t));
+    if ((o->word_count && !o->words) || (o->rank_count && !o->ranks) ||
+        (o->gap_bytes && !o->gaps) || (o->block_count && !o->blocks)) {
+        return -1;
+    }
+    return packed_order_check(o);
+}
+
+// Reads one record; returns -1 if it does not fit the payload
+static int readRecord(const unsigned char **cursor, const unsigned char *end, StoredOrder *r) {
+    StoreRecord rec;
+    if ((size_t)(end - *cursor) < sizeof(rec)) return -1;
+    memcpy(&rec, *cursor, sizeof(rec));
+    *cursor += sizeof(rec);
+
+    memset(r, 0, sizeof(*r));
+    r->playlist = rec.playlist;
+    r->play_mode = rec.play_mode;
+    r->track_count = rec.track_count;
+    r->flags = rec.flags;
+    r->cursor = rec.cursor;
+    r->order_seed = rec.order_seed;
+    r->fingerprint = rec.fingerprint;
+    r->lazy_seed = rec.lazy_seed;
+
+    StorePacked order = {
+        .kind = rec.kind, .width = rec.width, .universe = rec.universe, .count = rec.count,
+        .word_count = rec.word_count, .rank_count = rec.rank_count,
+        .gap_bytes = rec.gap_bytes, .block_count = rec.block_count,
+    };
+    if (takeTables(cursor, end, &order, &r->order) != 0) return -1;
+    if (r->flags & ORDER_STORE_BLOCKS) {
+        StorePacked blocks;
+        if ((size_t)(end - *cursor) < sizeof(blocks)) return -1;
+        memcpy(&blocks, *cursor, sizeof(blocks));
+        *cursor += sizeof(blocks);
+        if (takeTables(cursor, end, &blocks, &r->blocks) != 0) return -1;
+    }
+    if (r->flags & ORDER_STORE_CRITERIA) {
+        uint64_t bytes;
+        if ((size_t)(end - *cursor) < sizeof(bytes)) return -1;
+        memcpy(&bytes, *cursor, sizeof(bytes));
+        *cursor += sizeof(bytes);
+        const char *key = takeBlock(cursor, end, bytes);
+        if (!key || key[bytes - 1] != '\0') return -1;
+        r->criteria_key = key;
+    }
+    return 0;
+}
+
+// Reads one played set; returns -1 if it does not fit the payload
+static int readPlayed(const unsigned char **cursor, const unsigned char *end, StoredPlayed *p) {
+    StorePlayedRecord rec;
+    if ((size_t)(end - *cursor) < sizeof(rec)) return -1;
+    memcpy(&rec, *cursor, sizeof(rec));
+    *cursor += sizeof(rec);
+    if (rec.word_count != ((uint64_t)rec.track_count + 63) / 64 ||
+        rec.word_count > (uint64_t)(end - *cursor) / sizeof(uint64_t)) {
+        return -1;
+    }
+    p->playlist = rec.playlist;
+    p->track_count = rec.track_count;
+    p->words = (const uint64_t *)takeBlock(cursor, end, rec.word_count * sizeof(uint64_t));
+    return rec.word_count && !p->words ? -1 : 0;
+}
+
+// Maps the file at path and calls visit for every record and visit_played,
+// which may be NULL, for every played set once the version and checksum
+// matched. The tables point into the mapping and are valid during the call
+// only. Files of older versions are read as well. Returns the number of
+// records visited, -1 if the file is missing, of a newer version or corrupt.
+int order_store_read(const char *path, void (*visit)(const StoredOrder *record, void *data),
+                     void (*visit_played)(const StoredPlayed *played, void *data), void *data) {
+    CHECK_NULL_RET(path, "Null path in order_store_read", -1);
+    CHECK_NULL_RET(visit, "Null visitor in order_store_read", -1);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(StoreHeader)) {
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    const unsigned char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        trace_error("Cannot map order file %s\n", path);
+        return -1;
+    }
+
+    StoreHeader header;
+    memcpy(&header, map, sizeof(header));
+    const unsigned char *cursor = map + sizeof(header);
+    const unsigned char *end = map + size;
+    int visited = -1;
+    if (memcmp(header.magic, STORE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version == 0 || header.version > STORE_VERSION ||
+        header.byte_order != STORE_BYTE_ORDER || header.payload_bytes != size - sizeof(header)) {
+        trace_warn("Order file %s has another version or size, ignoring it\n", path);
+    } else if (checksumUpdate(0xcbf29ce484222325ULL, cursor, (size_t)header.payload_bytes) != header.checksum) {
+        trace_warn("Order file %s is corrupt, ignoring it\n", path);
+    } else {
+        visited = 0;
+        for (uint32_t i = 0; i < header.record_count; i++) {
+            StoredOrder record;
+            if (readRecord(&cursor, end, &record) != 0) {
+                trace_warn("Malformed record %u in order file %s\n", i, path);
+                break;
+            }
+            visit(&record, data);
+            visited++;
+        }
+        for (uint32_t i = 0; visited == (int)header.record_count && i < header.played_count; i++) {
+            StoredPlayed played;
+            if (readPlayed(&cursor, end, &played) != 0) {
+                trace_warn("Malformed played set %u in order file %s\n", i, path);
+                break;
+            }
+            if (visit_played) visit_played(&played, data);
+        }
+    }
+    munmap((void *)map, size);
+    return visited;
+}
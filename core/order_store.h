@@ -0,0 +1,73 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    Binary file of saved orders and played tracks, so that orders, seeds,
+    cursors and the tracks random draws skip survive a restart. The file carries a version and a checksum and is replaced
+    atomically on writing; it is memory-mapped on reading and every table
+    is checked before it is handed out.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef ORDER_STORE_H
+#define ORDER_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "packed_order.h"
+
+// Flags of a stored order
+#define ORDER_STORE_LAZY 0x1        // Computed from lazy_seed, order is empty
+#define ORDER_STORE_SORTED 0x2      // Lazy order with shuffle off
+#define ORDER_STORE_SHUFFLED 0x4    // Stored order was shuffled
+#define ORDER_STORE_BLOCKS 0x8      // Album blocks follow the order
+#define ORDER_STORE_CRITERIA 0x10   // Facet key of a keep mode follows
+
+// One saved order as written to and read from the file
+typedef struct {
+    uint32_t playlist;          // Playlist identity
+    uint32_t play_mode;
+    uint32_t track_count;       // Playlist size when the order was saved
+    uint32_t flags;
+    int32_t cursor;             // Position in the order to resume at
+    uint64_t order_seed;
+    uint64_t fingerprint;       // Fingerprint of the playlist when the order was saved
+    uint64_t lazy_seed;         // Permutation seed of a lazy order
+    PackedOrder order;
+    PackedOrder blocks;         // ORDER_STORE_BLOCKS: order positions the album blocks start at
+    const char *criteria_key;   // ORDER_STORE_CRITERIA: facet key the keep mode matches
+} StoredOrder;
+
+// Tracks played in one playlist as written to and read from the file
+typedef struct {
+    uint32_t playlist;          // Playlist identity
+    uint32_t track_count;
+    const uint64_t *words;      // One bit per track, (track_count + 63) / 64 words
+} StoredPlayed;
+
+// Writes the records and played sets to path through a temporary file that
+// replaces it. Returns 0 on success, -1 on failure.
+int order_store_write(const char *path, const StoredOrder *records, size_t count,
+                      const StoredPlayed *played, size_t played_count);
+
+// Maps the file at path and calls visit for every record and visit_played,
+// which may be NULL, for every played set once the version and checksum
+// matched. The tables point into the mapping and are valid during the call
+// only. Files of older versions are read as well. Returns the number of
+// records visited, -1 if the file is missing, of a newer version or corrupt.
+int order_store_read(const char *path, void (*visit)(const StoredOrder *record, void *data),
+                     void (*visit_played)(const StoredPlayed *played, void *data), void *data);
+
+#endif
@@ -0,0 +1,487 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "packed_order.h"
+#include "trace.h"
+
+#define RANK_BLOCK_WORDS 8      // Bitset words counted by one rank entry
+#define DELTA_BLOCK 64          // Entries per delta block
+#define MAX_VARINT_BYTES 5      // Longest varint of a 32 bit gap
+
+// Bits needed to store values up to max, at least one
+static unsigned bitsFor(uint32_t max) {
+    unsigned width = 1;
+    while (width < 32 && (max >> width) != 0) width++;
+    return width;
+}
+
+// Length of a gap as LEB128 varint
+static size_t varintLength(uint32_t value) {
+    size_t length = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        length++;
+    }
+    return length;
+}
+
+// Reads a LEB128 varint and advances the cursor
+static uint32_t readVarint(const uint8_t **cursor) {
+    const uint8_t *c = *cursor;
+    uint32_t value = 0;
+    unsigned shift = 0;
+    do {
+        value |= (uint32_t)(*c & 0x7f) << shift;
+        shift += 7;
+    } while (*c++ & 0x80);
+    *cursor = c;
+    return value;
+}
+
+static uint8_t *writeVarint(uint8_t *out, uint32_t value) {
+    while (value >= 0x80) {
+        *out++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+static size_t bitsetWords(uint32_t universe) {
+    return ((size_t)universe + 63) / 64;
+}
+
+static size_t rankCount(uint32_t universe) {
+    return (bitsetWords(universe) + RANK_BLOCK_WORDS - 1) / RANK_BLOCK_WORDS;
+}
+
+static size_t packedWords(size_t count, unsigned width) {
+    return (count * width + 63) / 64;
+}
+
+static int encodeBitset(PackedOrder *p, const int *entries, size_t count) {
+    size_t words = bitsetWords(p->universe);
+    size_t ranks = rankCount(p->universe);
+    p->words = calloc(words ? words : 1, sizeof(uint64_t));
+    p->ranks = malloc((ranks ? ranks : 1) * sizeof(uint32_t));
+    if (!p->words || !p->ranks) return -1;
+    p->word_count = words;
+    p->rank_count = ranks;
+    for (size_t i = 0; i < count; i++) {
+        p->words[entries[i] >> 6] |= 1ULL << (entries[i] & 63);
+    }
+    uint32_t seen = 0;
+    for (size_t w = 0; w < words; w++) {
+        if (w % RANK_BLOCK_WORDS == 0) p->ranks[w / RANK_BLOCK_WORDS] = seen;
+        seen += (uint32_t)__builtin_popcountll(p->words[w]);
+    }
+    p->bytes = words * sizeof(uint64_t) + ranks * sizeof(uint32_t);
+    return 0;
+}
+
+static int encodeDelta(PackedOrder *p, const int *entries, size_t count, size_t gap_bytes) {
+    size_t blocks = (count + DELTA_BLOCK - 1) / DELTA_BLOCK;
+    p->gaps = malloc(gap_bytes ? gap_bytes : 1);
+    p->blocks = malloc((blocks ? blocks : 1) * 2 * sizeof(uint32_t));
+    if (!p->gaps || !p->blocks) return -1;
+    p->gap_bytes = gap_bytes;
+    p->block_count = blocks;
+    uint8_t *out = p->gaps;
+    for (size_t i = 0; i < count; i++) {
+        if (i % DELTA_BLOCK == 0) {
+            p->blocks[2 * (i / DELTA_BLOCK)] = (uint32_t)entries[i];
+            p->blocks[2 * (i / DELTA_BLOCK) + 1] = (uint32_t)(out - p->gaps);
+        } else {
+            out = writeVarint(out, (uint32_t)(entries[i] - entries[i - 1]));
+        }
+    }
+    p->bytes = gap_bytes + blocks * 2 * sizeof(uint32_t);
+    return 0;
+}
+
+static int encodeBits(PackedOrder *p, const int *entries, size_t count) {
+    size_t words = packedWords(count, p->width);
+    if (words == 0) return 0;
+    p->words = calloc(words, sizeof(uint64_t));
+    if (!p->words) return -1;
+    p->word_count = words;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t bit = (uint64_t)i * p->width;
+        size_t w = (size_t)(bit >> 6);
+        unsigned offset = (unsigned)(bit & 63);
+        uint64_t value = (uint64_t)(uint32_t)entries[i];
+        p->words[w] |= value << offset;
+        if (offset + p->width > 64) {
+            p->words[w + 1] |= value >> (64 - offset);
+        }
+    }
+    p->bytes = words * sizeof(uint64_t);
+    return 0;
+}
+
+// Stores count entries, all below universe, in the smallest encoding.
+// Returns 0 on success, -1 on allocation failure or negative entries.
+int packed_order_encode(PackedOrder *p, const int *entries, size_t count, uint32_t universe) {
+    CHECK_NULL_RET(p, "Null order in packed_order_encode", -1);
+    memset(p, 0, sizeof(*p));
+    if (count > 0 && !entries) return -1;
+
+    // One pass decides which encodings apply and what each costs
+    int ascending = 1;
+    int strict = 1;
+    uint32_t max = 0;
+    size_t gap_bytes = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (entries[i] < 0) {
+            trace_warn("Negative entry in packed_order_encode\n");
+            return -1;
+        }
+        if ((uint32_t)entries[i] > max) max = (uint32_t)entries[i];
+        if (i == 0) continue;
+        if (entries[i] < entries[i - 1]) {
+            ascending = 0;
+            strict = 0;
+        } else {
+            if (entries[i] == entries[i - 1]) strict = 0;
+            if (i % DELTA_BLOCK != 0) gap_bytes += varintLength((uint32_t)(entries[i] - entries[i - 1]));
+        }
+    }
+    if (count > 0 && max >= universe) universe = max + 1;
+    p->universe = universe;
+    p->count = count;
+    p->width = bitsFor(max);
+
+    size_t best = packedWords(count, p->width) * sizeof(uint64_t);
+    p->kind = PACKED_BITS;
+    if (ascending && count > 0) {
+        size_t delta = gap_bytes + (count + DELTA_BLOCK - 1) / DELTA_BLOCK * 2 * sizeof(uint32_t);
+        if (delta < best) {
+            best = delta;
+            p->kind = PACKED_DELTA;
+        }
+    }
+    if (strict && count > 0) {
+        size_t bitset = bitsetWords(universe) * sizeof(uint64_t) + rankCount(universe) * sizeof(uint32_t);
+        if (bitset < best) {
+            best = bitset;
+            p->kind = PACKED_BITSET;
+        }
+    }
+
+    int result;
+    switch (p->kind) {
+        case PACKED_BITSET: result = encodeBitset(p, entries, count); break;
+        case PACKED_DELTA:  result = encodeDelta(p, entries, count, gap_bytes); break;
+        default:            result = encodeBits(p, entries, count); break;
+    }
+    if (result != 0) {
+        trace_error("Memory allocation failed in packed_order_encode\n");
+        packed_order_free(p);
+        return -1;
+    }
+    return 0;
+}
+
+// Number of entries in the order
+size_t packed_order_length(const PackedOrder *p) {
+    return p ? p->count : 0;
+}
+
+static int bitsAt(const PackedOrder *p, size_t pos) {
+    uint64_t bit = (uint64_t)pos * p->width;
+    size_t w = (size_t)(bit >> 6);
+    unsigned offset = (unsigned)(bit & 63);
+    uint64_t value = p->words[w] >> offset;
+    if (offset + p->width > 64) {
+        value |= p->words[w + 1] << (64 - offset);
+    }
+    return (int)(value & ((1ULL << p->width) - 1));
+}
+
+// Finds the pos-th set bit: the rank table narrows it to one block
+static int bitsetAt(const PackedOrder *p, size_t pos) {
+    size_t lo = 0;
+    size_t hi = rankCount(p->universe);
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (p->ranks[mid] <= pos) lo = mid;
+        else hi = mid;
+    }
+    size_t remaining = pos - p->ranks[lo];
+    size_t words = bitsetWords(p->universe);
+    for (size_t w = lo * RANK_BLOCK_WORDS; w < words; w++) {
+        uint64_t word = p->words[w];
+        size_t ones = (size_t)__builtin_popcountll(word);
+        if (remaining < ones) {
+            while (remaining--) word &= word - 1;
+            return (int)(w * 64 + (size_t)__builtin_ctzll(word));
+        }
+        remaining -= ones;
+    }
+    return -1;
+}
+
+static int deltaAt(const PackedOrder *p, size_t pos) {
+    size_t block = pos / DELTA_BLOCK;
+    uint32_t value = p->blocks[2 * block];
+    const uint8_t *cursor = p->gaps + p->blocks[2 * block + 1];
+    for (size_t i = block * DELTA_BLOCK + 1; i <= pos; i++) {
+        value += readVarint(&cursor);
+    }
+    return (int)value;
+}
+
+// Entry at a position, -1 if out of range
+int packed_order_at(const PackedOrder *p, size_t pos) {
+    if (!p || pos >= p->count) return -1;
+    switch (p->kind) {
+        case PACKED_BITSET: return bitsetAt(p, pos);
+        case PACKED_DELTA:  return deltaAt(p, pos);
+        case PACKED_BITS:   return bitsAt(p, pos);
+        default:            return -1;
+    }
+}
+
+// Counts the set bits below an entry
+static int bitsetPositionOf(const PackedOrder *p, uint32_t entry) {
+    size_t w = entry >> 6;
+    uint64_t below = (1ULL << (entry & 63)) - 1;
+    if (!(p->words[w] & (1ULL << (entry & 63)))) return -1;
+    size_t rank = p->ranks[w / RANK_BLOCK_WORDS];
+    for (size_t i = w - w % RANK_BLOCK_WORDS; i < w; i++) {
+        rank += (size_t)__builtin_popcountll(p->words[i]);
+    }
+    return (int)(rank + (size_t)__builtin_popcountll(p->words[w] & below));
+}
+
+// Starts at the last block beginning below the entry, so a run of equal
+// entries is found at its first position
+static int deltaPositionOf(const PackedOrder *p, uint32_t entry) {
+    size_t blocks = (p->count + DELTA_BLOCK - 1) / DELTA_BLOCK;
+    size_t lo = 0;
+    size_t hi = blocks;
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (p->blocks[2 * mid] < entry) lo = mid;
+        else hi = mid;
+    }
+    uint32_t value = p->blocks[2 * lo];
+    const uint8_t *cursor = p->gaps + p->blocks[2 * lo + 1];
+    for (size_t pos = lo * DELTA_BLOCK; pos < p->count; ) {
+        if (value == entry) return (int)pos;
+        if (value > entry) return -1;
+        pos++;
+        if (pos % DELTA_BLOCK == 0) {
+            if (pos >= p->count) break;
+            value = p->blocks[2 * (pos / DELTA_BLOCK)];
+            cursor = p->gaps + p->blocks[2 * (pos / DELTA_BLOCK) + 1];
+        } else if (pos < p->count) {
+            value += readVarint(&cursor);
+        }
+    }
+    return -1;
+}
+
+// First position of an entry, -1 if it is not in the order
+int packed_order_position_of(const PackedOrder *p, int entry) {
+    if (!p || entry < 0 || p->count == 0 || (uint32_t)entry >= p->universe) return -1;
+    switch (p->kind) {
+        case PACKED_BITSET: return bitsetPositionOf(p, (uint32_t)entry);
+        case PACKED_DELTA:  return deltaPositionOf(p, (uint32_t)entry);
+        case PACKED_BITS:
+            for (size_t i = 0; i < p->count; i++) {
+                if (bitsAt(p, i) == entry) return (int)i;
+            }
+            return -1;
+        default:
+            return -1;
+    }
+}
+
+// Writes all entries to out, which holds packed_order_length() ints
+void packed_order_decode(const PackedOrder *p, int *out) {
+    if (!p || !out || p->count == 0) return;
+    switch (p->kind) {
+        case PACKED_BITSET: {
+            size_t n = 0;
+            size_t words = bitsetWords(p->universe);
+            for (size_t w = 0; w < words && n < p->count; w++) {
+                uint64_t word = p->words[w];
+                while (word) {
+                    out[n++] = (int)(w * 64 + (size_t)__builtin_ctzll(word));
+                    word &= word - 1;
+                }
+            }
+            break;
+        }
+        case PACKED_DELTA: {
+            const uint8_t *cursor = p->gaps;
+            uint32_t value = 0;
+            for (size_t i = 0; i < p->count; i++) {
+                value = i % DELTA_BLOCK == 0 ? p->blocks[2 * (i / DELTA_BLOCK)] : value + readVarint(&cursor);
+                out[i] = (int)value;
+            }
+            break;
+        }
+        case PACKED_BITS:
+            for (size_t i = 0; i < p->count; i++) {
+                out[i] = bitsAt(p, i);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// Reads a varint that has to end before end and fit 32 bits, as the
+// encoder writes them; -1 for anything else
+static int readCheckedVarint(const uint8_t **cursor, const uint8_t *end, uint32_t *value) {
+    const uint8_t *c = *cursor;
+    uint32_t v = 0;
+    for (unsigned i = 0; i < MAX_VARINT_BYTES; i++) {
+        if (c >= end) return -1;
+        uint8_t byte = *c++;
+        if (i == MAX_VARINT_BYTES - 1 && byte > 0x0f) return -1;
+        v |= (uint32_t)(byte & 0x7f) << (7 * i);
+        if (!(byte & 0x80)) {
+            *cursor = c;
+            *value = v;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Walks the gaps of every block within its own bytes, checking that the
+// entries ascend below the universe and every byte is used
+static int checkDelta(const PackedOrder *p) {
+    if (p->block_count != (p->count + DELTA_BLOCK - 1) / DELTA_BLOCK) return -1;
+    if (p->block_count > 0 && p->blocks[1] != 0) return -1;
+    uint32_t last = 0;
+    for (size_t b = 0; b < p->block_count; b++) {
+        size_t start = p->blocks[2 * b + 1];
+        size_t end = b + 1 < p->block_count ? p->blocks[2 * b + 3] : p->gap_bytes;
+        if (start > end || end > p->gap_bytes) return -1;
+        uint32_t value = p->blocks[2 * b];
+        if (value >= p->universe || (b > 0 && value < last)) return -1;
+        const uint8_t *cursor = p->gaps + start;
+        size_t entries = b + 1 < p->block_count ? DELTA_BLOCK : p->count - b * DELTA_BLOCK;
+        for (size_t i = 1; i < entries; i++) {
+            uint32_t gap;
+            if (readCheckedVarint(&cursor, p->gaps + end, &gap) != 0) return -1;
+            if (gap >= p->universe - value) return -1;
+            value += gap;
+        }
+        if (cursor != p->gaps + end) return -1;
+        last = value;
+    }
+    return 0;
+}
+
+// Checks that the set bits lie below the universe, number count and
+// agree with the rank table
+static int checkBitset(const PackedOrder *p) {
+    if (p->word_count != bitsetWords(p->universe) || p->rank_count != rankCount(p->universe)) return -1;
+    if (p->word_count > 0 && (p->universe & 63) &&
+        (p->words[p->word_count - 1] >> (p->universe & 63)) != 0) {
+        return -1;
+    }
+    size_t seen = 0;
+    for (size_t w = 0; w < p->word_count; w++) {
+        if (w % RANK_BLOCK_WORDS == 0 && p->ranks[w / RANK_BLOCK_WORDS] != seen) return -1;
+        seen += (size_t)__builtin_popcountll(p->words[w]);
+    }
+    return seen == p->count ? 0 : -1;
+}
+
+// Checks that the table sizes match the encoding and every entry can be
+// reached, e.g. for an order read from disk. Returns 0 if the order can be
+// read safely.
+int packed_order_check(const PackedOrder *p) {
+    CHECK_NULL_RET(p, "Null order in packed_order_check", -1);
+    switch (p->kind) {
+        case PACKED_NONE:
+            return p->count == 0 ? 0 : -1;
+        case PACKED_BITSET:
+            return checkBitset(p);
+        case PACKED_DELTA:
+            return checkDelta(p);
+        case PACKED_BITS:
+            if (p->width < 1 || p->width > 32) return -1;
+            if (p->word_count != packedWords(p->count, p->width)) return -1;
+            for (size_t i = 0; i < p->count; i++) {
+                if ((uint32_t)bitsAt(p, i) >= p->universe) return -1;
+            }
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+// Duplicates a table unless it is empty
+static void *copyTable(const void *src, size_t bytes, int *failed) {
+    if (!src || bytes == 0) return NULL;
+    void *dst = malloc(bytes);
+    if (!dst) {
+        *failed = 1;
+        return NULL;
+    }
+    memcpy(dst, src, bytes);
+    return dst;
+}
+
+// Copies an order, e.g. one whose tables point into a mapped file.
+// Returns 0 on success, -1 on allocation failure.
+int packed_order_copy(PackedOrder *dst, const PackedOrder *src) {
+    CHECK_NULL_RET(dst, "Null destination in packed_order_copy", -1);
+    CHECK_NULL_RET(src, "Null source in packed_order_copy", -1);
+    int failed = 0;
+    *dst = *src;
+    dst->words = copyTable(src->words, src->word_count * sizeof(uint64_t), &failed);
+    dst->ranks = copyTable(src->ranks, src->rank_count * sizeof(uint32_t), &failed);
+    dst->gaps = copyTable(src->gaps, src->gap_bytes, &failed);
+    dst->blocks = copyTable(src->blocks, src->block_count * 2 * sizeof(uint32_t), &failed);
+    if (failed) {
+        trace_error("Memory allocation failed in packed_order_copy\n");
+        packed_order_free(dst);
+        return -1;
+    }
+    return 0;
+}
+
+// Name of the encoding, for traces and statistics
+const char *packed_order_kind_name(const PackedOrder *p) {
+    switch (p ? p->kind : PACKED_NONE) {
+        case PACKED_BITSET: return "bitset";
+        case PACKED_DELTA:  return "delta";
+        case PACKED_BITS:   return "bits";
+        default:            return "none";
+    }
+}
+
+// Releases the order; it reads as empty afterwards
+void packed_order_free(PackedOrder *p) {
+    if (!p) return;
+    free(p->words);
+    free(p->ranks);
+    free(p->gaps);
+    free(p->blocks);
+    memset(p, 0, sizeof(*p));
+}
@@ -0,0 +1,85 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    Compact storage for orders that are kept but not navigated, such as
+    the saved orders of other playlists. Every order is stored in the
+    smallest of three encodings: a membership bitset for ascending orders
+    without repeats, varint gaps for other ascending orders, and indices
+    packed to the bit width of the largest one for anything else.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef PACKED_ORDER_H
+#define PACKED_ORDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    PACKED_NONE,        // Nothing stored; a zeroed order
+    PACKED_BITSET,      // Strictly ascending entries as bits over the playlist
+    PACKED_DELTA,       // Ascending entries as varint gaps in blocks
+    PACKED_BITS         // Entries of a fixed bit width
+} PackedKind;
+
+typedef struct {
+    PackedKind kind;
+    size_t count;           // Entries in the order
+    uint32_t universe;      // Entries are below this, usually the playlist size
+    unsigned width;         // PACKED_BITS: bits per entry
+    uint64_t *words;        // PACKED_BITSET bits or PACKED_BITS entries
+    uint32_t *ranks;        // PACKED_BITSET: set bits before every rank block
+    uint8_t *gaps;          // PACKED_DELTA: varint gaps after every block start
+    uint32_t *blocks;       // PACKED_DELTA: first entry and gap offset of every block
+    size_t word_count;
+    size_t rank_count;
+    size_t gap_bytes;
+    size_t block_count;     // Two uint32_t per block
+    size_t bytes;           // Heap memory held by the order
+} PackedOrder;
+
+// Stores count entries, all below universe, in the smallest encoding.
+// Returns 0 on success, -1 on allocation failure or negative entries.
+int packed_order_encode(PackedOrder *p, const int *entries, size_t count, uint32_t universe);
+
+// Number of entries in the order
+size_t packed_order_length(const PackedOrder *p);
+
+// Entry at a position, -1 if out of range
+int packed_order_at(const PackedOrder *p, size_t pos);
+
+// First position of an entry, -1 if it is not in the order
+int packed_order_position_of(const PackedOrder *p, int entry);
+
+// Writes all entries to out, which holds packed_order_length() ints
+void packed_order_decode(const PackedOrder *p, int *out);
+
+// Checks that the table sizes match the encoding and every entry can be
+// reached, e.g. for an order read from disk. Returns 0 if the order can be
+// read safely.
+int packed_order_check(const PackedOrder *p);
+
+// Copies an order, e.g. one whose tables point into a mapped file.
+// Returns 0 on success, -1 on allocation failure.
+int packed_order_copy(PackedOrder *dst, const PackedOrder *src);
+
+// Name of the encoding, for traces and statistics
+const char *packed_order_kind_name(const PackedOrder *p);
+
+// Releases the order; it reads as empty afterwards
+void packed_order_free(PackedOrder *p);
+
+#endif
@@ -0,0 +1,98 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <string.h>
+#include "permutation.h"
+
+// SplitMix64 step, used to derive round keys from the seed
+static uint64_t nextKey(uint64_t *x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Round function: mixes one half with the round key
+static uint64_t roundFunction(uint64_t half, uint64_t key) {
+    uint64_t z = half ^ key;
+    z = (z ^ (z >> 33)) * 0xff51afd7ed558ccdULL;
+    z = (z ^ (z >> 33)) * 0xc4ceb9fe1a85ec53ULL;
+    return z ^ (z >> 33);
+}
+
+// One pass of the network over [0, 4^half_bits)
+static uint64_t encrypt(const Permutation *p, uint64_t x) {
+    uint64_t left = x >> p->half_bits;
+    uint64_t right = x & p->half_mask;
+    for (int r = 0; r < PERMUTATION_ROUNDS; r++) {
+        uint64_t next = left ^ (roundFunction(right, p->keys[r]) & p->half_mask);
+        left = right;
+        right = next;
+    }
+    return (left << p->half_bits) | right;
+}
+
+// Undoes encrypt by running the rounds backwards
+static uint64_t decrypt(const Permutation *p, uint64_t x) {
+    uint64_t left = x >> p->half_bits;
+    uint64_t right = x & p->half_mask;
+    for (int r = PERMUTATION_ROUNDS - 1; r >= 0; r--) {
+        uint64_t previous = right ^ (roundFunction(left, p->keys[r]) & p->half_mask);
+        right = left;
+        left = previous;
+    }
+    return (left << p->half_bits) | right;
+}
+
+// Sets up a permutation of [0, count) determined by seed
+void permutation_init(Permutation *p, uint64_t count, uint64_t seed) {
+    memset(p, 0, sizeof(*p));
+    p->count = count;
+    p->seed = seed;
+    // The network covers 4^half_bits values, the smallest such range >= count
+    p->half_bits = 1;
+    while (p->half_bits < 32 && (1ULL << (2 * p->half_bits)) < count) {
+        p->half_bits++;
+    }
+    p->half_mask = (1ULL << p->half_bits) - 1;
+    uint64_t x = seed;
+    for (int r = 0; r < PERMUTATION_ROUNDS; r++) {
+        p->keys[r] = nextKey(&x);
+    }
+}
+
+// Maps a position to the permuted value; values outside [0, count) are
+// walked along their cycle until they land inside, at most ~4 steps on average
+uint64_t permutation_forward(const Permutation *p, uint64_t index) {
+    if (p->count <= 1 || index >= p->count) return index;
+    uint64_t x = encrypt(p, index);
+    while (x >= p->count) {
+        x = encrypt(p, x);
+    }
+    return x;
+}
+
+// Maps a permuted value back to its position
+uint64_t permutation_inverse(const Permutation *p, uint64_t value) {
+    if (p->count <= 1 || value >= p->count) return value;
+    uint64_t x = decrypt(p, value);
+    while (x >= p->count) {
+        x = decrypt(p, x);
+    }
+    return x;
+}
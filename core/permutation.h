@@ -0,0 +1,48 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    Seeded bijection over [0, n) built from a Feistel network with cycle
+    walking. Maps an order position to a track index and back in O(1)
+    without storing the order, so a shuffled order of any size costs a
+    few words of memory and is reproducible from its seed.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef PERMUTATION_H
+#define PERMUTATION_H
+
+#include <stdint.h>
+
+#define PERMUTATION_ROUNDS 6
+
+typedef struct {
+    uint64_t count;                     // Size of the permuted range
+    uint64_t seed;
+    unsigned half_bits;                 // Width of one Feistel half
+    uint64_t half_mask;
+    uint64_t keys[PERMUTATION_ROUNDS];  // Round keys derived from the seed
+} Permutation;
+
+// Sets up a permutation of [0, count) determined by seed
+void permutation_init(Permutation *p, uint64_t count, uint64_t seed);
+
+// Maps a position to the permuted value
+uint64_t permutation_forward(const Permutation *p, uint64_t index);
+
+// Maps a permuted value back to its position
+uint64_t permutation_inverse(const Permutation *p, uint64_t value);
+
+#endif
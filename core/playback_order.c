@@ -0,0 +1,3799 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    Based on Playback Order Plugin from Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include "playback_order.h"
+#include "block_order.h"
+#include "facet_index.h"
+#include "metrics.h"
+#include "order_cache.h"
+#include "order_store.h"
+#include "packed_order.h"
+#include "permutation.h"
+#include "played_set.h"
+#include "playlist_diff.h"
+#include "rng.h"
+#include "string_pool.h"
+#include "weighted_sampler.h"
+#include "trace.h"
+
+// Constants
+#define INITIAL_ARRAY_SIZE 1
+#define MAX_METADATA_LENGTH 2048
+#define SMART_RANDOM_MAX_REDRAWS 16
+#define CANCEL_CHECK_INTERVAL 4096  // Items a builder handles between cancellation checks
+#define CONF_INCREMENTAL_UPDATES "Incremental_Order_Updates_Enabled"
+#define CONF_LAZY_ORDER "Lazy_Random_Order_Enabled"
+#define CONF_SAVED_ORDERS_CACHE_KB "Saved_Orders_Cache_KB"
+#define DEFAULT_SAVED_ORDERS_CACHE_KB 65536
+#define CONF_CHANGE_QUIET_MS "Playlist_Change_Quiet_Ms"
+#define DEFAULT_CHANGE_QUIET_MS 250
+#define CONF_PERSIST_ORDERS "Persist_Orders_Enabled"
+#define CONF_TRACE_LEVEL "Trace_Level"
+#define CONF_LOOKAHEAD_TRACKS "Lookahead_Tracks"
+#define DEFAULT_LOOKAHEAD_TRACKS 1
+#define CONF_SKIP_PLAYED "Skip_Played_Tracks_Enabled"
+#define CONF_PLAYED_SETS_CACHE_KB "Played_Sets_Cache_KB"
+#define DEFAULT_PLAYED_SETS_CACHE_KB 1024
+#define LOOKAHEAD_MAX 64
+#define HISTORY_LENGTH 128          // Played tracks remembered per playlist
+#define HISTORY_PLAYLISTS 8         // Playlists that keep a history at once
+#define TRACE_FLUSH_MS 100
+#define PLAYLIST_IDENTITY_KEY "playback_buttons_id"
+#define ORDER_FILE_NAME "playback_buttons_orders.bin"
+#define FINGERPRINT_SAMPLES 16      // Tracks whose URIs go into a playlist fingerprint
+#define METRICS_EVENT_SLOTS 32      // Distinct DB_EV_* types with their own histogram
+
+// Column groups of a track snapshot; each is read on first use only
+#define TRACK_COLUMNS_RATING 0x1    // Rating, selected flag and duration
+#define TRACK_COLUMNS_KEYS 0x2      // URI hash and facet keys
+
+static pthread_mutex_t playlist_mutex;
+
+// Run-time costs of the engine and its host, updated without locking
+typedef struct {
+    uint64_t started_ns;
+    MetricsHistogram generate[KEEP_YEAR + 1];   // Completed builds per play mode
+    MetricsHistogram changes;                   // Applied playlist changes
+    uint32_t event_ids[METRICS_EVENT_SLOTS];    // DB_EV_* of every slot, 0 = free
+    MetricsHistogram events[METRICS_EVENT_SLOTS];
+    uint64_t events_dropped;                    // Events of types without a free slot
+    uint64_t reallocations;                     // Order and snapshot arrays grown
+} EngineMetrics;
+
+static EngineMetrics metrics;
+
+static void safe_strncpy(char *dest, const char *src, size_t dest_size) {
+    if (!dest || dest_size == 0) {
+        return;
+    }
+    
+    dest[0] = '\0';
+    
+    if (src) {
+        strncpy(dest, src, dest_size - 1);
+        dest[dest_size - 1] = '\0';
+    }
+}
+
+// Data structures
+typedef struct {
+    int *array;
+    size_t used;
+    size_t size;
+} Array;
+
+// Inverse of an order: the position of every track index in the Array
+typedef struct {
+    int *positions;
+    size_t size;
+} PositionIndex;
+
+// Order computed on demand from a seeded permutation instead of being
+// stored; used for PURE_RANDOM and shuffled PLAYLIST orders
+typedef struct {
+    int active;
+    int sorted;             // Shuffle is off, position k plays track k
+    Permutation perm;
+} LazyOrder;
+
+// Immutable order published to readers. Readers take a reference with
+// acquireOrder() and never lock; writers build a new one and swap it in.
+// With blocks, playlist holds the unshuffled order and the blocks give
+// the play order of its album runs.
+typedef struct {
+    int refcount;
+    Array playlist;
+    PositionIndex positions;
+    LazyOrder lazy;
+    BlockOrder blocks;
+} OrderSnapshot;
+
+// Tracks of a playlist as seen by the last build, in columns: the item
+// pointers, with a reference held on each so the identities stay unique
+// while they are remembered, and optionally the metadata the builders
+// need. Captured in one pl_lock hold and read afterwards without the lock.
+typedef struct {
+    DB_playItem_t **items;
+    size_t count;
+    int plt_id;
+    uint32_t playlist;          // Identity of the playlist
+    unsigned columns;           // TRACK_COLUMNS_* groups that are filled
+    int8_t *rating;             // TRACK_COLUMNS_RATING
+    uint8_t *selected;
+    float *duration;
+    uint64_t *uri_hash;         // TRACK_COLUMNS_KEYS
+    uint32_t *keys[FACET_COUNT];    // Interned album folder, artist, genre and year
+} TrackSnapshot;
+
+enum { RAW_KEY_URI, RAW_KEY_ARTIST, RAW_KEY_GENRE, RAW_KEY_YEAR, RAW_KEY_FIELDS };
+
+// Tag values the keys of some tracks are made from, copied under pl_lock
+// so that parsing, hashing and interning run after it is released
+typedef struct {
+    char *text;                 // The values, NUL terminated
+    size_t used;
+    size_t size;
+    size_t *tracks;             // Track index of every row
+    size_t (*fields)[RAW_KEY_FIELDS];   // Offset + 1 of each value, 0 = tag missing
+    size_t count;
+    size_t capacity;
+    int failed;                 // A value could not be stored
+} RawTrackKeys;
+
+typedef struct {
+    // Draft order, private to the writer holding playlist_mutex until it is
+    // published; the fields are moved into the snapshot on publishing
+    Array playlist;
+    PositionIndex positions;
+    LazyOrder lazy;
+    BlockOrder blocks;
+    int draft_cursor;
+    OrderSnapshot *published;   // Current order, swapped atomically
+    int readers;                // Readers between loading published and taking a reference
+    uint64_t generation;        // Bumped with every published order, accessed atomically
+    Rng rng;                    // Writer stream: order seeds, patches, reshuffles
+    Rng nav_rng;                // Navigation stream, so readers never touch rng
+    int rng_seeded;
+    uint64_t order_seed;    // Seed the current order was built from
+    Rng order_rng;          // Stream of the build in progress, from order_seed
+    int current_played_item;    // Cursor into the published order, accessed atomically
+    PlayModes play_mode;
+    int is_shuffled;
+    TrackSnapshot tracks;
+    StringPool names;           // Strings interned by the track columns
+    char criteria_key[MAX_METADATA_LENGTH];    // Facet key of the active keep mode
+    FacetIndex facets;          // Facets of the current playlist, guarded by playlist_mutex
+} PluginState;
+
+typedef struct {
+    PackedOrder order;      // Stored order in its most compact encoding
+    PackedOrder blocks;     // Order positions the album blocks start at, PACKED_NONE without blocks
+    LazyOrder lazy;
+    uint64_t order_seed;
+    PlayModes play_mode;
+    size_t track_count;     // Playlist size when the order was saved
+    uint64_t fingerprint;   // playlistFingerprint() when the order was saved
+    int cursor;             // Position in the order when it was saved
+    int is_shuffled;
+    char *criteria_key;     // Facet key of a keep mode, NULL = none
+} SavedPlaylist;
+
+static DB_functions_t *deadbeef = NULL;
+static playback_order_hooks_t hooks = { .order_empty = NULL };
+static PluginState state = { .current_played_item = 0, .play_mode = PLAYLIST, .tracks = { .plt_id = -1 } };
+// Saved orders keyed by playlist identity, guarded by playlist_mutex
+static OrderCache saved_playlists;
+// Counter new playlist identities are derived from, seeded from the clock.
+// It is apart from the order generators, which only builds may draw from.
+static uint64_t identity_counter;
+// Identity of the current playlist, taken when it is switched to or built
+// so that skips never take pl_lock to look it up; accessed atomically
+static uint32_t current_playlist;
+
+// Background builder. Requests are numbered by epoch; the worker always
+// builds for the newest one, and every request cancels the build in
+// progress, so a burst of requests costs a single finished build.
+// Playlist changes only mark the order dirty; they are applied once no
+// further change arrived for the quiet period.
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;        // A request arrived or the worker has to stop; on the monotonic clock
+    pthread_cond_t done;        // A request was handled
+    int running;
+    int stop;
+    uint64_t requested;         // Epoch of the newest request
+    uint64_t handled;           // Newest epoch a build has finished for
+    uint64_t cancel;            // Bumped to cancel the build in progress, accessed atomically
+    uint64_t changed;           // Playlist changes reported
+    uint64_t patched;           // Playlist changes applied to the order
+    int change_plt;             // Playlist of the newest change
+    struct timespec quiet_until;    // Changes are applied once this passes without a new one
+    uint64_t requests;          // Build requests and playlist changes received
+    uint64_t coalesced;         // Requests served by the pass of a later one
+    uint64_t passes;            // Builds and change updates the worker ran
+    uint64_t cancelled;         // Builds abandoned for a newer request, accessed atomically
+} BuildWorker;
+
+static BuildWorker worker = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+typedef struct {
+    DB_playItem_t *item;        // Referenced while it is in the window
+    int cursor;                 // Order position of the track
+    int track;                  // Track index
+    uint32_t drawn;             // Playlist the track was drawn unplayed from, 0 = not drawn
+    int past;                   // History entry the track replays, -1 = from the order
+} QueuedTrack;
+
+// Next tracks of the order, kept in the playqueue while the current one
+// plays so the streamer preloads them and continues with them as tracks
+// end. Tracks the user queued stay in front of them.
+typedef struct {
+    pthread_mutex_t mutex;
+    QueuedTrack tracks[LOOKAHEAD_MAX];  // In play order
+    int count;
+    int from;                   // Cursor the first track follows
+    QueuedTrack taken;          // Former head the streamer took ahead of playing it, item NULL = none
+    int taken_after;            // Cursor the taken track follows
+    uint64_t generation;        // Published order the tracks come from
+    uint64_t batches;           // Top-ups that queued tracks
+} Lookahead;
+
+static Lookahead ahead = { .mutex = PTHREAD_MUTEX_INITIALIZER, .from = -1 };
+
+// Tracks played in every playlist, kept across sessions, so that random
+// draws skip them until every track of the order was played. An order
+// holding only part of the playlist gets a set of its played positions,
+// taken from the tracks on the first draw. Guarded by ahead.mutex.
+typedef struct {
+    int enabled;                // CONF_SKIP_PLAYED as of the last config change, accessed atomically
+    OrderCache sets;            // PlayedSet of every playlist by identity
+    PlayedSet *current;         // Set of the current playlist, owned by sets
+    uint32_t playlist;          // Identity of the current playlist
+    PlayedSet positions;        // Played positions of a partial order
+    uint64_t generation;        // Published order of the positions, 0 = none
+    uint64_t draws;             // Draws that skipped played tracks
+    uint64_t rounds;            // Sets cleared once all tracks of the order played
+} PlayedTracks;
+
+static PlayedTracks played;
+
+// Tracks that actually played in one playlist in a fixed ring, so that
+// appending never allocates. Entries are counted back from the newest.
+typedef struct {
+    DB_playItem_t *items[HISTORY_LENGTH];   // Referenced while remembered
+    int cursors[HISTORY_LENGTH];            // Order position each entry played at
+    uint32_t playlist;          // Identity, 0 = unused
+    uint64_t used;              // Last use; the least recent ring is reused
+    int newest;                 // Slot of the newest entry
+    int count;
+    int back;                   // Entry that plays
+    int pending;                // Entry PREV went to, count = one before the oldest, -1 = none
+} HistoryRing;
+
+// Histories of the playlists played last. PREV walks back through the
+// history of the current playlist and NEXT forward again before the order
+// resumes after the newest entry. Guarded by ahead.mutex.
+typedef struct {
+    HistoryRing rings[HISTORY_PLAYLISTS];
+    HistoryRing *current;       // Ring of the current playlist
+    uint64_t clock;
+    uint64_t replays;           // Tracks played again from a history
+} PlaybackHistory;
+
+static PlaybackHistory history;
+
+// Thread-lokale Variable für Race-Condition-Prävention
+static __thread DB_playItem_t *thread_last_played = NULL;
+// Build running on this thread and the cancel counter it started with
+static __thread int build_active = 0;
+static __thread uint64_t build_cancel_mark = 0;
+
+// Whether the build on this thread was cancelled since it started
+static int buildCancelled(void) {
+    return build_active && __atomic_load_n(&worker.cancel, __ATOMIC_ACQUIRE) != build_cancel_mark;
+}
+
+// Cancels the build in progress, if any; it stops at its next check
+static void cancelBuild(void) {
+    __atomic_add_fetch(&worker.cancel, 1, __ATOMIC_ACQ_REL);
+}
+
+// Locks mutex with error handling
+static int lock_mutex(pthread_mutex_t *mutex, const char *func_name) {
+    if (!mutex) {
+        trace_error("NULL mutex in %s\n", func_name);
+        return EINVAL;
+    }
+    
+    int result = pthread_mutex_lock(mutex);
+    if (result != 0) {
+        const char *error_str = "Unknown error";
+        switch (result) {
+            case EINVAL: error_str = "Invalid mutex"; break;
+            case EDEADLK: error_str = "Deadlock detected"; break;
+            case EAGAIN: error_str = "Maximum recursion exceeded"; break;
+        }
+        trace_error("Failed to lock mutex in %s: %s (%d)\n", func_name, error_str, result);
+    }
+    return result;
+}
+
+// Unlocks mutex with error handling
+static int unlock_mutex(pthread_mutex_t *mutex, const char *func_name) {
+    if (!mutex) {
+        trace_error("NULL mutex in %s\n", func_name);
+        return EINVAL;
+    }
+    
+    int result = pthread_mutex_unlock(mutex);
+    if (result != 0) {
+        const char *error_str = "Unknown error";
+        switch (result) {
+            case EINVAL: error_str = "Invalid mutex"; break;
+            case EPERM: error_str = "Thread doesn't own mutex"; break;
+        }
+        trace_error("Failed to unlock mutex in %s: %s (%d)\n", func_name, error_str, result);
+    }
+    return result;
+}
+
+// Frees the array memory. Arrays are either private to the writer or part
+// of a published snapshot that is never modified, so no locking is needed.
+static int freeArray(Array *a) {
+    CHECK_NULL_RET(a, "Null pointer passed to freeArray", -1);
+    if (a->array) {
+        free(a->array);
+        a->array = NULL;
+        a->used = a->size = 0;
+    }
+    return 0;
+}
+
+// Initializes a dynamic array
+static int initArray(Array *a, size_t initialSize) {
+    CHECK_NULL_RET(a, "Null pointer passed to initArray", -1);
+    a->array = malloc(initialSize * sizeof(int));
+    if (!a->array) {
+        trace_error("Memory allocation failed in initArray\n");
+        return -1;
+    }
+    memset(a->array, 0, initialSize * sizeof(int));
+    a->used = 0;
+    a->size = initialSize;
+    return 0;
+}
+
+// Grows the array so it holds at least capacity elements without reallocating
+static int reserveArray(Array *a, size_t capacity) {
+    CHECK_NULL_RET(a, "Null pointer passed to reserveArray", -1);
+    if (capacity <= a->size) return 0;
+    if (capacity > SIZE_MAX / sizeof(int)) {
+        trace_error("Array size overflow in reserveArray\n");
+        return -1;
+    }
+    int *newArray = realloc(a->array, capacity * sizeof(int));
+    if (!newArray) {
+        trace_error("Memory reallocation failed in reserveArray\n");
+        return -1;
+    }
+    __atomic_add_fetch(&metrics.reallocations, 1, __ATOMIC_RELAXED);
+    a->array = newArray;
+    a->size = capacity;
+    return 0;
+}
+
+// Inserts an element into the dynamic array with optimized resizing
+static int insertArray(Array *a, int element) {
+    CHECK_NULL_RET(a, "Null pointer passed to insertArray", -1);
+    
+    if (a->used == a->size) {
+        size_t new_size = (a->size < 1000) ? a->size * 2 + 1 : a->size + a->size / 2 + 1;
+        if (reserveArray(a, new_size) != 0) {
+            return -1;
+        }
+    }
+    a->array[a->used++] = element;
+    return 0;
+}
+
+// Appends count elements with a single copy
+static int appendArray(Array *a, const int *elements, size_t count) {
+    CHECK_NULL_RET(a, "Null pointer passed to appendArray", -1);
+    if (count == 0) return 0;
+    if (count > SIZE_MAX / sizeof(int) - a->used) {
+        trace_error("Array size overflow in appendArray\n");
+        return -1;
+    }
+    if (reserveArray(a, a->used + count) != 0) {
+        return -1;
+    }
+    memcpy(a->array + a->used, elements, count * sizeof(int));
+    a->used += count;
+    return 0;
+}
+
+// Replaces dst with a copy of src sized to its contents
+static int cloneArray(Array *dst, const Array *src) {
+    CHECK_NULL_RET(dst, "Null destination passed to cloneArray", -1);
+    CHECK_NULL_RET(src, "Null source passed to cloneArray", -1);
+    freeArray(dst);
+    if (initArray(dst, src->used > 0 ? src->used : INITIAL_ARRAY_SIZE) != 0) {
+        return -1;
+    }
+    return appendArray(dst, src->array, src->used);
+}
+
+// Exchanges the contents of two arrays; moving an array into an empty one
+// hands over its buffer without copying
+static void swapArray(Array *a, Array *b) {
+    Array temp = *a;
+    *a = *b;
+    *b = temp;
+}
+
+// Performs an operation on a writer-private array
+static int performPlaylistOperation(Array *a, int (*operation)(Array *, void *), void *data) {
+    CHECK_NULL_RET(a, "Null array in performPlaylistOperation", -1);
+    return operation(a, data);
+}
+
+// Frees the position index
+static void freePositionIndex(PositionIndex *p) {
+    free(p->positions);
+    p->positions = NULL;
+    p->size = 0;
+}
+
+// Makes sure the index covers track indices below count; new slots are -1
+static int reservePositionIndex(PositionIndex *p, size_t count) {
+    if (count <= p->size) return 0;
+    size_t new_size = (count > p->size * 2) ? count : p->size * 2;
+    if (new_size > SIZE_MAX / sizeof(int)) {
+        trace_error("Position index size overflow\n");
+        return -1;
+    }
+    int *grown = realloc(p->positions, new_size * sizeof(int));
+    if (!grown) {
+        trace_error("Memory reallocation failed in reservePositionIndex\n");
+        return -1;
+    }
+    __atomic_add_fetch(&metrics.reallocations, 1, __ATOMIC_RELAXED);
+    memset(grown + p->size, 0xff, (new_size - p->size) * sizeof(int));
+    p->positions = grown;
+    p->size = new_size;
+    return 0;
+}
+
+// Forgets all positions and sizes the index for count tracks
+static int clearPositionIndex(PositionIndex *p, size_t count) {
+    if (p->positions) {
+        memset(p->positions, 0xff, p->size * sizeof(int));
+    }
+    return reservePositionIndex(p, count);
+}
+
+// Records the order position of a track
+static void setPosition(PositionIndex *p, int track, int pos) {
+    if (track < 0) return;
+    if ((size_t)track >= p->size && reservePositionIndex(p, (size_t)track + 1) != 0) return;
+    p->positions[track] = pos;
+}
+
+// Rebuilds the index from the whole order, after it was shuffled or sorted
+static void rebuildPositionIndex(PositionIndex *p, const Array *a) {
+    clearPositionIndex(p, p->size);
+    for (size_t i = 0; i < a->used; i++) {
+        setPosition(p, a->array[i], (int)i);
+    }
+}
+
+// Looks up the order position of a track, -1 if it is not in the order
+static int lookupPosition(const PositionIndex *p, const Array *a, int track) {
+    if (track < 0 || (size_t)track >= p->size || !a->array) return -1;
+    int pos = p->positions[track];
+    if (pos < 0 || (size_t)pos >= a->used || a->array[pos] != track) return -1;
+    return pos;
+}
+
+// Frees a snapshot and its order
+static void freeSnapshot(OrderSnapshot *snap) {
+    freeArray(&snap->playlist);
+    freePositionIndex(&snap->positions);
+    block_order_free(&snap->blocks);
+    free(snap);
+}
+
+// Takes a reference to the published order, NULL if there is none. Readers
+// announce themselves first, so a writer never frees a snapshot between the
+// load and the reference count increment.
+static OrderSnapshot *acquireOrder(void) {
+    __atomic_add_fetch(&state.readers, 1, __ATOMIC_SEQ_CST);
+    OrderSnapshot *snap = __atomic_load_n(&state.published, __ATOMIC_SEQ_CST);
+    if (snap) {
+        __atomic_add_fetch(&snap->refcount, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_sub_fetch(&state.readers, 1, __ATOMIC_RELEASE);
+    return snap;
+}
+
+// Drops a reference taken with acquireOrder()
+static void releaseOrder(OrderSnapshot *snap) {
+    if (snap && __atomic_sub_fetch(&snap->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        freeSnapshot(snap);
+    }
+}
+
+// Swaps in a new published order and drops the old one once no reader can
+// still be on its way to taking a reference
+static void swapPublished(OrderSnapshot *snap) {
+    OrderSnapshot *old = __atomic_exchange_n(&state.published, snap, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&state.generation, 1, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&state.readers, __ATOMIC_ACQUIRE) != 0) {
+        sched_yield();
+    }
+    releaseOrder(old);
+}
+
+// Moves the draft into a new snapshot and publishes it with the draft cursor
+static int publishDraft(void) {
+    OrderSnapshot *snap = calloc(1, sizeof(OrderSnapshot));
+    if (!snap) {
+        trace_error("Memory allocation failed in publishDraft\n");
+        return -1;
+    }
+    snap->refcount = 1;
+    swapArray(&snap->playlist, &state.playlist);
+    snap->positions = state.positions;
+    snap->lazy = state.lazy;
+    snap->blocks = state.blocks;
+    memset(&state.positions, 0, sizeof(state.positions));
+    memset(&state.blocks, 0, sizeof(state.blocks));
+    state.lazy.active = 0;
+    swapPublished(snap);
+    __atomic_store_n(&state.current_played_item, state.draft_cursor, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Copies the published order into the draft so a writer can edit it
+static int copyPublishedToDraft(void) {
+    freeArray(&state.playlist);
+    freePositionIndex(&state.positions);
+    block_order_free(&state.blocks);
+    state.lazy.active = 0;
+    state.draft_cursor = __atomic_load_n(&state.current_played_item, __ATOMIC_ACQUIRE);
+
+    OrderSnapshot *snap = acquireOrder();
+    if (!snap) return 0;
+    int result = 0;
+    state.lazy = snap->lazy;
+    if (snap->playlist.array) {
+        if (cloneArray(&state.playlist, &snap->playlist) != 0 || block_order_copy(&state.blocks, &snap->blocks) != 0) {
+            result = -1;
+        } else if (reservePositionIndex(&state.positions, snap->positions.size) == 0 && snap->positions.size > 0) {
+            memcpy(state.positions.positions, snap->positions.positions, snap->positions.size * sizeof(int));
+        }
+    }
+    releaseOrder(snap);
+    return result;
+}
+
+// Number of entries in an order
+static size_t orderLength(const OrderSnapshot *snap) {
+    if (!snap) return 0;
+    return snap->lazy.active ? (size_t)snap->lazy.perm.count : snap->playlist.used;
+}
+
+// Track index at a position of an order, -1 if out of range
+static int orderTrackAt(const OrderSnapshot *snap, size_t pos) {
+    if (!snap) return -1;
+    if (snap->lazy.active) {
+        if (pos >= snap->lazy.perm.count) return -1;
+        return snap->lazy.sorted ? (int)pos : (int)permutation_forward(&snap->lazy.perm, pos);
+    }
+    if (!snap->playlist.array || pos >= snap->playlist.used) return -1;
+    if (snap->blocks.count) pos = block_order_base(&snap->blocks, pos);
+    return snap->playlist.array[pos];
+}
+
+// Position of a track in an order, -1 if it is not in the order
+static int orderPositionOf(const OrderSnapshot *snap, int track) {
+    if (!snap) return -1;
+    if (snap->lazy.active) {
+        if (track < 0 || (uint64_t)track >= snap->lazy.perm.count) return -1;
+        return snap->lazy.sorted ? track : (int)permutation_inverse(&snap->lazy.perm, (uint64_t)track);
+    }
+    int pos = lookupPosition(&snap->positions, &snap->playlist, track);
+    if (pos >= 0 && snap->blocks.count) pos = (int)block_order_position(&snap->blocks, (size_t)pos);
+    return pos;
+}
+
+// Shuffles the array using Fisher-Yates algorithm, drawing from the Rng in data
+static int shuffleArrayOperation(Array *a, void *data) {
+    Rng *rng = data;
+    if (!a->array || a->used == 0) {
+        trace_warn("Empty or invalid array in shuffleArray\n");
+        return -1;
+    }
+    if (a->used > a->size) {
+        trace_error("Array inconsistency detected: used (%zu) > size (%zu)\n", a->used, a->size);
+        return -1;
+    }
+    if (a->used <= 1) return 0;
+
+    for (size_t i = a->used - 1; i > 0; i--) {
+        size_t j = (size_t)rng_bounded(rng, (uint64_t)i + 1);
+        int temp = a->array[i];
+        a->array[i] = a->array[j];
+        a->array[j] = temp;
+    }
+    return 0;
+}
+
+// Comparison function for sorting array
+static int sortArray(const void *a, const void *b) {
+    int int_a = *(const int *)a;
+    int int_b = *(const int *)b;
+    return (int_a > int_b) - (int_a < int_b);
+}
+
+// Checks whether the order is ascending
+static int isSortedArray(const Array *a) {
+    for (size_t i = 1; i < a->used; i++) {
+        if (a->array[i - 1] > a->array[i]) return 0;
+    }
+    return 1;
+}
+
+// Resets the playlist to initial state with pre-allocation
+static int resetPlaylist(Array *a) {
+    if (freeArray(a) != 0) {
+        trace_error("Failed to free playlist array\n");
+        return -1;
+    }
+    size_t initialSize = INITIAL_ARRAY_SIZE;
+    if (deadbeef) {
+        int count = deadbeef->pl_getcount(PL_MAIN);
+        initialSize = (count > 0) ? count : INITIAL_ARRAY_SIZE;
+    }
+    return initArray(a, initialSize);
+}
+
+// Applies shuffle based on mode. Album shuffle leaves the order sorted and
+// shuffles the runs of tracks with the same album key as blocks instead;
+// without keys it falls back to shuffling tracks.
+static void applyShuffle(Array *a, PositionIndex *index, BlockOrder *blocks, const uint32_t *albums, Rng *rng,
+                         int shuffle_mode, PlayModes play_mode, int *currentItem) {
+    CHECK_NULL(a, "Invalid array in applyShuffle");
+    CHECK_NULL(currentItem, "Invalid currentItem in applyShuffle");
+    
+    if (a->used <= 1) return;
+    
+    if (*currentItem < 0 || *currentItem >= (int)a->used) {
+        trace_error("Invalid currentItem index %d in applyShuffle\n", *currentItem);
+        *currentItem = 0;
+        return;
+    }
+    
+    // SMART_RANDOM draws are already in random order, and reshuffling them
+    // could put two draws of the same track next to each other
+    if (play_mode == SMART_RANDOM) return;
+
+    if (shuffle_mode == DDB_SHUFFLE_ALBUMS && play_mode != PURE_RANDOM && albums) {
+        int value = a->array[*currentItem];
+        if (!isSortedArray(a)) {
+            qsort(a->array, a->used, sizeof(int), sortArray);
+            rebuildPositionIndex(index, a);
+        }
+        if (block_order_build(blocks, a->array, a->used, albums) == 0) {
+            block_order_shuffle(blocks, rng);
+            int pos = lookupPosition(index, a, value);
+            if (pos >= 0) {
+                *currentItem = (int)block_order_position(blocks, (size_t)pos);
+            }
+            return;
+        }
+    }
+    if (shuffle_mode != DDB_SHUFFLE_OFF || play_mode == PURE_RANDOM) {
+        int value = a->array[*currentItem];
+        performPlaylistOperation(a, shuffleArrayOperation, rng);
+        rebuildPositionIndex(index, a);
+        int pos = lookupPosition(index, a, value);
+        if (pos >= 0) {
+            *currentItem = pos;
+        }
+    }
+}
+
+// Seeds the engine generator from the clock, unless a seed was set
+static void init_random_seed(void) {
+    if (state.rng_seeded) return;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    rng_seed(&state.rng, ((uint64_t)now.tv_sec << 32) ^ (uint64_t)now.tv_nsec);
+    rng_seed(&state.nav_rng, rng_next(&state.rng));
+    state.rng_seeded = 1;
+}
+
+// Frees the metadata columns of a track snapshot, keeping the items
+static void freeTrackColumns(TrackSnapshot *snap) {
+    free(snap->rating);
+    free(snap->selected);
+    free(snap->duration);
+    free(snap->uri_hash);
+    snap->rating = NULL;
+    snap->selected = NULL;
+    snap->duration = NULL;
+    snap->uri_hash = NULL;
+    for (int f = 0; f < FACET_COUNT; f++) {
+        free(snap->keys[f]);
+        snap->keys[f] = NULL;
+    }
+    snap->columns = 0;
+}
+
+// Frees copied key values
+static void freeRawTrackKeys(RawTrackKeys *raw) {
+    free(raw->text);
+    free(raw->tracks);
+    free(raw->fields);
+    memset(raw, 0, sizeof(*raw));
+}
+
+// Releases the references held by a track snapshot
+static void releaseTrackSnapshot(TrackSnapshot *snap) {
+    if (snap->items && deadbeef) {
+        for (size_t i = 0; i < snap->count; i++) {
+            deadbeef->pl_item_unref(snap->items[i]);
+        }
+    }
+    free(snap->items);
+    freeTrackColumns(snap);
+    snap->items = NULL;
+    snap->count = 0;
+    snap->plt_id = -1;
+    snap->playlist = 0;
+}
+
+// Records the item pointers of a playlist; call with pl_lock held
+static int captureTrackSnapshot(TrackSnapshot *snap, ddb_playlist_t *plt, int plt_id) {
+    int count = deadbeef->pl_getcount(PL_MAIN);
+    size_t capacity = count > 0 ? (size_t)count : INITIAL_ARRAY_SIZE;
+    snap->items = malloc(capacity * sizeof(DB_playItem_t *));
+    snap->count = 0;
+    snap->plt_id = -1;
+    if (!snap->items) {
+        trace_error("Memory allocation failed in captureTrackSnapshot\n");
+        return -1;
+    }
+
+    DB_playItem_t *it = deadbeef->plt_get_first(plt, PL_MAIN);
+    while (it) {
+        if (snap->count == capacity) {
+            DB_playItem_t **grown = realloc(snap->items, capacity * 2 * sizeof(DB_playItem_t *));
+            if (!grown) {
+                trace_error("Memory reallocation failed in captureTrackSnapshot\n");
+                deadbeef->pl_item_unref(it);
+                releaseTrackSnapshot(snap);
+                return -1;
+            }
+            snap->items = grown;
+            capacity *= 2;
+            __atomic_add_fetch(&metrics.reallocations, 1, __ATOMIC_RELAXED);
+        }
+        // The iterator's reference is kept by the snapshot
+        snap->items[snap->count++] = it;
+        it = deadbeef->pl_get_next(it, PL_MAIN);
+    }
+    snap->plt_id = plt_id;
+    return 0;
+}
+
+// Ring slot of a history entry
+static int historySlot(const HistoryRing *ring, int back) {
+    return (ring->newest - back + HISTORY_LENGTH) % HISTORY_LENGTH;
+}
+
+// Entry of a history counted back from the newest one
+static DB_playItem_t *historyAt(const HistoryRing *ring, int back) {
+    return ring->items[historySlot(ring, back)];
+}
+
+// Releases the entries of a history; call with ahead.mutex held
+static void clearHistory(HistoryRing *ring) {
+    for (int i = 0; i < ring->count; i++) {
+        deadbeef->pl_item_unref(historyAt(ring, i));
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->pending = -1;
+}
+
+// Cleans up global resources
+static void cleanup(void) {
+    int lock_result = pthread_mutex_trylock(&playlist_mutex);
+    int was_locked = (lock_result == 0);
+    
+    // Free saved playlists
+    order_cache_free(&saved_playlists);
+    pthread_mutex_lock(&ahead.mutex);
+    order_cache_free(&played.sets);
+    played_set_free(&played.positions);
+    played.current = NULL;
+    played.playlist = 0;
+    played.generation = 0;
+    for (int i = 0; i < HISTORY_PLAYLISTS; i++) {
+        clearHistory(&history.rings[i]);
+    }
+    history.current = NULL;
+    pthread_mutex_unlock(&ahead.mutex);
+    
+    // State cleanup
+    freeArray(&state.playlist);
+    freePositionIndex(&state.positions);
+    block_order_free(&state.blocks);
+    state.lazy.active = 0;
+    swapPublished(NULL);
+    releaseTrackSnapshot(&state.tracks);
+    string_pool_free(&state.names);
+    facet_index_free(&state.facets);
+    
+    if (was_locked) {
+        unlock_mutex(&playlist_mutex, "cleanup");
+    }
+    
+    pthread_mutex_destroy(&playlist_mutex);
+    
+    trace_info("Cleanup completed (mutex %s)\n", was_locked ? "locked" : "not locked");
+}
+
+// Returns an identity for a playlist that survives reordering, insertion
+// and removal of other playlists; it is assigned once and kept in the
+// playlist metadata. Returns 0 if the playlist does not exist.
+static uint32_t playlistIdentity(int plt_id) {
+    ddb_playlist_t *plt = deadbeef->plt_get_for_idx(plt_id);
+    if (!plt) return 0;
+    deadbeef->pl_lock();
+    int id = deadbeef->plt_find_meta_int(plt, PLAYLIST_IDENTITY_KEY, 0);
+    if (id <= 0) {
+        Rng mix;
+        rng_seed(&mix, __atomic_add_fetch(&identity_counter, 1, __ATOMIC_RELAXED));
+        id = (int)((rng_next(&mix) & 0x7fffffff) | 1);
+        deadbeef->plt_set_meta_int(plt, PLAYLIST_IDENTITY_KEY, id);
+    }
+    deadbeef->pl_unlock();
+    deadbeef->plt_unref(plt);
+    return (uint32_t)id;
+}
+
+// Takes the identity of the playlist that became current, minting one if
+// needed, for the navigation path to use without taking pl_lock
+static uint32_t adoptCurrentPlaylist(int plt_id) {
+    uint32_t playlist = playlistIdentity(plt_id);
+    __atomic_store_n(&current_playlist, playlist, __ATOMIC_RELEASE);
+    return playlist;
+}
+
+// Identity a playlist already has, 0 if it has none yet or does not
+// exist; unlike playlistIdentity it never writes playlist metadata
+static uint32_t findPlaylistIdentity(int plt_id) {
+    ddb_playlist_t *plt = deadbeef->plt_get_for_idx(plt_id);
+    if (!plt) return 0;
+    deadbeef->pl_lock();
+    int id = deadbeef->plt_find_meta_int(plt, PLAYLIST_IDENTITY_KEY, 0);
+    deadbeef->pl_unlock();
+    deadbeef->plt_unref(plt);
+    return id > 0 ? (uint32_t)id : 0;
+}
+
+// Releases a played set evicted from or replaced in the cache
+static void freePlayedSet(void *value) {
+    played_set_free(value);
+    free(value);
+}
+
+// Byte ceiling of the played set cache from the configuration
+static size_t playedSetsBudget(void) {
+    int kb = deadbeef->conf_get_int(CONF_PLAYED_SETS_CACHE_KB, DEFAULT_PLAYED_SETS_CACHE_KB);
+    return kb > 0 ? (size_t)kb * 1024 : 0;
+}
+
+// Whether the current mode draws at random and skips played tracks;
+// SMART_RANDOM weights its draws instead
+static int skipsPlayed(void) {
+    if (!__atomic_load_n(&played.enabled, __ATOMIC_ACQUIRE)) return 0;
+    PlayModes mode = __atomic_load_n(&state.play_mode, __ATOMIC_ACQUIRE);
+    if (mode == SMART_RANDOM) return 0;
+    return mode == PURE_RANDOM || deadbeef->streamer_get_shuffle() == DDB_SHUFFLE_RANDOM;
+}
+
+// Played set of the current playlist, sized to its tracks; NULL if there
+// is none. Call with ahead.mutex held.
+static PlayedSet *currentPlayedSet(void) {
+    uint32_t playlist = __atomic_load_n(&current_playlist, __ATOMIC_ACQUIRE);
+    if (!playlist) return NULL;
+    int count = deadbeef->pl_getcount(PL_MAIN);
+    size_t tracks = count > 0 ? (size_t)count : 0;
+    if (playlist != played.playlist || !played.current) {
+        played.current = order_cache_get(&played.sets, playlist);
+        played.playlist = playlist;
+        played.generation = 0;
+    }
+    if (!played.current) {
+        PlayedSet *set = malloc(sizeof(PlayedSet));
+        if (!set || played_set_init(set, tracks) != 0) {
+            trace_error("Failed to create the played set\n");
+            free(set);
+            return NULL;
+        }
+        if (order_cache_put(&played.sets, playlist, set, sizeof(PlayedSet) + played_set_bytes(set)) != 0) {
+            freePlayedSet(set);
+            return NULL;
+        }
+        played.current = set;
+    }
+    if (played.current->count != tracks) {
+        // Tracks keep their bits by index; edits that are applied as a
+        // patch move the bits along with their tracks
+        if (played_set_resize(played.current, tracks) != 0) return NULL;
+        played.generation = 0;
+        // Stored again so the cache accounts for the new size
+        if (order_cache_put(&played.sets, playlist, played.current,
+                            sizeof(PlayedSet) + played_set_bytes(played.current)) != 0) {
+            return NULL;
+        }
+    }
+    return played.current;
+}
+
+// Takes the played positions of a partial order from its tracks, unless
+// they are current. Call with ahead.mutex held.
+static int syncPlayedPositions(const OrderSnapshot *snap, uint64_t generation, size_t length) {
+    if (played.generation == generation && played.positions.count == length) return 0;
+    played_set_free(&played.positions);
+    played.generation = 0;
+    if (played_set_init(&played.positions, length) != 0) return -1;
+    for (size_t pos = 0; pos < length; pos++) {
+        int track = orderTrackAt(snap, pos);
+        if (track >= 0 && played_set_test(played.current, (size_t)track)) {
+            played_set_mark(&played.positions, pos);
+        }
+    }
+    played.generation = generation;
+    return 0;
+}
+
+// Draws a random order position whose track was not played yet and marks
+// the track; -1 if played tracks are not skipped. Once every track of the
+// order played, a new round starts with all of them. Orders over the whole
+// playlist draw from the tracks directly, others from their positions.
+// Call with ahead.mutex held.
+static int drawUnplayed(const OrderSnapshot *snap, uint64_t generation) {
+    size_t length = orderLength(snap);
+    if (length == 0 || !skipsPlayed()) return -1;
+    PlayedSet *tracks = currentPlayedSet();
+    if (!tracks) return -1;
+
+    int pos;
+    if (length == tracks->count) {
+        if (tracks->marked == tracks->count) {
+            played_set_clear(tracks);
+            played.rounds++;
+        }
+        size_t track = played_set_select_unmarked(tracks, (size_t)rng_bounded(&state.nav_rng, tracks->count - tracks->marked));
+        pos = orderPositionOf(snap, (int)track);
+        if (pos < 0) return -1;
+        played_set_mark(tracks, track);
+    } else {
+        if (syncPlayedPositions(snap, generation, length) != 0) return -1;
+        PlayedSet *positions = &played.positions;
+        if (positions->marked == positions->count) {
+            for (size_t p = 0; p < length; p++) {
+                int track = orderTrackAt(snap, p);
+                if (track >= 0) played_set_unmark(tracks, (size_t)track);
+            }
+            played_set_clear(positions);
+            played.rounds++;
+        }
+        pos = (int)played_set_select_unmarked(positions, (size_t)rng_bounded(&state.nav_rng, positions->count - positions->marked));
+        played_set_mark(positions, (size_t)pos);
+        int track = orderTrackAt(snap, (size_t)pos);
+        if (track >= 0) played_set_mark(tracks, (size_t)track);
+    }
+    played.draws++;
+    return pos;
+}
+
+// Marks a track as played in the current playlist while random draws skip
+// played tracks
+static void markPlayed(int track) {
+    if (track < 0 || !skipsPlayed()) return;
+    pthread_mutex_lock(&ahead.mutex);
+    PlayedSet *tracks = currentPlayedSet();
+    if (tracks && played_set_mark(tracks, (size_t)track) &&
+        played.generation == __atomic_load_n(&state.generation, __ATOMIC_ACQUIRE)) {
+        OrderSnapshot *snap = acquireOrder();
+        int pos = orderPositionOf(snap, track);
+        if (pos >= 0) played_set_mark(&played.positions, (size_t)pos);
+        releaseOrder(snap);
+    }
+    pthread_mutex_unlock(&ahead.mutex);
+}
+
+// Releases a window track; a track that was drawn but never played is
+// drawable again. Call with ahead.mutex held.
+static void releaseQueued(const QueuedTrack *q) {
+    if (q->item) deadbeef->pl_item_unref(q->item);
+    if (!q->drawn || q->drawn != played.playlist || !played.current) return;
+    played_set_unmark(played.current, (size_t)q->track);
+    if (played.generation == ahead.generation) {
+        played_set_unmark(&played.positions, (size_t)q->cursor);
+    }
+}
+
+// History of the current playlist; a playlist without one takes over the
+// least recently used ring. NULL if there is no playlist. Call with
+// ahead.mutex held.
+static HistoryRing *currentHistory(void) {
+    uint32_t playlist = __atomic_load_n(&current_playlist, __ATOMIC_ACQUIRE);
+    if (!playlist) return NULL;
+    HistoryRing *ring = history.current;
+    if (!ring || ring->playlist != playlist) {
+        ring = NULL;
+        for (int i = 0; i < HISTORY_PLAYLISTS && !ring; i++) {
+            if (history.rings[i].playlist == playlist) ring = &history.rings[i];
+        }
+        if (!ring) {
+            ring = &history.rings[0];
+            for (int i = 1; i < HISTORY_PLAYLISTS; i++) {
+                if (history.rings[i].used < ring->used) ring = &history.rings[i];
+            }
+            clearHistory(ring);
+            ring->playlist = playlist;
+        }
+        history.current = ring;
+    }
+    ring->used = ++history.clock;
+    return ring;
+}
+
+// Playlist index of the nearest entry past back, going older for a step of
+// 1 and newer for -1, that is still in the current playlist; the entry is
+// stored in found. Returns -1 if there is none.
+static int historyTrack(const HistoryRing *ring, int back, int step, int *found) {
+    for (int b = back + step; b >= 0 && b < ring->count; b += step) {
+        int track = deadbeef->pl_get_idx_of(historyAt(ring, b));
+        if (track >= 0) {
+            *found = b;
+            return track;
+        }
+    }
+    return -1;
+}
+
+// Order position to replay an entry at: the one it played at, unless the
+// order changed since. SMART_RANDOM holds tracks more than once.
+static int historyCursor(const OrderSnapshot *snap, const HistoryRing *ring, int back, int track) {
+    int cursor = ring->cursors[historySlot(ring, back)];
+    if (cursor >= 0 && orderTrackAt(snap, (size_t)cursor) == track) return cursor;
+    return orderPositionOf(snap, track);
+}
+
+// Order position a track that started plays at: the cursor if it is on the
+// track, else its first position; -1 if it is not in the order
+static int playingCursor(DB_playItem_t *playing) {
+    int track = deadbeef->pl_get_idx_of(playing);
+    if (track < 0) return -1;
+    OrderSnapshot *snap = acquireOrder();
+    int cursor = __atomic_load_n(&state.current_played_item, __ATOMIC_ACQUIRE);
+    if (cursor < 0 || orderTrackAt(snap, (size_t)cursor) != track) {
+        cursor = orderPositionOf(snap, track);
+    }
+    releaseOrder(snap);
+    return cursor;
+}
+
+// Sets the currentPlayedItem based on the currently playing or marked track
+static void syncCurrentPlayedItem(void) {
+    DB_playItem_t *playing = deadbeef->streamer_get_playing_track_safe();
+    if (!playing) {
+        trace("No track currently playing\n");
+        return;
+    }
+
+    int idx = deadbeef->pl_get_idx_of(playing);
+    deadbeef->pl_item_unref(playing);
+    markPlayed(idx);
+
+    OrderSnapshot *snap = acquireOrder();
+    int cursor = __atomic_load_n(&state.current_played_item, __ATOMIC_ACQUIRE);
+
+    // SMART_RANDOM repeats tracks, so a cursor already on the track is kept
+    if (cursor >= 0 && orderTrackAt(snap, (size_t)cursor) == idx) {
+        releaseOrder(snap);
+        return;
+    }
+
+    int pos = orderPositionOf(snap, idx);
+    if (pos >= 0) {
+        __atomic_store_n(&state.current_played_item, pos, __ATOMIC_RELEASE);
+        trace("Current position updated to: %d (track index %d)\n", pos, idx);
+    } else if (orderLength(snap) > 0) {
+        __atomic_store_n(&state.current_played_item, 0, __ATOMIC_RELEASE);
+        trace("Track not found, resetting to first position\n");
+    } else {
+        trace("Playlist empty, can't sync position\n");
+    }
+    releaseOrder(snap);
+}
+
+// Order position a skip in the given direction lands on; random shuffle
+// draws any position, otherwise the order wraps around at both ends. Call
+// with ahead.mutex held, which also guards the navigation stream.
+static int stepCursor(const OrderSnapshot *snap, uint32_t event, int cursor) {
+    int length = (int)orderLength(snap);
+    int random = deadbeef->streamer_get_shuffle() == DDB_SHUFFLE_RANDOM;
+    // PURE_RANDOM plays on with a fresh draw instead of its stored order
+    if (random || (event == DB_EV_NEXT && __atomic_load_n(&state.play_mode, __ATOMIC_ACQUIRE) == PURE_RANDOM)) {
+        int pos = drawUnplayed(snap, ahead.generation);
+        if (pos >= 0) return pos;
+    }
+    if (random) {
+        return (int)rng_bounded(&state.nav_rng, (uint64_t)length);
+    }
+    if (event == DB_EV_NEXT) {
+        cursor++;
+        if (cursor >= length || cursor < 0) cursor = 0;
+    } else {
+        cursor--;
+        if (cursor < 0 || cursor >= length) cursor = length - 1;
+    }
+    return cursor;
+}
+
+// Whether the queued item at position i is the given track
+static int queuedAt(int i, DB_playItem_t *track) {
+    DB_playItem_t *it = deadbeef->playqueue_get_item(i);
+    if (!it) return 0;
+    deadbeef->pl_item_unref(it);
+    return it == track;
+}
+
+// Finds the playqueue positions of the window tracks; call with
+// ahead.mutex held. The window is queued as one block, which tells its
+// tracks apart from copies the user queued in front of or behind it. Once
+// the user broke the block up, the tracks are matched in order and those
+// that left the queue are skipped. Returns the number of tracks found.
+static int locateLookahead(int *positions) {
+    int count = deadbeef->playqueue_get_count();
+    for (int start = 0; start + ahead.count <= count && ahead.count > 0; start++) {
+        int k = 0;
+        while (k < ahead.count && queuedAt(start + k, ahead.tracks[k].item)) k++;
+        if (k == ahead.count) {
+            for (k = 0; k < ahead.count; k++) positions[k] = start + k;
+            return ahead.count;
+        }
+    }
+
+    int found = 0;
+    int next = 0;
+    for (int k = 0; k < ahead.count; k++) {
+        for (int i = next; i < count; i++) {
+            if (queuedAt(i, ahead.tracks[k].item)) {
+                positions[found++] = i;
+                next = i + 1;
+                break;
+            }
+        }
+    }
+    return found;
+}
+
+// Compares the window with the playqueue; call with ahead.mutex held.
+// Returns -1 if a track of the window left the queue, 1 if a track the
+// user queued sits behind the start of the window, 0 otherwise. The
+// number of tracks the user queued is stored in foreign if it is not NULL.
+static int checkLookahead(int *foreign) {
+    int positions[LOOKAHEAD_MAX];
+    int count = deadbeef->playqueue_get_count();
+    int found = locateLookahead(positions);
+    if (foreign) *foreign = count - found;
+    if (found < ahead.count) return -1;
+    return found > 0 && count - positions[0] > found;
+}
+
+// Takes the tracks of the window out of the playqueue; they stay
+// referenced. Call with ahead.mutex held.
+static void unqueueLookahead(void) {
+    int positions[LOOKAHEAD_MAX];
+    for (int k = locateLookahead(positions) - 1; k >= 0; k--) {
+        deadbeef->playqueue_remove_nth(positions[k]);
+    }
+}
+
+// Takes the window out of the playqueue and releases it; call with
+// ahead.mutex held
+static void dropLookahead(void) {
+    unqueueLookahead();
+    for (int i = 0; i < ahead.count; i++) {
+        releaseQueued(&ahead.tracks[i]);
+    }
+    ahead.count = 0;
+    ahead.from = -1;
+}
+
+// Releases the taken track once it will not play as the next track; call
+// with ahead.mutex held
+static void releaseTaken(void) {
+    if (!ahead.taken.item) return;
+    releaseQueued(&ahead.taken);
+    memset(&ahead.taken, 0, sizeof(ahead.taken));
+}
+
+// Sets the head of the window aside once it left the playqueue. The
+// streamer takes the next track when it starts decoding it for gapless
+// playback, seconds before the song changes; the window then follows the
+// taken track while the cursor stays on the one that still plays. Call
+// with ahead.mutex held. Returns 1 if the head was taken.
+static int takeLookaheadHead(void) {
+    if (ahead.count == 0 || ahead.taken.item) return 0;
+    // A short order can hold the same track more than once in the window
+    DB_playItem_t *head = ahead.tracks[0].item;
+    int copies = 0;
+    for (int k = 0; k < ahead.count; k++) {
+        if (ahead.tracks[k].item == head) copies++;
+    }
+    int count = deadbeef->playqueue_get_count();
+    for (int i = 0; i < count && copies > 0; i++) {
+        if (queuedAt(i, head)) copies--;
+    }
+    if (copies == 0) return 0;
+    ahead.taken = ahead.tracks[0];
+    ahead.taken_after = ahead.from;
+    ahead.count--;
+    memmove(&ahead.tracks[0], &ahead.tracks[1], (size_t)ahead.count * sizeof(QueuedTrack));
+    ahead.from = ahead.taken.cursor;
+    return 1;
+}
+
+// Queues the window again behind the tracks the user queued since; call
+// with ahead.mutex held
+static void requeueLookahead(void) {
+    unqueueLookahead();
+    int kept = 0;
+    for (int i = 0; i < ahead.count; i++) {
+        if (deadbeef->playqueue_push(ahead.tracks[i].item) == 0) {
+            ahead.tracks[kept++] = ahead.tracks[i];
+        } else {
+            releaseQueued(&ahead.tracks[i]);
+        }
+    }
+    ahead.count = kept;
+}
+
+// Queues up to n tracks that follow the window in the order, or in the
+// history while an older entry plays; call with ahead.mutex held. Returns
+// the number of tracks queued.
+static int extendLookahead(const OrderSnapshot *snap, int n) {
+    int cursor = ahead.count > 0 ? ahead.tracks[ahead.count - 1].cursor : ahead.from;
+    // Entries newer than the playing one are replayed before the order
+    HistoryRing *ring = history.current;
+    int past = ring ? ring->back : -1;
+    if (ahead.count > 0) {
+        past = ahead.tracks[ahead.count - 1].past;
+    } else if (ahead.taken.item) {
+        past = ahead.taken.past;
+    }
+    int added = 0;
+    for (; added < n && ahead.count < LOOKAHEAD_MAX; added++) {
+        uint64_t draws = played.draws;
+        QueuedTrack *q = &ahead.tracks[ahead.count];
+        q->past = -1;
+        q->track = past > 0 ? historyTrack(ring, past, -1, &q->past) : -1;
+        if (q->track >= 0) {
+            past = q->past;
+            cursor = historyCursor(snap, ring, past, q->track);
+        } else {
+            past = -1;
+            cursor = stepCursor(snap, DB_EV_NEXT, cursor);
+            q->track = orderTrackAt(snap, (size_t)cursor);
+        }
+        q->cursor = cursor;
+        q->drawn = played.draws != draws ? played.playlist : 0;
+        q->item = deadbeef->pl_get_for_idx(q->track);
+        if (!q->item || deadbeef->playqueue_push(q->item) != 0) {
+            releaseQueued(q);
+            break;
+        }
+        ahead.count++;
+    }
+    return added;
+}
+
+// Number of tracks the window should hold now; none in PLAYLIST mode,
+// while a track repeats or nothing plays
+static int lookaheadSize(void) {
+    if (__atomic_load_n(&state.play_mode, __ATOMIC_ACQUIRE) == PLAYLIST ||
+        deadbeef->streamer_get_repeat() == DDB_REPEAT_SINGLE) {
+        return 0;
+    }
+    DB_playItem_t *playing = deadbeef->streamer_get_playing_track_safe();
+    if (!playing) return 0;
+    deadbeef->pl_item_unref(playing);
+    int size = deadbeef->conf_get_int(CONF_LOOKAHEAD_TRACKS, DEFAULT_LOOKAHEAD_TRACKS);
+    if (size < 0) size = 0;
+    return size < LOOKAHEAD_MAX ? size : LOOKAHEAD_MAX;
+}
+
+// Number of tracks in the playqueue other than the window
+static int foreignQueueCount(void) {
+    pthread_mutex_lock(&ahead.mutex);
+    int foreign = 0;
+    checkLookahead(&foreign);
+    pthread_mutex_unlock(&ahead.mutex);
+    return foreign;
+}
+
+// Keeps the window in line with the cursor and the published order. It is
+// picked again only when it no longer follows the cursor, and topped up in
+// one batch once half of it was played, so most track changes only check
+// the queue. A head the streamer already took counts as played.
+static void refreshLookahead(void) {
+    if (!deadbeef->playqueue_push) return;
+    pthread_mutex_lock(&ahead.mutex);
+    uint64_t generation = __atomic_load_n(&state.generation, __ATOMIC_ACQUIRE);
+    int cursor = __atomic_load_n(&state.current_played_item, __ATOMIC_ACQUIRE);
+    int size = lookaheadSize();
+    takeLookaheadHead();
+    if (ahead.taken.item && ahead.generation != generation) {
+        // A new order put the cursor back on the playing track, which the
+        // taken track still follows
+        ahead.taken_after = cursor;
+    }
+    if (ahead.taken.item && ahead.taken_after != cursor) {
+        releaseTaken();
+    }
+    int status = checkLookahead(NULL);
+    int from = ahead.taken.item ? ahead.taken_after : ahead.from;
+    if (status < 0 || ahead.generation != generation || from != cursor || ahead.count > size) {
+        dropLookahead();
+    } else if (status > 0) {
+        requeueLookahead();
+    }
+
+    if (size > 0 && ahead.count * 2 <= size) {
+        OrderSnapshot *snap = acquireOrder();
+        if (orderLength(snap) > 0) {
+            if (ahead.count == 0) {
+                ahead.from = cursor;
+                if (ahead.taken.item && ahead.generation != generation) {
+                    // The taken track keeps its place in the new order
+                    ahead.taken.track = deadbeef->pl_get_idx_of(ahead.taken.item);
+                    ahead.taken.cursor = orderPositionOf(snap, ahead.taken.track);
+                }
+                if (ahead.taken.item && ahead.taken.cursor >= 0) {
+                    ahead.from = ahead.taken.cursor;
+                }
+                ahead.generation = generation;
+            }
+            if (extendLookahead(snap, size - ahead.count) > 0) {
+                ahead.batches++;
+                trace("Queued %d tracks after position %d\n", ahead.count, cursor);
+            }
+        }
+        releaseOrder(snap);
+    }
+    pthread_mutex_unlock(&ahead.mutex);
+}
+
+// Moves the cursor onto the head of the window once the streamer took it
+// from the queue and plays it, the same way a skip would have. A taken
+// track is void once another one started. Returns 1 if it did.
+static int followLookahead(DB_playItem_t *playing, int changed) {
+    int followed = 0;
+    pthread_mutex_lock(&ahead.mutex);
+    takeLookaheadHead();
+    if (ahead.taken.item == playing) {
+        int cursor = ahead.taken.cursor;
+        if (ahead.taken.past >= 0 && history.current) {
+            history.current->back = ahead.taken.past;
+            history.replays++;
+        }
+        deadbeef->pl_item_unref(ahead.taken.item);
+        memset(&ahead.taken, 0, sizeof(ahead.taken));
+        if (cursor >= 0 && ahead.generation == __atomic_load_n(&state.generation, __ATOMIC_ACQUIRE)) {
+            __atomic_store_n(&state.current_played_item, cursor, __ATOMIC_RELEASE);
+        }
+        followed = 1;
+    } else if (changed) {
+        releaseTaken();
+    }
+    pthread_mutex_unlock(&ahead.mutex);
+    return followed;
+}
+
+// Whether a track plays in between while the whole window still waits in
+// the queue, e.g. one the user queued in front of it; the cursor stays put
+static int lookaheadInterlude(void) {
+    pthread_mutex_lock(&ahead.mutex);
+    int interlude = ahead.count > 0 && checkLookahead(NULL) >= 0;
+    pthread_mutex_unlock(&ahead.mutex);
+    return interlude;
+}
+
+// Withdraws the window, e.g. when the custom order stops applying
+static void withdrawLookahead(void) {
+    pthread_mutex_lock(&ahead.mutex);
+    dropLookahead();
+    releaseTaken();
+    pthread_mutex_unlock(&ahead.mutex);
+}
+
+// Appends a track that started to the history of the current playlist,
+// unless it is the entry PREV went to or the one that plays already. Once
+// PREV went past the oldest entry the track goes in front of it instead,
+// in place of the newest entry if the ring is full. Any other new track
+// forgets the entries newer than the playing one, together with the window
+// tracks that would have replayed them.
+static void recordHistory(DB_playItem_t *playing) {
+    pthread_mutex_lock(&ahead.mutex);
+    HistoryRing *ring = currentHistory();
+    if (!ring) {
+        pthread_mutex_unlock(&ahead.mutex);
+        return;
+    }
+    int pending = ring->pending;
+    ring->pending = -1;
+    if (pending >= 0 && pending < ring->count && historyAt(ring, pending) == playing) {
+        // The window was picked for the entry that played before
+        ring->back = pending;
+        history.replays++;
+        dropLookahead();
+    } else if (pending > 0 && pending == ring->count && historyAt(ring, ring->back) != playing) {
+        if (ring->count == HISTORY_LENGTH) {
+            deadbeef->pl_item_unref(ring->items[ring->newest]);
+            ring->newest = (ring->newest + HISTORY_LENGTH - 1) % HISTORY_LENGTH;
+            ring->count--;
+        }
+        int slot = historySlot(ring, ring->count);
+        deadbeef->pl_item_ref(playing);
+        ring->items[slot] = playing;
+        ring->cursors[slot] = playingCursor(playing);
+        ring->back = ring->count++;
+        dropLookahead();
+    } else if (ring->count == 0 || historyAt(ring, ring->back) != playing) {
+        if (ring->back > 0) {
+            for (; ring->back > 0; ring->back--) {
+                deadbeef->pl_item_unref(ring->items[ring->newest]);
+                ring->newest = (ring->newest + HISTORY_LENGTH - 1) % HISTORY_LENGTH;
+                ring->count--;
+            }
+            for (int i = 0; i < ahead.count; i++) {
+                if (ahead.tracks[i].past >= 0) {
+                    dropLookahead();
+                    break;
+                }
+            }
+        }
+        ring->newest = (ring->newest + 1) % HISTORY_LENGTH;
+        if (ring->count == HISTORY_LENGTH) {
+            deadbeef->pl_item_unref(ring->items[ring->newest]);
+        } else {
+            ring->count++;
+        }
+        deadbeef->pl_item_ref(playing);
+        ring->items[ring->newest] = playing;
+        ring->cursors[ring->newest] = playingCursor(playing);
+    }
+    pthread_mutex_unlock(&ahead.mutex);
+}
+
+// Checks if playback is active
+static int isPlaybackActive(void) {
+    CHECK_NULL_RET(deadbeef, "Deadbeef API not initialized in isPlaybackActive", 0);
+    return (deadbeef->pl_getcount(PL_MAIN) > 0 && 
+            deadbeef->get_output() != NULL && 
+            deadbeef->get_output()->state() == DDB_PLAYBACK_STATE_PLAYING);
+}
+
+// Appends a track to the current order and records its position
+static int appendToOrder(int track) {
+    if (insertArray(&state.playlist, track) != 0) {
+        return -1;
+    }
+    setPosition(&state.positions, track, (int)state.playlist.used - 1);
+    return 0;
+}
+
+// Tells the host when the order is empty so it can fall back to PLAYLIST
+static void notifyIfEmpty(void) {
+    OrderSnapshot *snap = acquireOrder();
+    size_t length = orderLength(snap);
+    releaseOrder(snap);
+    if (length == 0 && hooks.order_empty) {
+        hooks.order_empty();
+    }
+}
+
+// Checks whether a track is rated high enough for TOP_RATED_SONGS
+static int isTopRatedSong(const TrackSnapshot *snap, size_t index) {
+    return snap->rating[index] >= 4;
+}
+
+// Checks whether a track is selected
+static int isSelectedSong(const TrackSnapshot *snap, size_t index) {
+    return snap->selected[index] != 0;
+}
+
+// Extracts the artist name from the artist tag, without featured artists
+static void extractArtist(const char *meta, char *artist, size_t size) {
+    CHECK_NULL(artist, "Invalid artist buffer in extractArtist");
+    
+    artist[0] = '\0';
+    
+    if (meta) {
+        safe_strncpy(artist, meta, size);
+        
+        char *feat_ptr = strstr(artist, " feat");
+        if (!feat_ptr) feat_ptr = strstr(artist, " feat.");
+        if (!feat_ptr) feat_ptr = strstr(artist, " featuring");
+        
+        if (feat_ptr) {
+            *feat_ptr = '\0';
+            
+            size_t len = strlen(artist);
+            while (len > 0 && artist[len-1] == ' ') {
+                artist[len-1] = '\0';
+                len--;
+            }
+        }
+    }
+}
+
+// Extracts the album folder from a track URI
+static void extractFolderUri(const char *uri, char *folder_uri, size_t size) {
+    CHECK_NULL(folder_uri, "Invalid folder URI buffer in extractFolderUri");
+    
+    folder_uri[0] = '\0';
+    
+    if (uri) {
+        safe_strncpy(folder_uri, uri, size);
+        
+        char *last_slash = strrchr(folder_uri, '/');
+        if (last_slash) {
+            *last_slash = '\0';
+            
+            char *cd_dir = strstr(folder_uri, "/CD");
+            if (cd_dir) {
+                *cd_dir = '\0';
+                
+                size_t len = strlen(folder_uri);
+                if (len > 0 && folder_uri[len-1] == '/') {
+                    folder_uri[len-1] = '\0';
+                }
+            }
+        }
+    }
+}
+
+// Extracts the year from the value of the year or date tag
+static void extractYear(const char *meta, char *year, size_t size) {
+    year[0] = '\0';
+    if (!meta) return;
+    size_t len = 0;
+    while (len < 4 && len + 1 < size && meta[len] >= '0' && meta[len] <= '9') {
+        year[len] = meta[len];
+        len++;
+    }
+    year[len] = '\0';
+}
+
+static uint64_t hashUri(const char *uri) {
+    uint64_t h = 14695981039346656037ULL;
+    while (*uri) {
+        h ^= (unsigned char)*uri++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Allocates column groups for the tracks of a snapshot
+static int allocTrackColumns(TrackSnapshot *snap, unsigned columns) {
+    size_t n = snap->count ? snap->count : 1;
+    int ok = 1;
+    if (columns & TRACK_COLUMNS_RATING) {
+        snap->rating = malloc(n * sizeof(int8_t));
+        snap->selected = malloc(n * sizeof(uint8_t));
+        snap->duration = malloc(n * sizeof(float));
+        ok = snap->rating && snap->selected && snap->duration;
+    }
+    if (columns & TRACK_COLUMNS_KEYS) {
+        snap->uri_hash = malloc(n * sizeof(uint64_t));
+        ok = ok && snap->uri_hash;
+        for (int f = 0; f < FACET_COUNT; f++) {
+            snap->keys[f] = malloc(n * sizeof(uint32_t));
+            ok = ok && snap->keys[f];
+        }
+    }
+    if (!ok) {
+        trace_error("Memory allocation failed in allocTrackColumns\n");
+        freeTrackColumns(snap);
+        return -1;
+    }
+    return 0;
+}
+
+// Starts an empty copy of raw key values for up to capacity tracks
+static int initRawTrackKeys(RawTrackKeys *raw, size_t capacity) {
+    memset(raw, 0, sizeof(*raw));
+    raw->tracks = malloc((capacity ? capacity : 1) * sizeof(size_t));
+    raw->fields = malloc((capacity ? capacity : 1) * sizeof(*raw->fields));
+    if (!raw->tracks || !raw->fields) {
+        trace_error("Memory allocation failed in initRawTrackKeys\n");
+        freeRawTrackKeys(raw);
+        return -1;
+    }
+    raw->capacity = capacity;
+    return 0;
+}
+
+// Appends a value to the copied text; returns its offset + 1, 0 for a
+// missing value or when it could not be stored
+static size_t copyRawValue(RawTrackKeys *raw, const char *value) {
+    if (!value) return 0;
+    size_t len = strlen(value) + 1;
+    if (len > raw->size - raw->used) {
+        size_t size = raw->size ? raw->size * 2 : 64 * 1024;
+        while (size - raw->used < len) size *= 2;
+        char *text = realloc(raw->text, size);
+        if (!text) {
+            raw->failed = 1;
+            return 0;
+        }
+        raw->text = text;
+        raw->size = size;
+    }
+    memcpy(raw->text + raw->used, value, len);
+    raw->used += len;
+    return raw->used - len + 1;
+}
+
+// Copies the tag values a track is keyed by; call with pl_lock held
+static void copyRawTrackKeys(RawTrackKeys *raw, size_t index, DB_playItem_t *it) {
+    if (raw->count == raw->capacity) {
+        raw->failed = 1;
+        return;
+    }
+    const char *year = deadbeef->pl_find_meta_raw(it, "year");
+    if (!year) year = deadbeef->pl_find_meta_raw(it, "date");
+    size_t *fields = raw->fields[raw->count];
+    fields[RAW_KEY_URI] = copyRawValue(raw, deadbeef->pl_find_meta(it, ":URI"));
+    fields[RAW_KEY_ARTIST] = copyRawValue(raw, deadbeef->pl_find_meta_raw(it, "artist"));
+    fields[RAW_KEY_GENRE] = copyRawValue(raw, deadbeef->pl_find_meta_raw(it, "genre"));
+    fields[RAW_KEY_YEAR] = copyRawValue(raw, year);
+    raw->tracks[raw->count++] = index;
+}
+
+// Copied value of a row, NULL if the tag was missing
+static const char *rawValue(const RawTrackKeys *raw, size_t row, int field) {
+    size_t offset = raw->fields[row][field];
+    return offset ? raw->text + offset - 1 : NULL;
+}
+
+// Fills the key columns from the copied values: the album folder, artist
+// and year are parsed, the URI hashed and every key interned. Runs after
+// pl_lock is released; call with playlist_mutex held.
+static int internTrackKeys(TrackSnapshot *snap, const RawTrackKeys *raw) {
+    if (raw->failed) {
+        trace_error("Memory allocation failed copying track metadata\n");
+        return -1;
+    }
+    char key[MAX_METADATA_LENGTH];
+    for (size_t row = 0; row < raw->count; row++) {
+        if ((row & (CANCEL_CHECK_INTERVAL - 1)) == 0 && buildCancelled()) {
+            return -1;
+        }
+        size_t index = raw->tracks[row];
+        const char *uri = rawValue(raw, row, RAW_KEY_URI);
+        snap->uri_hash[index] = uri ? hashUri(uri) : 0;
+        extractFolderUri(uri, key, sizeof(key));
+        snap->keys[FACET_ALBUM][index] = string_pool_intern(&state.names, key);
+        extractArtist(rawValue(raw, row, RAW_KEY_ARTIST), key, sizeof(key));
+        snap->keys[FACET_ARTIST][index] = string_pool_intern(&state.names, key);
+        snap->keys[FACET_GENRE][index] = string_pool_intern(&state.names, rawValue(raw, row, RAW_KEY_GENRE));
+        extractYear(rawValue(raw, row, RAW_KEY_YEAR), key, sizeof(key));
+        snap->keys[FACET_YEAR][index] = string_pool_intern(&state.names, key);
+    }
+    return 0;
+}
+
+// Reads column groups of one track; the values keys are made from are
+// only copied into raw. Call with pl_lock held.
+static void readTrackMetadata(TrackSnapshot *snap, size_t index, unsigned columns, RawTrackKeys *raw) {
+    DB_playItem_t *it = snap->items[index];
+
+    if (columns & TRACK_COLUMNS_RATING) {
+        int rating = deadbeef->pl_find_meta_int(it, "rating", 0);
+        snap->rating[index] = (int8_t)(rating < 0 ? 0 : (rating > 100 ? 100 : rating));
+        snap->selected[index] = deadbeef->pl_is_selected(it) != 0;
+        snap->duration[index] = deadbeef->pl_get_item_duration(it);
+    }
+    if (columns & TRACK_COLUMNS_KEYS) {
+        copyRawTrackKeys(raw, index, it);
+    }
+}
+
+// Fills the requested column groups that are still missing for every
+// track. Call with pl_lock held and internTrackKeys after releasing it,
+// which completes the key columns; raw is freed by the caller either way.
+static int captureTrackMetadata(TrackSnapshot *snap, unsigned columns, RawTrackKeys *raw) {
+    memset(raw, 0, sizeof(*raw));
+    columns &= ~snap->columns;
+    if (!columns) return 0;
+    if (allocTrackColumns(snap, columns) != 0) return -1;
+    if ((columns & TRACK_COLUMNS_KEYS) && initRawTrackKeys(raw, snap->count) != 0) return -1;
+    for (size_t i = 0; i < snap->count; i++) {
+        if ((i & (CANCEL_CHECK_INTERVAL - 1)) == 0 && buildCancelled()) {
+            // The caller drops the snapshot with the half-filled groups
+            return -1;
+        }
+        readTrackMetadata(snap, i, columns, raw);
+    }
+    snap->columns |= columns;
+    return 0;
+}
+
+// Fills the columns of a snapshot taken after a playlist change from the
+// previous one: surviving tracks are copied through the diff, metadata is
+// only read for inserted tracks. Call with pl_lock held and internTrackKeys
+// after releasing it; raw is freed by the caller either way.
+static int carryTrackMetadata(const TrackSnapshot *old, TrackSnapshot *fresh, const PlaylistDiff *diff,
+                              RawTrackKeys *raw) {
+    memset(raw, 0, sizeof(*raw));
+    unsigned columns = old->columns;
+    if (!columns) return 0;
+    if (allocTrackColumns(fresh, columns) != 0) return -1;
+    if ((columns & TRACK_COLUMNS_KEYS) && initRawTrackKeys(raw, diff->inserted_count) != 0) return -1;
+    for (size_t i = 0; i < old->count; i++) {
+        int mapped = playlist_diff_map(diff, (int)i);
+        if (mapped < 0) continue;
+        if (columns & TRACK_COLUMNS_RATING) {
+            fresh->rating[mapped] = old->rating[i];
+            fresh->selected[mapped] = old->selected[i];
+            fresh->duration[mapped] = old->duration[i];
+        }
+        if (columns & TRACK_COLUMNS_KEYS) {
+            fresh->uri_hash[mapped] = old->uri_hash[i];
+            for (int f = 0; f < FACET_COUNT; f++) {
+                fresh->keys[f][mapped] = old->keys[f][i];
+            }
+        }
+    }
+    for (size_t k = 0; k < diff->inserted_count; k++) {
+        readTrackMetadata(fresh, (size_t)diff->inserted[k], columns, raw);
+    }
+    fresh->columns = columns;
+    return 0;
+}
+
+// Re-reads the selected flags, which change without a playlist change
+static void refreshSelection(TrackSnapshot *snap) {
+    if (!(snap->columns & TRACK_COLUMNS_RATING)) return;
+    deadbeef->pl_lock();
+    for (size_t i = 0; i < snap->count; i++) {
+        snap->selected[i] = deadbeef->pl_is_selected(snap->items[i]) != 0;
+    }
+    deadbeef->pl_unlock();
+}
+
+// Column groups the builder of a mode reads
+static unsigned modeColumns(PlayModes mode) {
+    switch (mode) {
+        case PLAYLIST:
+        case PURE_RANDOM:
+            return 0;
+        case TOP_RATED_SONGS:
+        case SELECTION:
+        case SMART_RANDOM:
+            return TRACK_COLUMNS_RATING;
+        default:
+            return TRACK_COLUMNS_KEYS;
+    }
+}
+
+// Makes sure state.tracks describes the current playlist with the column
+// groups a mode needs. A snapshot of the unchanged playlist is reused and
+// only gains the missing groups; whatever has to be read is read in one
+// pl_lock hold. Call with playlist_mutex held.
+static int snapshotTracks(int plt_id, unsigned columns) {
+    uint32_t playlist = playlistIdentity(plt_id);
+    int count = deadbeef->pl_getcount(PL_MAIN);
+    int reuse = state.tracks.items && state.tracks.playlist == playlist &&
+                state.tracks.count == (size_t)(count > 0 ? count : 0);
+    if (reuse && !(columns & ~state.tracks.columns)) {
+        return 0;
+    }
+
+    ddb_playlist_t *plt = deadbeef->plt_get_curr();
+    if (!plt) {
+        trace("No current playlist found\n");
+        return -1;
+    }
+    if (!reuse) {
+        releaseTrackSnapshot(&state.tracks);
+        // No other snapshot refers to the interned strings any more, and
+        // the facet index keys on their ids
+        string_pool_free(&state.names);
+        facet_index_free(&state.facets);
+    }
+
+    struct timespec start, end;
+    RawTrackKeys raw;
+    memset(&raw, 0, sizeof(raw));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    deadbeef->pl_lock();
+    int result = reuse ? 0 : captureTrackSnapshot(&state.tracks, plt, plt_id);
+    if (result == 0) {
+        result = captureTrackMetadata(&state.tracks, columns, &raw);
+    }
+    deadbeef->pl_unlock();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    deadbeef->plt_unref(plt);
+    if (result == 0) {
+        result = internTrackKeys(&state.tracks, &raw);
+    }
+    freeRawTrackKeys(&raw);
+
+    if (result != 0) {
+        releaseTrackSnapshot(&state.tracks);
+        return -1;
+    }
+    state.tracks.playlist = playlist;
+    trace_info("Captured %zu tracks (columns 0x%x) in %.3f ms under pl_lock\n", state.tracks.count, state.tracks.columns,
+          (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+    return 0;
+}
+
+// Index of the playing track in a snapshot, -1 if it is not in it. The
+// host knows the index; the snapshot is only scanned when it is older
+// than the playlist.
+static int playingIndex(const TrackSnapshot *snap) {
+    DB_playItem_t *playing = deadbeef->streamer_get_playing_track_safe();
+    if (!playing) return -1;
+    int index = deadbeef->pl_get_idx_of(playing);
+    if (index < 0 || (size_t)index >= snap->count || snap->items[index] != playing) {
+        index = -1;
+        for (size_t i = 0; i < snap->count; i++) {
+            if (snap->items[i] == playing) {
+                index = (int)i;
+                break;
+            }
+        }
+    }
+    deadbeef->pl_item_unref(playing);
+    return index;
+}
+
+// Facet a keep mode groups tracks by, -1 for other modes
+static int facetOfMode(int mode) {
+    switch (mode) {
+        case KEEP_ALBUM:  return FACET_ALBUM;
+        case KEEP_ARTIST: return FACET_ARTIST;
+        case KEEP_GENRE:  return FACET_GENRE;
+        case KEEP_YEAR:   return FACET_YEAR;
+        default:          return -1;
+    }
+}
+
+// Checks a track against the specified criteria; keep modes compare the
+// track's facet key with the one of the track they were started from
+static int trackMatchesCriteria(int criteria, const TrackSnapshot *snap, size_t index) {
+    CHECK_NULL_RET(snap->columns & modeColumns(criteria) ? snap : NULL, "Track metadata missing in trackMatchesCriteria", 0);
+    
+    int facet = facetOfMode(criteria);
+    if (facet >= 0) {
+        if (state.criteria_key[0] == '\0') {
+            trace_warn("Invalid parameters for criteria %d\n", criteria);
+            return 0;
+        }
+        return strcmp(string_pool_get(&state.names, snap->keys[facet][index]), state.criteria_key) == 0;
+    }
+    
+    switch (criteria) {
+        case TOP_RATED_SONGS: 
+            return isTopRatedSong(snap, index);
+        case SELECTION:       
+            return isSelectedSong(snap, index);
+        default:
+            trace_warn("Unknown criteria type: %d\n", criteria);
+            return 0;
+    }
+}
+
+// Number of order entries a track gets in the active mode, used when
+// tracks are added to an existing order
+static int countTrackEntries(const TrackSnapshot *snap, size_t index) {
+    switch (state.play_mode) {
+        case PLAYLIST:
+        case PURE_RANDOM:
+            return 1;
+        case SMART_RANDOM:
+            // The order holds one draw per track; a new track is scattered in once
+            return 1;
+        default:
+            return trackMatchesCriteria(state.play_mode, snap, index);
+    }
+}
+
+// Files a track under its key in every facet
+static int indexTrackFacets(const TrackSnapshot *snap, size_t index) {
+    for (int f = 0; f < FACET_COUNT; f++) {
+        if (facet_index_add(&state.facets, (FacetKind)f, (int)index, snap->keys[f][index]) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Makes sure the facet index describes the tracks of the snapshot,
+// building it from the columns if not; call with playlist_mutex held
+static int ensureFacetIndex(const TrackSnapshot *snap) {
+    if (state.facets.valid && state.facets.playlist == snap->playlist &&
+        state.facets.track_count == snap->count) {
+        return 0;
+    }
+    if (!(snap->columns & TRACK_COLUMNS_KEYS)) {
+        return -1;
+    }
+    const uint32_t *keys[FACET_COUNT];
+    for (int f = 0; f < FACET_COUNT; f++) {
+        keys[f] = snap->keys[f];
+    }
+    // Key ids run from 1 to the number of interned strings
+    if (facet_index_build(&state.facets, snap->playlist, keys, snap->count, state.names.count + 1) != 0) {
+        return -1;
+    }
+    trace("Indexed facets of %zu tracks\n", snap->count);
+    return 0;
+}
+
+// Creates a keep mode order from the facet group of the playing track;
+// once the index exists this costs the size of the group, not the playlist
+static void createPlaylistByFacet(int mode) {
+    FacetKind facet = (FacetKind)facetOfMode(mode);
+    state.criteria_key[0] = '\0';
+    state.draft_cursor = 0;
+
+    int playing = playingIndex(&state.tracks);
+    if (playing < 0) {
+        trace("No playing track found\n");
+        return;
+    }
+    const FacetGroup *group = NULL;
+    if (ensureFacetIndex(&state.tracks) == 0) {
+        group = facet_index_group_of(&state.facets, facet, playing);
+    }
+    if (!group) return;
+
+    // Kept in the state so that tracks added later can be matched too
+    safe_strncpy(state.criteria_key, string_pool_get(&state.names, group->key), sizeof(state.criteria_key));
+    if (appendArray(&state.playlist, group->tracks, group->count) == 0) {
+        for (size_t i = 0; i < group->count; i++) {
+            setPosition(&state.positions, group->tracks[i], (int)i);
+            if (group->tracks[i] == playing) {
+                state.draft_cursor = (int)i;
+            }
+        }
+    }
+}
+
+// Creates a playlist based on specified criteria
+static void createPlaylistByCriteria(int criteriaType) {
+    CHECK_NULL(deadbeef, "Deadbeef API not initialized in createPlaylistByCriteria");
+    
+    if (facetOfMode(criteriaType) >= 0) {
+        createPlaylistByFacet(criteriaType);
+        return;
+    }
+    
+    int playing = playingIndex(&state.tracks);
+    if (playing < 0) {
+        trace("No playing track found\n");
+        return;
+    }
+    if (criteriaType == SELECTION) {
+        refreshSelection(&state.tracks);
+    }
+    
+    state.criteria_key[0] = '\0';
+    state.draft_cursor = 0;
+    for (size_t index = 0; index < state.tracks.count; index++) {
+        if ((index & (CANCEL_CHECK_INTERVAL - 1)) == 0 && buildCancelled()) {
+            return;
+        }
+        if (trackMatchesCriteria(criteriaType, &state.tracks, index)) {
+            appendToOrder((int)index);
+        }
+        if ((int)index == playing) {
+            state.draft_cursor = state.playlist.used - 1;
+        }
+    }
+}
+
+// Creates the playlist order over all tracks of the snapshot
+static void createSequentialList(void) {
+    state.draft_cursor = 0;
+    int playing = playingIndex(&state.tracks);
+    if (playing >= 0) {
+        state.draft_cursor = playing;
+    }
+    for (size_t index = 0; index < state.tracks.count; index++) {
+        if ((index & (CANCEL_CHECK_INTERVAL - 1)) == 0 && buildCancelled()) {
+            return;
+        }
+        if (appendToOrder((int)index) != 0) {
+            trace_error("Failed to insert index into playlist\n");
+            break;
+        }
+    }
+}
+
+// Creates a pure random playlist
+static void createPureRandomList(void) {
+    CHECK_NULL(deadbeef, "Deadbeef API not initialized in createPureRandomList");
+    createSequentialList();
+    if (state.playlist.used > 1) {
+        performPlaylistOperation(&state.playlist, shuffleArrayOperation, &state.order_rng);
+    }
+}
+
+// Builds the SMART_RANDOM sampler, where a track rated r is drawn r + 1
+// times as often as an unrated one
+static int buildRatingSampler(WeightedSampler *sampler, const TrackSnapshot *snap) {
+    size_t count = snap->count;
+    uint32_t *weights = count > 0 ? malloc(count * sizeof(uint32_t)) : NULL;
+    if (!weights) {
+        trace_error("Memory allocation failed in buildRatingSampler\n");
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        int rating = snap->rating[i];
+        weights[i] = rating > 0 ? (uint32_t)rating + 1 : 1;
+    }
+    int result = weighted_sampler_build(sampler, weights, count);
+    free(weights);
+    return result;
+}
+
+// Appends weighted draws until the order holds length entries; every draw
+// is redrawn when it would repeat the previous entry
+static void appendWeightedDraws(WeightedSampler *sampler, int previous, size_t length) {
+    int index = (int)sampler->count;
+    for (size_t i = state.playlist.used; i < length; i++) {
+        if ((i & (CANCEL_CHECK_INTERVAL - 1)) == 0 && buildCancelled()) {
+            break;
+        }
+        int drawn = (int)weighted_sampler_draw(sampler, rng_next(&state.order_rng));
+        for (int retry = 0; drawn == previous && retry < SMART_RANDOM_MAX_REDRAWS; retry++) {
+            drawn = (int)weighted_sampler_draw(sampler, rng_next(&state.order_rng));
+        }
+        if (drawn == previous) {
+            drawn = (drawn + 1) % index;
+        }
+        if (appendToOrder(drawn) != 0) {
+            trace_error("Failed to append weighted draw to playlist\n");
+            break;
+        }
+        previous = drawn;
+    }
+}
+
+// Creates a smart random playlist: one weighted draw per track, starting
+// at the playing track
+static void createSmartRandomList(void) {
+    CHECK_NULL(deadbeef, "Deadbeef API not initialized in createSmartRandomList");
+    
+    int played_index = playingIndex(&state.tracks);
+    if (played_index < 0) {
+        trace("No currently playing track found\n");
+        return;
+    }
+    
+    WeightedSampler sampler;
+    if (buildRatingSampler(&sampler, &state.tracks) != 0) {
+        return;
+    }
+    appendToOrder(played_index);
+    state.draft_cursor = 0;
+    appendWeightedDraws(&sampler, played_index, state.tracks.count);
+    weighted_sampler_free(&sampler);
+}
+
+// Creates a default playlist
+static void createDefaultList(void) {
+    CHECK_NULL(deadbeef, "Deadbeef API not initialized in createDefaultList");
+    createSequentialList();
+}
+
+// Cheap fingerprint of the current playlist from its size and the URIs of
+// a few tracks spread over it; tells whether a saved order still fits
+static uint64_t playlistFingerprint(void) {
+    deadbeef->pl_lock();
+    int count = deadbeef->pl_getcount(PL_MAIN);
+    uint64_t h = hashUri("") ^ (uint64_t)(count > 0 ? count : 0);
+    for (int i = 0; count > 0 && i < FINGERPRINT_SAMPLES; i++) {
+        int idx = (int)((int64_t)(count - 1) * i / (FINGERPRINT_SAMPLES - 1));
+        DB_playItem_t *it = deadbeef->pl_get_for_idx(idx);
+        if (!it) continue;
+        const char *uri = deadbeef->pl_find_meta(it, ":URI");
+        h = (h ^ (uri ? hashUri(uri) : 0)) * 1099511628211ULL;
+        deadbeef->pl_item_unref(it);
+    }
+    deadbeef->pl_unlock();
+    return h;
+}
+
+// Releases a saved order evicted from or replaced in the cache
+static void freeSavedPlaylist(void *value) {
+    SavedPlaylist *sp = value;
+    packed_order_free(&sp->order);
+    packed_order_free(&sp->blocks);
+    free(sp->criteria_key);
+    free(sp);
+}
+
+// Byte ceiling of the saved order cache from the configuration
+static size_t savedOrdersBudget(void) {
+    int kb = deadbeef->conf_get_int(CONF_SAVED_ORDERS_CACHE_KB, DEFAULT_SAVED_ORDERS_CACHE_KB);
+    return kb > 0 ? (size_t)kb * 1024 : 0;
+}
+
+// Memory a saved order holds, as accounted in the cache
+static size_t savedPlaylistBytes(const SavedPlaylist *sp) {
+    size_t key = sp->criteria_key ? strlen(sp->criteria_key) + 1 : 0;
+    return sizeof(SavedPlaylist) + sp->order.bytes + sp->blocks.bytes + key;
+}
+
+// Packs the order positions the blocks of a block order start at
+static int packBlockStarts(PackedOrder *out, const BlockOrder *blocks, size_t length) {
+    int *starts = malloc(blocks->count * sizeof(int));
+    if (!starts) {
+        trace_error("Memory allocation failed in packBlockStarts\n");
+        return -1;
+    }
+    for (size_t s = 0; s < blocks->count; s++) {
+        starts[s] = (int)blocks->offsets[s];
+    }
+    int result = packed_order_encode(out, starts, blocks->count, (uint32_t)length);
+    free(starts);
+    return result;
+}
+
+// Finds a saved playlist by ID; the caller holds playlist_mutex
+static SavedPlaylist* find_saved_playlist(int plt_id) {
+    uint32_t key = playlistIdentity(plt_id);
+    return key ? order_cache_get(&saved_playlists, key) : NULL;
+}
+
+// Saves the current playlist state
+static void save_current_playlist(int plt_id) {
+    SavedPlaylist *sp = calloc(1, sizeof(SavedPlaylist));
+    if (!sp) {
+        trace_error("Memory allocation failed in save_current_playlist\n");
+        return;
+    }
+    
+    // Pack the published order; a lazy order is saved as its seed alone and
+    // a block order in play order
+    int count = deadbeef->pl_getcount(PL_MAIN);
+    sp->track_count = count > 0 ? (size_t)count : 0;
+    OrderSnapshot *snap = acquireOrder();
+    int result = 0;
+    if (snap) {
+        sp->lazy = snap->lazy;
+        if (!snap->lazy.active && snap->playlist.array) {
+            const int *order = snap->playlist.array;
+            int *expanded = NULL;
+            if (snap->blocks.count) {
+                expanded = malloc(snap->playlist.used * sizeof(int));
+                if (expanded) {
+                    block_order_expand(&snap->blocks, snap->playlist.array, expanded);
+                } else {
+                    trace_error("Memory allocation failed in save_current_playlist\n");
+                }
+                order = expanded;
+            }
+            result = order ? packed_order_encode(&sp->order, order, snap->playlist.used, (uint32_t)sp->track_count) : -1;
+            free(expanded);
+            if (result == 0 && snap->blocks.count) {
+                result = packBlockStarts(&sp->blocks, &snap->blocks, snap->playlist.used);
+            }
+        }
+    }
+    releaseOrder(snap);
+    if (result != 0) {
+        freeSavedPlaylist(sp);
+        return;
+    }
+    sp->order_seed = state.order_seed;
+    sp->play_mode = state.play_mode;
+    sp->fingerprint = playlistFingerprint();
+    sp->cursor = __atomic_load_n(&state.current_played_item, __ATOMIC_ACQUIRE);
+
+    if (lock_mutex(&playlist_mutex, "save_current_playlist") != 0) {
+        freeSavedPlaylist(sp);
+        return;
+    }
+    // Builds write these under playlist_mutex
+    sp->is_shuffled = state.is_shuffled;
+    sp->criteria_key = state.criteria_key[0] ? strdup(state.criteria_key) : NULL;
+    uint32_t key = playlistIdentity(plt_id);
+    order_cache_set_budget(&saved_playlists, savedOrdersBudget());
+    if (!key || order_cache_put(&saved_playlists, key, sp, savedPlaylistBytes(sp)) != 0) {
+        freeSavedPlaylist(sp);
+    }
+    unlock_mutex(&playlist_mutex, "save_current_playlist");
+}
+
+// Decodes a saved stored order and its album blocks into the draft;
+// returns -1 if nothing was stored or it cannot be decoded
+static int decodeSavedOrder(const SavedPlaylist *sp) {
+    size_t length = packed_order_length(&sp->order);
+    if (sp->order.kind == PACKED_NONE || length == 0) return -1;
+    if (initArray(&state.playlist, length) != 0) return -1;
+    packed_order_decode(&sp->order, state.playlist.array);
+    state.playlist.used = length;
+    if (sp->blocks.kind != PACKED_NONE) {
+        // The order was saved in play order, so its blocks start out in
+        // sequence over it
+        size_t count = packed_order_length(&sp->blocks);
+        int *starts = malloc(count * sizeof(int));
+        if (!starts) {
+            trace_error("Memory allocation failed in decodeSavedOrder\n");
+            return -1;
+        }
+        packed_order_decode(&sp->blocks, starts);
+        int result = block_order_split(&state.blocks, starts, count, length);
+        free(starts);
+        if (result != 0) return -1;
+    }
+    rebuildPositionIndex(&state.positions, &state.playlist);
+    return 0;
+}
+
+// Loads a saved playlist
+static int load_saved_playlist(int plt_id) {
+    cancelBuild();
+    if (lock_mutex(&playlist_mutex, "load_saved_playlist") != 0) return 0;
+    adoptCurrentPlaylist(plt_id);
+    SavedPlaylist *sp = find_saved_playlist(plt_id);
+    int count = deadbeef ? deadbeef->pl_getcount(PL_MAIN) : 0;
+    int same_tracks = sp && sp->track_count == (size_t)(count > 0 ? count : 0) &&
+                      sp->fingerprint == playlistFingerprint();
+    if (sp && !sp->lazy.active && !same_tracks) {
+        // Stored indices no longer match the playlist; rebuild instead
+        order_cache_remove(&saved_playlists, playlistIdentity(plt_id));
+        sp = NULL;
+    }
+    if (!sp) {
+        unlock_mutex(&playlist_mutex, "load_saved_playlist");
+        return 0;
+    }
+    
+    freeArray(&state.playlist);
+    freePositionIndex(&state.positions);
+    block_order_free(&state.blocks);
+    if (!sp->lazy.active && decodeSavedOrder(sp) != 0) {
+        // Nothing usable was stored; the caller builds the order again
+        freeArray(&state.playlist);
+        block_order_free(&state.blocks);
+        order_cache_remove(&saved_playlists, playlistIdentity(plt_id));
+        unlock_mutex(&playlist_mutex, "load_saved_playlist");
+        return 0;
+    }
+    state.lazy = sp->lazy;
+    state.order_seed = sp->order_seed;
+    if (state.lazy.active) {
+        // The playlist may have changed size while it was not current
+        permutation_init(&state.lazy.perm, count > 0 ? (uint64_t)count : 0, state.lazy.perm.seed);
+        state.lazy.active = count > 0;
+    }
+    state.play_mode = sp->play_mode;
+    state.is_shuffled = sp->is_shuffled;
+    safe_strncpy(state.criteria_key, sp->criteria_key ? sp->criteria_key : "", sizeof(state.criteria_key));
+    // Resume where the order was left; the caller syncs the cursor to the
+    // playing track afterwards. A lazy order over changed tracks restarts.
+    size_t order_length = state.lazy.active ? (size_t)count : state.playlist.used;
+    state.draft_cursor = same_tracks && sp->cursor > 0 && (size_t)sp->cursor < order_length ? sp->cursor : 0;
+    publishDraft();
+    unlock_mutex(&playlist_mutex, "load_saved_playlist");
+    return 1;
+}
+
+// Whether the order can be computed on demand instead of being stored
+static int useLazyOrder(int shuffle_mode) {
+    if (!deadbeef->conf_get_int(CONF_LAZY_ORDER, 1)) return 0;
+    return state.play_mode == PURE_RANDOM || (state.play_mode == PLAYLIST && shuffle_mode != DDB_SHUFFLE_OFF);
+}
+
+// Sets up a lazy shuffled order over the whole playlist; nothing is stored
+// per track, so switching to it costs the same for any playlist size
+static void buildLazyOrder(void) {
+    int count = deadbeef->pl_getcount(PL_MAIN);
+    freeArray(&state.playlist);
+    initArray(&state.playlist, INITIAL_ARRAY_SIZE);
+    freePositionIndex(&state.positions);
+    block_order_free(&state.blocks);
+    state.order_seed = rng_next(&state.rng);
+    permutation_init(&state.lazy.perm, count > 0 ? (uint64_t)count : 0, state.order_seed);
+    state.lazy.active = count > 0;
+    state.lazy.sorted = 0;
+    state.draft_cursor = 0;
+}
+
+// Builds a stored order for the active mode and shuffles it if needed
+static int buildStoredOrder(int plt_id, int shuffle_mode) {
+    state.lazy.active = 0;
+    block_order_free(&state.blocks);
+    // Every draw of the build comes from order_rng, so the seed alone
+    // reproduces the order for the same playlist
+    state.order_seed = rng_next(&state.rng);
+    rng_seed(&state.order_rng, state.order_seed);
+    if (resetPlaylist(&state.playlist) != 0) {
+        trace_error("Failed to reset playlist array\n");
+        return -1;
+    }
+    clearPositionIndex(&state.positions, state.playlist.size);
+    // Builders read the snapshot columns and never take pl_lock themselves
+    // Album shuffle reads the album keys on top of the mode's columns
+    unsigned columns = modeColumns(state.play_mode);
+    if (shuffle_mode == DDB_SHUFFLE_ALBUMS && state.play_mode != PURE_RANDOM && state.play_mode != SMART_RANDOM) {
+        columns |= TRACK_COLUMNS_KEYS;
+    }
+    if (snapshotTracks(plt_id, columns) != 0) {
+        return -1;
+    }
+
+    switch (state.play_mode) {
+        case PLAYLIST:
+            createDefaultList();
+            break;
+        case KEEP_ALBUM:
+            createPlaylistByCriteria(KEEP_ALBUM);
+            break;
+        case KEEP_ARTIST:
+            createPlaylistByCriteria(KEEP_ARTIST);
+            break;
+        case KEEP_GENRE:
+            createPlaylistByCriteria(KEEP_GENRE);
+            break;
+        case KEEP_YEAR:
+            createPlaylistByCriteria(KEEP_YEAR);
+            break;
+        case TOP_RATED_SONGS:
+            createPlaylistByCriteria(TOP_RATED_SONGS);
+            break;
+        case SELECTION:
+            createPlaylistByCriteria(SELECTION);
+            break;
+        case PURE_RANDOM:
+            createPureRandomList();
+            break;
+        case SMART_RANDOM:
+            createSmartRandomList();
+            break;
+    }
+    if (buildCancelled()) {
+        // The published order may predate the snapshot taken for the
+        // abandoned build; without one, the next change rebuilds
+        releaseTrackSnapshot(&state.tracks);
+        facet_index_free(&state.facets);
+        return -1;
+    }
+
+    const uint32_t *albums = (state.tracks.columns & TRACK_COLUMNS_KEYS) ? state.tracks.keys[FACET_ALBUM] : NULL;
+    applyShuffle(&state.playlist, &state.positions, &state.blocks, albums, &state.order_rng,
+                 shuffle_mode, state.play_mode, &state.draft_cursor);
+    return 0;
+}
+
+// Generates the current playlist based on selected mode. Runs on the
+// build worker; a cancelled build publishes nothing and readers keep the
+// previous order.
+static void createSongList(void) {
+    if (!isPlaybackActive()) {
+        notifyIfEmpty();
+        return;
+    }
+
+    int plt_id = deadbeef->plt_get_curr_idx();
+    if (lock_mutex(&playlist_mutex, "createSongList") != 0) {
+        return;
+    }
+    adoptCurrentPlaylist(plt_id);
+    SavedPlaylist *sp = find_saved_playlist(plt_id);
+    int rebuild = !sp || sp->play_mode != state.play_mode || (sp->order.kind == PACKED_NONE && !sp->lazy.active);
+    unlock_mutex(&playlist_mutex, "createSongList");
+
+    if (rebuild) {
+        trace("Generating new playlist for mode: %d\n", state.play_mode);
+        uint64_t started = metrics_now_ns();
+        
+        // Builders fill the draft without locking per entry; the mutex only
+        // keeps writers apart, readers keep using the published order
+        if (lock_mutex(&playlist_mutex, "createSongList") != 0) {
+            return;
+        }
+        int shuffle_mode = deadbeef->streamer_get_shuffle();
+        int lazy = useLazyOrder(shuffle_mode);
+        int result = 0;
+        if (lazy) {
+            buildLazyOrder();
+        } else {
+            result = buildStoredOrder(plt_id, shuffle_mode);
+        }
+        if (buildCancelled()) {
+            trace("Build for mode %d cancelled by a newer request\n", state.play_mode);
+            __atomic_add_fetch(&worker.cancelled, 1, __ATOMIC_RELAXED);
+            result = -1;
+        }
+        if (result == 0) {
+            state.is_shuffled = shuffle_mode != DDB_SHUFFLE_OFF || state.play_mode == PURE_RANDOM || state.play_mode == SMART_RANDOM;
+            result = publishDraft();
+        }
+        if (result == 0) {
+            // Saved before unlocking, so a playlist switch cannot come between
+            save_current_playlist(plt_id);
+            if (state.play_mode <= KEEP_YEAR) {
+                metrics_record(&metrics.generate[state.play_mode], metrics_now_ns() - started);
+            }
+        }
+        unlock_mutex(&playlist_mutex, "createSongList");
+        if (result != 0) {
+            return;
+        }
+
+        syncCurrentPlayedItem();
+        
+        trace_info("Generated playlist with %zu items%s\n", playback_order_length(), lazy ? " (lazy)" : "");
+    }
+
+    notifyIfEmpty();
+}
+
+// Places the last entry of the order at a random position after the cursor,
+// so tracks added to a shuffled order are still played in random order
+static void scatterLastEntry(Array *a, int currentItem, Rng *rng) {
+    if (a->used < 2) return;
+    size_t last = a->used - 1;
+    size_t first = currentItem >= 0 ? (size_t)currentItem + 1 : 0;
+    if (first >= last) return;
+    size_t j = first + (size_t)rng_bounded(rng, last - first + 1);
+    int temp = a->array[last];
+    a->array[last] = a->array[j];
+    a->array[j] = temp;
+}
+
+// Resizes a lazy order to the changed playlist. The seed is kept, so the
+// order only depends on the new track count; the cursor follows the track.
+static int patchLazyOrder(void) {
+    int count = deadbeef->pl_getcount(PL_MAIN);
+    if (count <= 0) return -1;
+    if (lock_mutex(&playlist_mutex, "patchLazyOrder") != 0) return -1;
+    // Patches only need the new track count; without a diff of the tracks
+    // the snapshot and facets cannot be carried over
+    releaseTrackSnapshot(&state.tracks);
+    facet_index_free(&state.facets);
+    int result = copyPublishedToDraft();
+    if (result == 0 && state.lazy.active) {
+        if ((uint64_t)count != state.lazy.perm.count) {
+            permutation_init(&state.lazy.perm, (uint64_t)count, state.lazy.perm.seed);
+        }
+        result = publishDraft();
+    }
+    unlock_mutex(&playlist_mutex, "patchLazyOrder");
+    if (result == 0) {
+        syncCurrentPlayedItem();
+    }
+    return result;
+}
+
+// Carries the facet index over a playlist change, filing the inserted
+// tracks from the fresh snapshot's columns. A change without structural edits may have been a
+// tag edit, so the index is dropped then, as it is when the order is
+// rebuilt anyway. Call with playlist_mutex held.
+static void patchFacetIndex(const PlaylistDiff *diff, const TrackSnapshot *fresh, int drop) {
+    if (!state.facets.valid) return;
+    if (drop || facet_index_patch(&state.facets, diff) != 0) {
+        facet_index_free(&state.facets);
+        return;
+    }
+    for (size_t k = 0; k < diff->inserted_count; k++) {
+        int index = diff->inserted[k];
+        if (!(fresh->columns & TRACK_COLUMNS_KEYS) || indexTrackFacets(fresh, (size_t)index) != 0) {
+            facet_index_free(&state.facets);
+            return;
+        }
+    }
+}
+
+// Moves the played bits of the current playlist along with their tracks
+// through a playlist diff. Call with playlist_mutex held and pl_lock not.
+static void remapPlayedSet(const PlaylistDiff *diff, size_t count) {
+    pthread_mutex_lock(&ahead.mutex);
+    PlayedSet *set = played.current;
+    if (set && set->marked > 0 && played.playlist == state.tracks.playlist && set->count == state.tracks.count) {
+        PlayedSet moved;
+        if (played_set_init(&moved, count) == 0) {
+            for (size_t i = 0; i < set->count; i++) {
+                int mapped = played_set_test(set, i) ? playlist_diff_map(diff, (int)i) : -1;
+                if (mapped >= 0) played_set_mark(&moved, (size_t)mapped);
+            }
+            played_set_free(set);
+            *set = moved;
+            played.generation = 0;
+        }
+    }
+    pthread_mutex_unlock(&ahead.mutex);
+}
+
+// Brings the draft up to date with a change of tags, ratings or selection
+// that moved no track: entries whose track no longer matches the mode are
+// dropped and newly matching tracks added, the rest keep their places.
+// SMART_RANDOM draws depend on every rating, so the draws after the next
+// entry, which the streamer may already hold, are made again. Call with
+// playlist_mutex held and the mode's columns read into fresh; publishes on
+// success.
+static int refilterSongList(const TrackSnapshot *fresh) {
+    if (copyPublishedToDraft() != 0 || state.blocks.count) {
+        return -1;
+    }
+    if (state.play_mode == SMART_RANDOM) {
+        WeightedSampler sampler;
+        size_t length = state.playlist.used;
+        size_t keep = state.draft_cursor >= 0 ? (size_t)state.draft_cursor + 2 : 0;
+        if (keep > length) keep = length;
+        if (length == 0 || buildRatingSampler(&sampler, fresh) != 0) return -1;
+        state.playlist.used = keep;
+        appendWeightedDraws(&sampler, keep > 0 ? state.playlist.array[keep - 1] : -1, length);
+        weighted_sampler_free(&sampler);
+        if (state.playlist.used != length) return -1;
+        rebuildPositionIndex(&state.positions, &state.playlist);
+        trace("Redrew %zu of %zu weighted entries\n", length - keep, length);
+        return publishDraft();
+    }
+    char *listed = calloc(fresh->count ? fresh->count : 1, 1);
+    if (!listed) return -1;
+
+    // Keep the matching entries; the cursor stays on its track, or moves to
+    // the entry that followed a dropped one
+    int cursor = state.draft_cursor;
+    int new_cursor = -1;
+    size_t kept = 0, dropped = 0;
+    for (size_t i = 0; i < state.playlist.used; i++) {
+        if ((int)i == cursor) new_cursor = (int)kept;
+        int index = state.playlist.array[i];
+        if (index < 0 || (size_t)index >= fresh->count || !countTrackEntries(fresh, (size_t)index)) {
+            dropped++;
+            continue;
+        }
+        listed[index] = 1;
+        state.playlist.array[kept++] = index;
+    }
+    state.playlist.used = kept;
+    if (new_cursor < 0 || new_cursor >= (int)kept) new_cursor = kept > 0 ? (int)kept - 1 : 0;
+
+    size_t added = 0;
+    for (size_t index = 0; index < fresh->count; index++) {
+        if (listed[index] || !countTrackEntries(fresh, index)) continue;
+        if (insertArray(&state.playlist, (int)index) != 0) break;
+        if (state.is_shuffled) {
+            scatterLastEntry(&state.playlist, new_cursor, &state.rng);
+        }
+        added++;
+    }
+    free(listed);
+    if (state.playlist.used == 0) {
+        // Nothing matches any more; the build falls back like a fresh one
+        return -1;
+    }
+
+    int value = state.playlist.array[new_cursor];
+    if (!state.is_shuffled && !isSortedArray(&state.playlist)) {
+        qsort(state.playlist.array, state.playlist.used, sizeof(int), sortArray);
+    }
+    rebuildPositionIndex(&state.positions, &state.playlist);
+    int pos = lookupPosition(&state.positions, &state.playlist, value);
+    state.draft_cursor = pos >= 0 ? pos : 0;
+    trace("Refiltered order: %zu entries dropped, %zu added, %zu entries\n", dropped, added, state.playlist.used);
+    return publishDraft();
+}
+
+// Applies a playlist change to the current order instead of rebuilding it:
+// entries are remapped through an identity diff of the playlist, removed
+// tracks are dropped and only inserted tracks are looked at. The edit runs
+// on a private copy that is published when done. Returns -1 when the order
+// has to be rebuilt from scratch.
+static int patchSongList(int plt_id) {
+    OrderSnapshot *current = acquireOrder();
+    int lazy = current && current->lazy.active;
+    // Album runs change with the edit, so a block order is rebuilt
+    int stored = current && current->playlist.array && !current->blocks.count;
+    releaseOrder(current);
+    if (lazy) {
+        return patchLazyOrder();
+    }
+    if (state.tracks.plt_id != plt_id || !state.tracks.items || !stored) {
+        return -1;
+    }
+    if (lock_mutex(&playlist_mutex, "patchSongList") != 0) return -1;
+    int same_playlist = state.tracks.playlist == playlistIdentity(plt_id);
+    unlock_mutex(&playlist_mutex, "patchSongList");
+    if (!same_playlist) {
+        return -1;
+    }
+    ddb_playlist_t *plt = deadbeef->plt_get_curr();
+    if (!plt) return -1;
+
+    TrackSnapshot fresh = { .items = NULL, .count = 0, .plt_id = -1 };
+    PlaylistDiff diff;
+
+    if (lock_mutex(&playlist_mutex, "patchSongList") != 0) {
+        deadbeef->plt_unref(plt);
+        return -1;
+    }
+    deadbeef->pl_lock();
+    if (captureTrackSnapshot(&fresh, plt, plt_id) != 0 ||
+        playlist_diff_compute(&diff, (void *const *)state.tracks.items, state.tracks.count,
+                              (void *const *)fresh.items, fresh.count) != 0) {
+        deadbeef->pl_unlock();
+        unlock_mutex(&playlist_mutex, "patchSongList");
+        releaseTrackSnapshot(&fresh);
+        deadbeef->plt_unref(plt);
+        return -1;
+    }
+
+    size_t changed = playlist_diff_span(&diff) + diff.inserted_count;
+    // Remapping is cheap, metadata is only read for inserted tracks; when
+    // most of the playlist is new a full rebuild costs the same
+    int rebuild = diff.inserted_count > (fresh.count + 1) / 2;
+    // Nothing moved, so tags, ratings or the selection changed and the
+    // columns the mode reads are read again
+    unsigned refilter = changed == 0 ? modeColumns(state.play_mode) : 0;
+    RawTrackKeys raw;
+    int failed = 0;
+    if (refilter) {
+        failed = captureTrackMetadata(&fresh, refilter, &raw) != 0;
+    } else if (changed > 0 && !rebuild) {
+        failed = carryTrackMetadata(&state.tracks, &fresh, &diff, &raw) != 0;
+    } else {
+        memset(&raw, 0, sizeof(raw));
+    }
+    // Keys are parsed and interned once the host can go on
+    deadbeef->pl_unlock();
+    if (!failed && internTrackKeys(&fresh, &raw) != 0) {
+        failed = 1;
+    }
+    freeRawTrackKeys(&raw);
+    if (changed > 0 && !rebuild && (failed || (modeColumns(state.play_mode) & ~fresh.columns))) {
+        rebuild = 1;
+    }
+    patchFacetIndex(&diff, &fresh, changed == 0 || rebuild);
+    if (changed == 0) {
+        // The tags of any track may have changed
+        freeTrackColumns(&state.tracks);
+    }
+    if (refilter) {
+        int result = failed ? -1 : refilterSongList(&fresh);
+        if (result == 0) {
+            fresh.playlist = state.tracks.playlist;
+            releaseTrackSnapshot(&state.tracks);
+            state.tracks = fresh;
+        } else {
+            releaseTrackSnapshot(&fresh);
+        }
+        unlock_mutex(&playlist_mutex, "patchSongList");
+        playlist_diff_free(&diff);
+        deadbeef->plt_unref(plt);
+        return result;
+    }
+    if (changed == 0 || rebuild || copyPublishedToDraft() != 0 || state.blocks.count) {
+        if (rebuild) {
+            trace("Playlist change inserts %zu of %zu tracks, rebuilding\n", diff.inserted_count, fresh.count);
+        }
+        // With nothing changed the order reads no metadata and is still valid
+        if (changed > 0) {
+            remapPlayedSet(&diff, fresh.count);
+        }
+        unlock_mutex(&playlist_mutex, "patchSongList");
+        playlist_diff_free(&diff);
+        releaseTrackSnapshot(&fresh);
+        deadbeef->plt_unref(plt);
+        return changed == 0 ? 0 : -1;
+    }
+
+    // Remap surviving entries and drop removed ones; the cursor stays on
+    // its track, or moves to the entry that followed a removed one
+    int cursor = state.draft_cursor;
+    int new_cursor = -1;
+    size_t kept = 0;
+    for (size_t i = 0; i < state.playlist.used; i++) {
+        if ((int)i == cursor) new_cursor = (int)kept;
+        int mapped = playlist_diff_map(&diff, state.playlist.array[i]);
+        if (mapped < 0) continue;
+        // Dropping a track must not leave two SMART_RANDOM draws of one track adjacent
+        if (state.play_mode == SMART_RANDOM && kept > 0 && state.playlist.array[kept - 1] == mapped) {
+            if ((int)i == cursor) new_cursor = (int)kept - 1;
+            continue;
+        }
+        state.playlist.array[kept++] = mapped;
+    }
+    state.playlist.used = kept;
+    if (new_cursor < 0 || new_cursor >= (int)kept) new_cursor = kept > 0 ? (int)kept - 1 : 0;
+
+    size_t added = 0;
+    reserveArray(&state.playlist, state.playlist.used + diff.inserted_count);
+    for (size_t k = 0; k < diff.inserted_count; k++) {
+        int index = diff.inserted[k];
+        int entries = countTrackEntries(&fresh, (size_t)index);
+        for (int e = 0; e < entries; e++) {
+            if (insertArray(&state.playlist, index) != 0) break;
+            if (state.is_shuffled) {
+                scatterLastEntry(&state.playlist, new_cursor, &state.rng);
+            }
+            added++;
+        }
+    }
+    remapPlayedSet(&diff, fresh.count);
+
+    int value = state.playlist.used > 0 ? state.playlist.array[new_cursor] : -1;
+    if (!state.is_shuffled && !isSortedArray(&state.playlist)) {
+        qsort(state.playlist.array, state.playlist.used, sizeof(int), sortArray);
+    }
+    // Indices of most tracks moved, so the index is rebuilt in one pass
+    rebuildPositionIndex(&state.positions, &state.playlist);
+    int pos = lookupPosition(&state.positions, &state.playlist, value);
+    state.draft_cursor = pos >= 0 ? pos : 0;
+    size_t entries = state.playlist.used;
+    int result = publishDraft();
+    fresh.playlist = state.tracks.playlist;
+    releaseTrackSnapshot(&state.tracks);
+    state.tracks = fresh;
+    unlock_mutex(&playlist_mutex, "patchSongList");
+
+    trace("Patched order: %zu removed, %zu moved, %zu inserted (%zu entries added), %zu entries\n",
+          diff.removed_count, diff.moved_count, diff.inserted_count, added, entries);
+
+    playlist_diff_free(&diff);
+    deadbeef->plt_unref(plt);
+    return result;
+}
+
+// Drops the track snapshot and facet index if they describe the given
+// playlist, or with others set any other one, so the next build reads it
+// again
+static void forgetPlaylistTracks(int plt_id, int others) {
+    if (lock_mutex(&playlist_mutex, "forgetPlaylistTracks") != 0) return;
+    uint32_t playlist = findPlaylistIdentity(plt_id);
+    int facets = state.facets.valid && playlist && state.facets.playlist == playlist;
+    int tracks = state.tracks.items && playlist && state.tracks.playlist == playlist;
+    if (state.facets.valid && facets != others) {
+        facet_index_free(&state.facets);
+    }
+    if (state.tracks.items && tracks != others) {
+        releaseTrackSnapshot(&state.tracks);
+    }
+    unlock_mutex(&playlist_mutex, "forgetPlaylistTracks");
+}
+
+// Runs one build on the calling thread; mark is the cancel counter the
+// build started with
+static void runBuild(uint64_t mark) {
+    build_cancel_mark = mark;
+    build_active = 1;
+    createSongList();
+    build_active = 0;
+}
+
+// Drops the saved order of a playlist
+static void dropSavedOrder(int plt_id) {
+    if (lock_mutex(&playlist_mutex, "dropSavedOrder") != 0) return;
+    uint32_t key = playlistIdentity(plt_id);
+    if (key) {
+        order_cache_remove(&saved_playlists, key);
+    }
+    unlock_mutex(&playlist_mutex, "dropSavedOrder");
+}
+
+// Brings the order up to date with a change of the playlist: patches it
+// when possible and rebuilds it otherwise
+static void applyPlaylistChange(int plt_id, uint64_t mark) {
+    // The user may have switched playlists while the change was pending
+    if (plt_id != deadbeef->plt_get_curr_idx()) {
+        forgetPlaylistTracks(plt_id, 0);
+        return;
+    }
+    uint64_t started = metrics_now_ns();
+    if (deadbeef->conf_get_int(CONF_INCREMENTAL_UPDATES, 1) && patchSongList(plt_id) == 0) {
+        save_current_playlist(plt_id);
+    } else {
+        forgetPlaylistTracks(plt_id, 0);
+        dropSavedOrder(plt_id);
+        runBuild(mark);
+    }
+    metrics_record(&metrics.changes, metrics_now_ns() - started);
+}
+
+// Quiet period after a playlist change, from the configuration
+static int changeQuietMs(void) {
+    int ms = deadbeef->conf_get_int(CONF_CHANGE_QUIET_MS, DEFAULT_CHANGE_QUIET_MS);
+    return ms > 0 ? ms : 0;
+}
+
+// Whether the quiet period after the newest change has passed; call with
+// worker.mutex held
+static int changesSettled(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec > worker.quiet_until.tv_sec ||
+           (now.tv_sec == worker.quiet_until.tv_sec && now.tv_nsec >= worker.quiet_until.tv_nsec);
+}
+
+// Build worker loop: sleeps until a request arrives, then builds for the
+// newest epoch. Requests arriving meanwhile cancel it and are served by the
+// next pass. Pending playlist changes are applied in the same pass once
+// they have settled.
+static void *buildWorkerMain(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&worker.mutex);
+    while (!worker.stop) {
+        int build = worker.handled != worker.requested;
+        int change = worker.patched != worker.changed;
+        if (change && !changesSettled()) {
+            if (!build) {
+                pthread_cond_timedwait(&worker.wake, &worker.mutex, &worker.quiet_until);
+                continue;
+            }
+            change = 0;
+        }
+        if (!build && !change) {
+            pthread_cond_wait(&worker.wake, &worker.mutex);
+            continue;
+        }
+        uint64_t epoch = worker.requested;
+        uint64_t changes = worker.changed;
+        int plt_id = worker.change_plt;
+        uint64_t mark = __atomic_load_n(&worker.cancel, __ATOMIC_ACQUIRE);
+        if (build) worker.coalesced += epoch - worker.handled - 1;
+        if (change) worker.coalesced += changes - worker.patched - 1;
+        worker.passes++;
+        pthread_mutex_unlock(&worker.mutex);
+
+        if (change) {
+            applyPlaylistChange(plt_id, mark);
+        }
+        if (build) {
+            runBuild(mark);
+        }
+        // The order the window came from may have been replaced
+        refreshLookahead();
+
+        pthread_mutex_lock(&worker.mutex);
+        if (build) worker.handled = epoch;
+        if (change) worker.patched = changes;
+        pthread_cond_broadcast(&worker.done);
+    }
+    // Nothing is built any more; release anyone waiting
+    worker.handled = worker.requested;
+    worker.patched = worker.changed;
+    pthread_cond_broadcast(&worker.done);
+    pthread_mutex_unlock(&worker.mutex);
+    return NULL;
+}
+
+// Starts the build worker; without it builds run inline
+static void startBuildWorker(void) {
+    pthread_mutex_lock(&worker.mutex);
+    worker.stop = 0;
+    worker.handled = worker.requested;
+    worker.patched = worker.changed;
+    // The quiet period is timed on the monotonic clock
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&worker.wake, &attr);
+    pthread_condattr_destroy(&attr);
+    worker.running = pthread_create(&worker.thread, NULL, buildWorkerMain, NULL) == 0;
+    if (!worker.running) {
+        trace_warn("Failed to start build worker, building inline\n");
+    }
+    pthread_mutex_unlock(&worker.mutex);
+}
+
+// Cancels the build in progress and joins the worker
+static void stopBuildWorker(void) {
+    pthread_mutex_lock(&worker.mutex);
+    if (!worker.running) {
+        pthread_mutex_unlock(&worker.mutex);
+        return;
+    }
+    worker.stop = 1;
+    cancelBuild();
+    pthread_cond_signal(&worker.wake);
+    pthread_mutex_unlock(&worker.mutex);
+
+    pthread_join(worker.thread, NULL);
+
+    pthread_mutex_lock(&worker.mutex);
+    worker.running = 0;
+    pthread_cond_destroy(&worker.wake);
+    pthread_mutex_unlock(&worker.mutex);
+}
+
+// Queues a build of the order for the current playlist and mode, cancelling
+// the one in progress. Builds inline when the worker is not running.
+static void requestBuild(void) {
+    pthread_mutex_lock(&worker.mutex);
+    worker.requests++;
+    if (worker.running) {
+        worker.requested++;
+        cancelBuild();
+        pthread_cond_signal(&worker.wake);
+        pthread_mutex_unlock(&worker.mutex);
+        return;
+    }
+    pthread_mutex_unlock(&worker.mutex);
+    runBuild(__atomic_load_n(&worker.cancel, __ATOMIC_ACQUIRE));
+    refreshLookahead();
+}
+
+// Marks the order of a playlist dirty; the worker applies the change once
+// the playlist has been quiet for the configured period, so a burst of
+// changes costs one update. Applied inline when the worker is not running.
+static void requestPlaylistChange(int plt_id) {
+    pthread_mutex_lock(&worker.mutex);
+    worker.requests++;
+    if (worker.running) {
+        worker.changed++;
+        worker.change_plt = plt_id;
+        int ms = changeQuietMs();
+        clock_gettime(CLOCK_MONOTONIC, &worker.quiet_until);
+        worker.quiet_until.tv_sec += ms / 1000;
+        worker.quiet_until.tv_nsec += (long)(ms % 1000) * 1000000L;
+        if (worker.quiet_until.tv_nsec >= 1000000000L) {
+            worker.quiet_until.tv_sec++;
+            worker.quiet_until.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_signal(&worker.wake);
+        pthread_mutex_unlock(&worker.mutex);
+        return;
+    }
+    pthread_mutex_unlock(&worker.mutex);
+    applyPlaylistChange(plt_id, __atomic_load_n(&worker.cancel, __ATOMIC_ACQUIRE));
+    refreshLookahead();
+}
+
+// Blocks until the worker has handled every request and playlist change
+// made so far
+static void waitForBuilds(void) {
+    pthread_mutex_lock(&worker.mutex);
+    uint64_t epoch = worker.requested;
+    uint64_t changes = worker.changed;
+    while (worker.running && (worker.handled < epoch || worker.patched < changes)) {
+        pthread_cond_wait(&worker.done, &worker.mutex);
+    }
+    pthread_mutex_unlock(&worker.mutex);
+}
+
+// Path of the order file in the DeaDBeeF configuration directory; returns
+// -1 if orders are not persisted
+static int orderFilePath(char *path, size_t size) {
+    if (!deadbeef->conf_get_int(CONF_PERSIST_ORDERS, 1) || !deadbeef->get_system_dir) return -1;
+    const char *dir = deadbeef->get_system_dir(DDB_SYS_DIR_CONFIG);
+    if (!dir || !*dir) return -1;
+    int len = snprintf(path, size, "%s/%s", dir, ORDER_FILE_NAME);
+    return len > 0 && (size_t)len < size ? 0 : -1;
+}
+
+typedef struct {
+    int orders;
+    int played;
+} RestoredCounts;
+
+// Adds an order read from the order file to the saved orders; its tables
+// are copied out of the mapped file
+static void restoreStoredOrder(const StoredOrder *record, void *data) {
+    if (record->play_mode > KEEP_YEAR || record->playlist == 0) return;
+    SavedPlaylist *sp = calloc(1, sizeof(SavedPlaylist));
+    if (!sp) {
+        trace_error("Memory allocation failed in restoreStoredOrder\n");
+        return;
+    }
+    if (packed_order_copy(&sp->order, &record->order) != 0 ||
+        ((record->flags & ORDER_STORE_BLOCKS) && packed_order_copy(&sp->blocks, &record->blocks) != 0) ||
+        ((record->flags & ORDER_STORE_CRITERIA) && !(sp->criteria_key = strdup(record->criteria_key)))) {
+        freeSavedPlaylist(sp);
+        return;
+    }
+    if (record->flags & ORDER_STORE_LAZY) {
+        permutation_init(&sp->lazy.perm, record->track_count, record->lazy_seed);
+        sp->lazy.active = 1;
+        sp->lazy.sorted = (record->flags & ORDER_STORE_SORTED) != 0;
+    }
+    sp->order_seed = record->order_seed;
+    sp->play_mode = (PlayModes)record->play_mode;
+    sp->track_count = record->track_count;
+    sp->fingerprint = record->fingerprint;
+    sp->cursor = record->cursor;
+    sp->is_shuffled = (record->flags & ORDER_STORE_SHUFFLED) != 0;
+    if (order_cache_put(&saved_playlists, record->playlist, sp, savedPlaylistBytes(sp)) != 0) {
+        freeSavedPlaylist(sp);
+        return;
+    }
+    ((RestoredCounts *)data)->orders++;
+}
+
+// Adds a played set read from the order file; its words are copied out of
+// the mapped file
+static void restorePlayedSet(const StoredPlayed *record, void *data) {
+    if (record->playlist == 0) return;
+    PlayedSet *set = malloc(sizeof(PlayedSet));
+    if (!set || played_set_load(set, record->words, record->track_count) != 0) {
+        trace_error("Failed to restore a played set\n");
+        free(set);
+        return;
+    }
+    if (order_cache_put(&played.sets, record->playlist, set, sizeof(PlayedSet) + played_set_bytes(set)) != 0) {
+        freePlayedSet(set);
+        return;
+    }
+    ((RestoredCounts *)data)->played++;
+}
+
+// Reads the orders saved by the previous session into the saved orders
+static void restoreSavedOrders(void) {
+    char path[4096];
+    if (orderFilePath(path, sizeof(path)) != 0) return;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    RestoredCounts restored = { 0, 0 };
+    if (lock_mutex(&playlist_mutex, "restoreSavedOrders") != 0) return;
+    pthread_mutex_lock(&ahead.mutex);
+    int read = order_store_read(path, restoreStoredOrder, restorePlayedSet, &restored);
+    pthread_mutex_unlock(&ahead.mutex);
+    unlock_mutex(&playlist_mutex, "restoreSavedOrders");
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (read >= 0) {
+        trace_info("Restored %d of %d saved orders and %d played sets in %.3f ms\n", restored.orders, read, restored.played,
+              (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+    }
+}
+
+typedef struct {
+    StoredOrder *records;
+    size_t count;
+    StoredPlayed *played;
+    size_t played_count;
+} StoredOrders;
+
+// Adds a saved order to the records to write; the tables are borrowed
+static void collectSavedOrder(uint32_t key, void *value, void *data) {
+    StoredOrders *out = data;
+    const SavedPlaylist *sp = value;
+    StoredOrder *r = &out->records[out->count++];
+    memset(r, 0, sizeof(*r));
+    r->playlist = key;
+    r->play_mode = (uint32_t)sp->play_mode;
+    r->track_count = (uint32_t)sp->track_count;
+    r->cursor = sp->cursor;
+    r->order_seed = sp->order_seed;
+    r->fingerprint = sp->fingerprint;
+    if (sp->lazy.active) {
+        r->flags = ORDER_STORE_LAZY | (sp->lazy.sorted ? ORDER_STORE_SORTED : 0);
+        r->lazy_seed = sp->lazy.perm.seed;
+    }
+    if (sp->is_shuffled) r->flags |= ORDER_STORE_SHUFFLED;
+    if (sp->blocks.kind != PACKED_NONE) r->flags |= ORDER_STORE_BLOCKS;
+    if (sp->criteria_key) r->flags |= ORDER_STORE_CRITERIA;
+    r->order = sp->order;
+    r->blocks = sp->blocks;
+    r->criteria_key = sp->criteria_key;
+}
+
+// Adds a played set to the sets to write; the words are borrowed
+static void collectPlayedSet(uint32_t key, void *value, void *data) {
+    StoredOrders *out = data;
+    const PlayedSet *set = value;
+    StoredPlayed *p = &out->played[out->played_count++];
+    p->playlist = key;
+    p->track_count = (uint32_t)set->count;
+    p->words = set->words;
+}
+
+// Writes the saved orders to the order file for the next session
+static void persistSavedOrders(void) {
+    char path[4096];
+    if (orderFilePath(path, sizeof(path)) != 0) return;
+    if (lock_mutex(&playlist_mutex, "persistSavedOrders") != 0) return;
+    pthread_mutex_lock(&ahead.mutex);
+    StoredOrders out = {
+        .records = calloc(saved_playlists.entries ? saved_playlists.entries : 1, sizeof(StoredOrder)),
+        .played = calloc(played.sets.entries ? played.sets.entries : 1, sizeof(StoredPlayed)),
+    };
+    if (out.records && out.played) {
+        order_cache_each(&saved_playlists, collectSavedOrder, &out);
+        order_cache_each(&played.sets, collectPlayedSet, &out);
+        if (order_store_write(path, out.records, out.count, out.played, out.played_count) == 0) {
+            trace_info("Persisted %zu saved orders and %zu played sets to %s\n", out.count, out.played_count, path);
+        }
+    } else {
+        trace_error("Memory allocation failed in persistSavedOrders\n");
+    }
+    free(out.records);
+    free(out.played);
+    pthread_mutex_unlock(&ahead.mutex);
+    unlock_mutex(&playlist_mutex, "persistSavedOrders");
+}
+
+// Initializes the engine; hooks may be NULL. Does not build an order yet.
+int playback_order_init(DB_functions_t *api, const playback_order_hooks_t *host_hooks) {
+    CHECK_NULL_RET(api, "Deadbeef API missing in playback_order_init", -1);
+    deadbeef = api;
+    if (host_hooks) {
+        hooks = *host_hooks;
+    }
+    trace_set_level(deadbeef->conf_get_int(CONF_TRACE_LEVEL, TRACE_LEVEL_WARN));
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    
+    if (pthread_mutex_init(&playlist_mutex, &attr) != 0) {
+        pthread_mutexattr_destroy(&attr);
+        trace_error("Failed to initialize recursive mutex\n");
+        return -1;
+    }
+    pthread_mutexattr_destroy(&attr);
+    
+    if (order_cache_init(&saved_playlists, savedOrdersBudget(), freeSavedPlaylist) != 0) {
+        pthread_mutex_destroy(&playlist_mutex);
+        return -1;
+    }
+    __atomic_store_n(&played.enabled, deadbeef->conf_get_int(CONF_SKIP_PLAYED, 0), __ATOMIC_RELEASE);
+    if (order_cache_init(&played.sets, playedSetsBudget(), freePlayedSet) != 0) {
+        order_cache_free(&saved_playlists);
+        pthread_mutex_destroy(&playlist_mutex);
+        return -1;
+    }
+    played.draws = played.rounds = 0;
+    history.replays = 0;
+    if (trace_start(TRACE_FLUSH_MS) != 0) {
+        trace_warn("Failed to start log writer, logging to stderr directly\n");
+    }
+    memset(&metrics, 0, sizeof(metrics));
+    metrics.started_ns = metrics_now_ns();
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    __atomic_store_n(&identity_counter, ((uint64_t)now.tv_sec << 32) ^ (uint64_t)now.tv_nsec, __ATOMIC_RELAXED);
+    __atomic_store_n(&current_playlist, 0, __ATOMIC_RELEASE);
+    init_random_seed();
+    restoreSavedOrders();
+    startBuildWorker();
+    return 0;
+}
+
+// Releases all orders and engine resources
+void playback_order_cleanup(void) {
+    stopBuildWorker();
+    withdrawLookahead();
+    // The cursor of the current order moved since it was saved
+    OrderSnapshot *snap = acquireOrder();
+    size_t length = orderLength(snap);
+    releaseOrder(snap);
+    if (length > 0) {
+        save_current_playlist(deadbeef->plt_get_curr_idx());
+    }
+    persistSavedOrders();
+    cleanup();
+    trace_stop();
+}
+
+// Seeds the engine generator, making the following orders reproducible
+void playback_order_set_seed(uint64_t seed) {
+    if (lock_mutex(&playlist_mutex, "playback_order_set_seed") != 0) return;
+    pthread_mutex_lock(&ahead.mutex);
+    rng_seed(&state.rng, seed);
+    rng_seed(&state.nav_rng, rng_next(&state.rng));
+    state.rng_seeded = 1;
+    pthread_mutex_unlock(&ahead.mutex);
+    unlock_mutex(&playlist_mutex, "playback_order_set_seed");
+}
+
+// Seed the current order was built from
+uint64_t playback_order_seed(void) {
+    return state.order_seed;
+}
+
+// Counters of the saved order cache
+void playback_order_cache_stats(playback_order_cache_stats_t *stats) {
+    CHECK_NULL(stats, "Null stats in playback_order_cache_stats");
+    if (lock_mutex(&playlist_mutex, "playback_order_cache_stats") != 0) return;
+    stats->entries = saved_playlists.entries;
+    stats->bytes = saved_playlists.bytes;
+    stats->budget = saved_playlists.budget;
+    stats->hits = saved_playlists.hits;
+    stats->misses = saved_playlists.misses;
+    stats->evictions = saved_playlists.evictions;
+    unlock_mutex(&playlist_mutex, "playback_order_cache_stats");
+}
+
+// Counters of the build worker
+void playback_order_build_stats(playback_order_build_stats_t *stats) {
+    CHECK_NULL(stats, "Null stats in playback_order_build_stats");
+    pthread_mutex_lock(&worker.mutex);
+    stats->requests = worker.requests;
+    stats->coalesced = worker.coalesced;
+    stats->passes = worker.passes;
+    stats->cancelled = __atomic_load_n(&worker.cancelled, __ATOMIC_RELAXED);
+    stats->pending_changes = worker.changed - worker.patched;
+    pthread_mutex_unlock(&worker.mutex);
+}
+
+// Records that the host spent ns handling a DB_EV_* event
+void playback_order_record_event(uint32_t event, uint64_t ns) {
+    if (event == 0) return;
+    // Slots are claimed once and never released, so a lookup never races
+    // with a slot changing its event
+    size_t slot = event % METRICS_EVENT_SLOTS;
+    for (size_t probe = 0; probe < METRICS_EVENT_SLOTS; probe++) {
+        uint32_t *id = &metrics.event_ids[(slot + probe) % METRICS_EVENT_SLOTS];
+        uint32_t seen = __atomic_load_n(id, __ATOMIC_ACQUIRE);
+        if (seen == 0) {
+            __atomic_compare_exchange_n(id, &seen, event, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+            if (seen == 0) seen = event;
+        }
+        if (seen == event) {
+            metrics_record(&metrics.events[(slot + probe) % METRICS_EVENT_SLOTS], ns);
+            return;
+        }
+    }
+    __atomic_add_fetch(&metrics.events_dropped, 1, __ATOMIC_RELAXED);
+}
+
+// Name of a DB_EV_* event in the metrics snapshot
+static const char *eventName(uint32_t event, char *buffer, size_t size) {
+    switch (event) {
+    case DB_EV_NEXT: return "next";
+    case DB_EV_PREV: return "prev";
+    case DB_EV_STOP: return "stop";
+    case DB_EV_PAUSE: return "pause";
+    case DB_EV_CONFIGCHANGED: return "configchanged";
+    case DB_EV_TOGGLE_PAUSE: return "toggle_pause";
+    case DB_EV_PAUSED: return "paused";
+    case DB_EV_PLAYLISTCHANGED: return "playlistchanged";
+    case DB_EV_PLAYLISTSWITCHED: return "playlistswitched";
+    case DB_EV_SEEK: return "seek";
+    case DB_EV_SELCHANGED: return "selchanged";
+    case DB_EV_SONGCHANGED: return "songchanged";
+    case DB_EV_SONGSTARTED: return "songstarted";
+    case DB_EV_SONGFINISHED: return "songfinished";
+    case DB_EV_TRACKINFOCHANGED: return "trackinfochanged";
+    case DB_EV_SEEKED: return "seeked";
+    default:
+        snprintf(buffer, size, "event_%u", event);
+        return buffer;
+    }
+}
+
+static const char *mode_names[KEEP_YEAR + 1] = {
+    "playlist", "keep_album", "keep_artist", "top_rated", "selection", "pure_random", "smart_random",
+    "keep_genre", "keep_year"
+};
+
+// Memory held by the current order and the track snapshot
+static void engineBytes(size_t *order_bytes, size_t *snapshot_bytes) {
+    OrderSnapshot *snap = acquireOrder();
+    *order_bytes = snap ? (snap->playlist.size + snap->positions.size) * sizeof(int) + snap->blocks.bytes : 0;
+    releaseOrder(snap);
+
+    *snapshot_bytes = 0;
+    if (lock_mutex(&playlist_mutex, "engineBytes") != 0) return;
+    const TrackSnapshot *tracks = &state.tracks;
+    size_t per_track = sizeof(DB_playItem_t *);
+    if (tracks->columns & TRACK_COLUMNS_RATING) per_track += sizeof(int8_t) + sizeof(uint8_t) + sizeof(float);
+    if (tracks->columns & TRACK_COLUMNS_KEYS) per_track += sizeof(uint64_t) + FACET_COUNT * sizeof(uint32_t);
+    *snapshot_bytes = tracks->count * per_track;
+    unlock_mutex(&playlist_mutex, "engineBytes");
+}
+
+// Formats a JSON snapshot of the engine metrics and counters; the caller
+// frees it. Returns NULL on failure.
+char *playback_order_metrics_json(void) {
+    playback_order_build_stats_t build;
+    playback_order_cache_stats_t cache;
+    playback_order_build_stats(&build);
+    memset(&cache, 0, sizeof(cache));
+    playback_order_cache_stats(&cache);
+    size_t order_bytes, snapshot_bytes;
+    engineBytes(&order_bytes, &snapshot_bytes);
+    pthread_mutex_lock(&ahead.mutex);
+    uint64_t lookahead_queued = (uint64_t)ahead.count;
+    uint64_t lookahead_batches = ahead.batches;
+    uint64_t played_tracks = played.current ? played.current->marked : 0;
+    uint64_t played_of = played.current ? played.current->count : 0;
+    uint64_t played_draws = played.draws;
+    uint64_t played_rounds = played.rounds;
+    uint64_t played_sets = played.sets.entries;
+    uint64_t played_bytes = played.sets.bytes + played_set_bytes(&played.positions);
+    uint64_t history_tracks = history.current ? (uint64_t)history.current->count : 0;
+    uint64_t history_back = history.current ? (uint64_t)history.current->back : 0;
+    uint64_t history_replays = history.replays;
+    pthread_mutex_unlock(&ahead.mutex);
+
+    MetricsJson j;
+    metrics_json_init(&j);
+    metrics_json_open(&j, NULL);
+    metrics_json_uint(&j, "uptime_ms", (metrics_now_ns() - metrics.started_ns) / 1000000);
+    metrics_json_uint(&j, "play_mode", (uint64_t)playback_order_get_mode());
+    metrics_json_open(&j, "generate");
+    for (int mode = 0; mode <= KEEP_YEAR; mode++) {
+        metrics_json_histogram(&j, mode_names[mode], &metrics.generate[mode]);
+    }
+    metrics_json_close(&j);
+    metrics_json_histogram(&j, "playlist_changes", &metrics.changes);
+
+    metrics_json_open(&j, "events");
+    for (size_t slot = 0; slot < METRICS_EVENT_SLOTS; slot++) {
+        uint32_t event = __atomic_load_n(&metrics.event_ids[slot], __ATOMIC_ACQUIRE);
+        char name[32];
+        if (event) metrics_json_histogram(&j, eventName(event, name, sizeof(name)), &metrics.events[slot]);
+    }
+    metrics_json_uint(&j, "untracked", __atomic_load_n(&metrics.events_dropped, __ATOMIC_RELAXED));
+    metrics_json_close(&j);
+
+    metrics_json_open(&j, "worker");
+    metrics_json_uint(&j, "requests", build.requests);
+    metrics_json_uint(&j, "coalesced", build.coalesced);
+    metrics_json_uint(&j, "passes", build.passes);
+    metrics_json_uint(&j, "cancelled", build.cancelled);
+    metrics_json_uint(&j, "pending_changes", build.pending_changes);
+    metrics_json_close(&j);
+
+    metrics_json_open(&j, "lookahead");
+    metrics_json_uint(&j, "queued", lookahead_queued);
+    metrics_json_uint(&j, "batches", lookahead_batches);
+    metrics_json_close(&j);
+
+    metrics_json_open(&j, "played");
+    metrics_json_uint(&j, "tracks", played_tracks);
+    metrics_json_uint(&j, "of", played_of);
+    metrics_json_uint(&j, "draws", played_draws);
+    metrics_json_uint(&j, "rounds", played_rounds);
+    metrics_json_uint(&j, "playlists", played_sets);
+    metrics_json_uint(&j, "bytes", played_bytes);
+    metrics_json_close(&j);
+
+    metrics_json_open(&j, "history");
+    metrics_json_uint(&j, "tracks", history_tracks);
+    metrics_json_uint(&j, "back", history_back);
+    metrics_json_uint(&j, "replays", history_replays);
+    metrics_json_close(&j);
+
+    metrics_json_open(&j, "saved_orders");
+    metrics_json_uint(&j, "entries", cache.entries);
+    metrics_json_uint(&j, "bytes", cache.bytes);
+    metrics_json_uint(&j, "budget", cache.budget);
+    metrics_json_uint(&j, "hits", cache.hits);
+    metrics_json_uint(&j, "misses", cache.misses);
+    metrics_json_uint(&j, "evictions", cache.evictions);
+    metrics_json_close(&j);
+
+    metrics_json_open(&j, "memory");
+    metrics_json_uint(&j, "order_bytes", order_bytes);
+    metrics_json_uint(&j, "snapshot_bytes", snapshot_bytes);
+    metrics_json_uint(&j, "saved_order_bytes", cache.bytes);
+    metrics_json_uint(&j, "reallocations", __atomic_load_n(&metrics.reallocations, __ATOMIC_RELAXED));
+    metrics_json_close(&j);
+    metrics_json_close(&j);
+    return metrics_json_finish(&j);
+}
+
+// Writes the JSON snapshot to path through a temporary file.
+// Returns 0 on success, -1 on failure.
+int playback_order_metrics_write(const char *path) {
+    CHECK_NULL_RET(path, "Null path in playback_order_metrics_write", -1);
+    char *json = playback_order_metrics_json();
+    if (!json) return -1;
+    char tmp[4096];
+    int result = -1;
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) < (int)sizeof(tmp)) {
+        FILE *file = fopen(tmp, "w");
+        if (file) {
+            int ok = fputs(json, file) >= 0 && fputc('\n', file) != EOF;
+            ok = fclose(file) == 0 && ok;
+            result = ok && rename(tmp, path) == 0 ? 0 : -1;
+            if (result != 0) unlink(tmp);
+        }
+    }
+    if (result != 0) trace_error("Failed to write metrics to %s\n", path);
+    free(json);
+    return result;
+}
+
+// Returns the active play mode
+PlayModes playback_order_get_mode(void) {
+    return __atomic_load_n(&state.play_mode, __ATOMIC_ACQUIRE);
+}
+
+// Sets the active play mode without rebuilding the order
+void playback_order_set_mode(PlayModes mode) {
+    __atomic_store_n(&state.play_mode, mode, __ATOMIC_RELEASE);
+    // The streamer's own order applies again
+    if (mode == PLAYLIST) {
+        withdrawLookahead();
+    }
+}
+
+// Requests the order for the current playlist and mode; it is built in the
+// background and replaces the current order once it is complete
+void playback_order_generate(void) {
+    requestBuild();
+}
+
+// Blocks until every requested order has been built or cancelled and every
+// pending playlist change has been applied
+void playback_order_wait(void) {
+    waitForBuilds();
+}
+
+// Drops the saved order of a playlist so the next generation rebuilds it
+void playback_order_invalidate(int plt_id) {
+    // A build in progress may be about to save the order being dropped
+    cancelBuild();
+    dropSavedOrder(plt_id);
+}
+
+// Saves the current order for a playlist
+void playback_order_save(int plt_id) {
+    save_current_playlist(plt_id);
+}
+
+// Restores the saved order of a playlist, returns 1 if one was found
+int playback_order_load(int plt_id) {
+    return load_saved_playlist(plt_id);
+}
+
+// Frees the current order
+void playback_order_clear(void) {
+    cancelBuild();
+    withdrawLookahead();
+    if (lock_mutex(&playlist_mutex, "playback_order_clear") != 0) return;
+    if (freeArray(&state.playlist) != 0) {
+        trace_error("Failed to free playlist array\n");
+    }
+    freePositionIndex(&state.positions);
+    block_order_free(&state.blocks);
+    state.lazy.active = 0;
+    swapPublished(NULL);
+    unlock_mutex(&playlist_mutex, "playback_order_clear");
+}
+
+// Moves the cursor to the position of the playing track; reads the
+// published order without locking
+void playback_order_sync(void) {
+    CHECK_NULL(deadbeef, "Deadbeef API not initialized in playback_order_sync");
+    syncCurrentPlayedItem();
+    refreshLookahead();
+}
+
+// Handles DB_EV_SONGCHANGED / DB_EV_TRACKINFOCHANGED
+void playback_order_track_changed(void) {
+    CHECK_NULL(deadbeef, "Deadbeef API not initialized in playback_order_track_changed");
+    DB_playItem_t *playing = deadbeef->streamer_get_playing_track_safe();
+    if (!playing) return;
+
+    // A random pick may be the track that was already playing
+    int changed = playing != thread_last_played;
+    int followed = followLookahead(playing, changed);
+    if (changed) {
+        recordHistory(playing);
+        if (!followed && lookaheadInterlude()) {
+            markPlayed(deadbeef->pl_get_idx_of(playing));
+            refreshLookahead();
+        } else {
+            playback_order_sync();
+        }
+        
+        if (thread_last_played) {
+            deadbeef->pl_item_unref(thread_last_played);
+        }
+        thread_last_played = playing;
+    } else {
+        refreshLookahead();
+        deadbeef->pl_item_unref(playing);
+    }
+}
+
+// Whether a content change may have touched the current playlist. The
+// event does not say which playlist changed, so the current one is
+// compared with the tracks the order was built from: a change elsewhere
+// leaves its length, first and last track alone. Tags are not compared,
+// so modes that read them always look at the playlist again. A build in
+// progress reads the playlist anyway, so the change is passed on then.
+static int currentPlaylistChanged(int plt_id) {
+    if (modeColumns(__atomic_load_n(&state.play_mode, __ATOMIC_ACQUIRE)) != 0) return 1;
+    OrderSnapshot *snap = acquireOrder();
+    int64_t lazy = snap && snap->lazy.active ? (int64_t)snap->lazy.perm.count : -1;
+    releaseOrder(snap);
+    if (lazy >= 0) {
+        // A lazy order only follows the track count
+        return deadbeef->pl_getcount(PL_MAIN) != lazy;
+    }
+    if (pthread_mutex_trylock(&playlist_mutex) != 0) return 1;
+    const TrackSnapshot *tracks = &state.tracks;
+    int changed = 1;
+    if (tracks->items && tracks->count > 0 && tracks->plt_id == plt_id) {
+        deadbeef->pl_lock();
+        int count = deadbeef->pl_getcount(PL_MAIN);
+        if (count > 0 && (size_t)count == tracks->count) {
+            DB_playItem_t *head = deadbeef->pl_get_first(PL_MAIN);
+            DB_playItem_t *tail = deadbeef->pl_get_last(PL_MAIN);
+            changed = head != tracks->items[0] || tail != tracks->items[tracks->count - 1];
+            if (head) deadbeef->pl_item_unref(head);
+            if (tail) deadbeef->pl_item_unref(tail);
+        }
+        deadbeef->pl_unlock();
+    }
+    pthread_mutex_unlock(&playlist_mutex);
+    return changed;
+}
+
+// Handles DB_EV_PLAYLISTCHANGED. The event tells what changed, not in
+// which playlist, so changed tracks are looked for in the current one.
+// Queue, title and search changes leave every order as it is; the
+// window's own playqueue pushes send one of them each time. Selection
+// changes only matter to SELECTION, which reads the selected tracks.
+void playback_order_playlist_changed(int change) {
+    CHECK_NULL(deadbeef, "Deadbeef API not initialized in playback_order_playlist_changed");
+    switch (change) {
+    case DDB_PLAYLIST_CHANGE_PLAYQUEUE:
+    case DDB_PLAYLIST_CHANGE_TITLE:
+    case DDB_PLAYLIST_CHANGE_SEARCHRESULT:
+        return;
+    case DDB_PLAYLIST_CHANGE_SELECTION:
+        if (__atomic_load_n(&state.play_mode, __ATOMIC_ACQUIRE) != SELECTION) return;
+        break;
+    default:
+        break;
+    }
+    int plt_id = deadbeef->plt_get_curr_idx();
+    if (plt_id < 0) return;
+    if ((change == DDB_PLAYLIST_CHANGE_CONTENT || change == DDB_PLAYLIST_CHANGE_SELECTION) &&
+        currentPlaylistChanged(plt_id)) {
+        requestPlaylistChange(plt_id);
+    }
+}
+
+// Handles DB_EV_CONFIGCHANGED: takes over the settings that are read on
+// every track change
+void playback_order_config_changed(void) {
+    CHECK_NULL(deadbeef, "Deadbeef API not initialized in playback_order_config_changed");
+    pthread_mutex_lock(&ahead.mutex);
+    __atomic_store_n(&played.enabled, deadbeef->conf_get_int(CONF_SKIP_PLAYED, 0), __ATOMIC_RELEASE);
+    order_cache_set_budget(&played.sets, playedSetsBudget());
+    if (played.current && order_cache_get(&played.sets, played.playlist) != played.current) {
+        // The current set was evicted with the smaller budget
+        played.current = NULL;
+        played.generation = 0;
+    }
+    pthread_mutex_unlock(&ahead.mutex);
+}
+
+// Re-sorts or reshuffles the current order after the shuffle mode changed
+void playback_order_shuffle_changed(int shuffle_mode) {
+    if (lock_mutex(&playlist_mutex, "playback_order_shuffle_changed") != 0) return;
+    // SMART_RANDOM draws its own order regardless of the shuffle setting
+    if (state.play_mode == SMART_RANDOM) {
+        state.is_shuffled = 1;
+        unlock_mutex(&playlist_mutex, "playback_order_shuffle_changed");
+        return;
+    }
+    state.is_shuffled = shuffle_mode != DDB_SHUFFLE_OFF;
+    if (copyPublishedToDraft() != 0) {
+        unlock_mutex(&playlist_mutex, "playback_order_shuffle_changed");
+        return;
+    }
+
+    if (state.lazy.active) {
+        // Turning shuffle off reads the permutation as identity, turning it
+        // on draws a new seed; either way nothing is rebuilt
+        int value = state.lazy.sorted ? state.draft_cursor
+                                      : (int)permutation_forward(&state.lazy.perm, (uint64_t)state.draft_cursor);
+        state.lazy.sorted = shuffle_mode == DDB_SHUFFLE_OFF;
+        if (!state.lazy.sorted) {
+            state.order_seed = rng_next(&state.rng);
+            permutation_init(&state.lazy.perm, state.lazy.perm.count, state.order_seed);
+            value = (int)permutation_inverse(&state.lazy.perm, (uint64_t)value);
+        }
+        state.draft_cursor = value;
+        publishDraft();
+    } else if (state.playlist.used > 1 && state.draft_cursor >= 0 && (size_t)state.draft_cursor < state.playlist.used) {
+        size_t base = state.blocks.count ? block_order_base(&state.blocks, (size_t)state.draft_cursor)
+                                         : (size_t)state.draft_cursor;
+        int value = state.playlist.array[base];
+        int albums = shuffle_mode == DDB_SHUFFLE_ALBUMS && state.play_mode != PURE_RANDOM;
+        if (albums && state.blocks.count) {
+            // The album runs are already known; only the blocks are reshuffled
+            block_order_shuffle(&state.blocks, &state.rng);
+            state.draft_cursor = (int)block_order_position(&state.blocks, base);
+            publishDraft();
+            unlock_mutex(&playlist_mutex, "playback_order_shuffle_changed");
+            return;
+        }
+        // The base of a block order is sorted already
+        block_order_free(&state.blocks);
+        const TrackSnapshot *tracks = &state.tracks;
+        int keyed = tracks->items && (tracks->columns & TRACK_COLUMNS_KEYS) &&
+                    tracks->plt_id == deadbeef->plt_get_curr_idx();
+        if (albums && !keyed) {
+            // The album keys are read by a rebuild, not by the UI thread
+            unlock_mutex(&playlist_mutex, "playback_order_shuffle_changed");
+            dropSavedOrder(deadbeef->plt_get_curr_idx());
+            requestBuild();
+            return;
+        }
+        if (shuffle_mode == DDB_SHUFFLE_OFF || albums) {
+            qsort(state.playlist.array, state.playlist.used, sizeof(int), sortArray);
+        } else {
+            performPlaylistOperation(&state.playlist, shuffleArrayOperation, &state.rng);
+        }
+        rebuildPositionIndex(&state.positions, &state.playlist);
+        int pos = lookupPosition(&state.positions, &state.playlist, value);
+        if (pos >= 0) {
+            state.draft_cursor = pos;
+        }
+        if (albums && block_order_build(&state.blocks, state.playlist.array, state.playlist.used,
+                                        tracks->keys[FACET_ALBUM]) == 0) {
+            block_order_shuffle(&state.blocks, &state.rng);
+            if (pos >= 0) {
+                state.draft_cursor = (int)block_order_position(&state.blocks, (size_t)pos);
+            }
+        }
+        publishDraft();
+    }
+    unlock_mutex(&playlist_mutex, "playback_order_shuffle_changed");
+}
+
+// Hands the next track to the streamer without stopping the output.
+// Plugins see an event before the host acts on it, so a track queued for
+// DB_EV_NEXT is what the host's own next-track step plays, and the cursor
+// follows once it does. DB_EV_PREV ignores the queue, so there the track
+// replaces the host's choice; the host still takes its own step first,
+// which makes PREV switch tracks twice. Call with ahead.mutex held.
+static void playChosenTrack(uint32_t event, const OrderSnapshot *snap, int from, uint64_t generation) {
+    dropLookahead();
+    releaseTaken();
+    ahead.from = from;
+    ahead.generation = generation;
+    if (event == DB_EV_NEXT && deadbeef->playqueue_push && extendLookahead(snap, 1) == 1) {
+        return;
+    }
+    int cursor = stepCursor(snap, event, from);
+    __atomic_store_n(&state.current_played_item, cursor, __ATOMIC_RELEASE);
+    deadbeef->sendmessage(DB_EV_PLAY_NUM, 0, orderTrackAt(snap, (size_t)cursor), 0);
+}
+
+// Entry of the history PREV goes back to, or NEXT forward to when the
+// playqueue cannot hand it over; NEXT normally takes it from the window.
+// Returns its playlist index and marks it pending, -1 if the history has
+// none and the order decides. Call with ahead.mutex held.
+static int stepHistory(uint32_t event) {
+    if (event == DB_EV_NEXT && deadbeef->playqueue_push) return -1;
+    HistoryRing *ring = currentHistory();
+    if (!ring) return -1;
+    int found;
+    int track = historyTrack(ring, ring->back, event == DB_EV_PREV ? 1 : -1, &found);
+    if (track >= 0) {
+        ring->pending = found;
+    } else if (event == DB_EV_PREV) {
+        // The order's previous track goes in front of the oldest entry
+        ring->pending = ring->count;
+    }
+    return track;
+}
+
+// Plays the pending entry of the history again; the cursor moves to its
+// order position, if it has one, so the order resumes from there. Call
+// with ahead.mutex held.
+static void playPastTrack(const OrderSnapshot *snap, int track) {
+    dropLookahead();
+    releaseTaken();
+    int cursor = historyCursor(snap, history.current, history.current->pending, track);
+    if (cursor >= 0) {
+        __atomic_store_n(&state.current_played_item, cursor, __ATOMIC_RELEASE);
+    }
+    deadbeef->sendmessage(DB_EV_PLAY_NUM, 0, track, 0);
+}
+
+// Handles DB_EV_NEXT / DB_EV_PREV when a custom mode is active
+void playback_order_navigate(uint32_t event) {
+    CHECK_NULL(deadbeef, "Deadbeef API not initialized in playback_order_navigate");
+    if (state.play_mode == PLAYLIST || foreignQueueCount() != 0) return;
+    if (event != DB_EV_NEXT && event != DB_EV_PREV) return;
+
+    OrderSnapshot *snap = acquireOrder();
+    if (orderLength(snap) == 0) {
+        // Waiting for the build would hold the message thread for the quiet
+        // period and a whole build; the host handles this press natively
+        // and the order takes over once the worker published it
+        releaseOrder(snap);
+        trace("No order yet, building it in the background\n");
+        requestBuild();
+        return;
+    }
+
+    pthread_mutex_lock(&ahead.mutex);
+    uint64_t generation = __atomic_load_n(&state.generation, __ATOMIC_ACQUIRE);
+    int from = __atomic_load_n(&state.current_played_item, __ATOMIC_ACQUIRE);
+    // The user's queue is empty, so a valid window starts at the queue head
+    // and its first track already is the next one
+    int queued = event == DB_EV_NEXT && ahead.count > 0 && ahead.generation == generation &&
+                 ahead.from == from && checkLookahead(NULL) == 0;
+    if (!queued) {
+        int past = stepHistory(event);
+        if (past >= 0) {
+            playPastTrack(snap, past);
+        } else {
+            playChosenTrack(event, snap, from, generation);
+        }
+    }
+    pthread_mutex_unlock(&ahead.mutex);
+    releaseOrder(snap);
+}
+
+// Number of entries in the current order
+size_t playback_order_length(void) {
+    OrderSnapshot *snap = acquireOrder();
+    size_t length = orderLength(snap);
+    releaseOrder(snap);
+    return length;
+}
+
+// Cursor position in the current order
+int playback_order_position(void) {
+    return __atomic_load_n(&state.current_played_item, __ATOMIC_ACQUIRE);
+}
+
+// Track index at a position of the current order, -1 if out of range
+int playback_order_track_at(size_t pos) {
+    OrderSnapshot *snap = acquireOrder();
+    int track = orderTrackAt(snap, pos);
+    releaseOrder(snap);
+    return track;
+}
@@ -0,0 +1,162 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    Ordering engine: builds and navigates the custom play order for the
+    current playlist. It only talks to DeaDBeeF through DB_functions_t and
+    has no GTK dependency, so the widget plugins and the command-line tools
+    link the same static library.
+
+    Orders are published as immutable snapshots: navigation, sync and the
+    position queries never lock, while generation, patches and shuffle
+    changes are serialized among themselves.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef PLAYBACK_ORDER_H
+#define PLAYBACK_ORDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "deadbeef.h"
+
+typedef enum {
+    PLAYLIST = 0,       // Plays tracks in original playlist order
+    KEEP_ALBUM,         // Restricts playback to current album
+    KEEP_ARTIST,        // Restricts playback to current artist
+    TOP_RATED_SONGS,    // Plays tracks with high ratings
+    SELECTION,          // Plays currently selected tracks
+    PURE_RANDOM,        // Completely random track selection
+    SMART_RANDOM,       // Random selection weighted by ratings
+    KEEP_GENRE,         // Restricts playback to current genre
+    KEEP_YEAR           // Restricts playback to current year
+} PlayModes;
+
+// Callbacks from the engine into its host (e.g. the GTK widget)
+typedef struct {
+    // Called when a generation finished with an empty order; may run on
+    // the build worker thread
+    void (*order_empty)(void);
+} playback_order_hooks_t;
+
+// Counters of the cache holding the saved orders of all playlists
+typedef struct {
+    size_t entries;         // Playlists with a saved order
+    size_t bytes;           // Memory held by the saved orders
+    size_t budget;          // Configured ceiling, 0 = unlimited
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;     // Orders dropped to stay within the budget
+} playback_order_cache_stats_t;
+
+// Counters of the background build worker
+typedef struct {
+    uint64_t requests;          // Build requests and playlist changes received
+    uint64_t coalesced;         // Requests served by the pass of a later one
+    uint64_t passes;            // Builds and change updates the worker ran
+    uint64_t cancelled;         // Builds abandoned for a newer request
+    uint64_t pending_changes;   // Changes waiting for the quiet period to pass
+} playback_order_build_stats_t;
+
+// Initializes the engine and starts its build worker; hooks may be NULL.
+// Reads the orders persisted by the last session into the saved orders but
+// does not build or load an order yet.
+int playback_order_init(DB_functions_t *api, const playback_order_hooks_t *hooks);
+
+// Persists the saved orders, including the current one with its cursor,
+// to the configuration directory and releases all engine resources
+void playback_order_cleanup(void);
+
+// Seeds the engine generator, making the following orders reproducible
+void playback_order_set_seed(uint64_t seed);
+
+// Seed the current order was built from
+uint64_t playback_order_seed(void);
+
+// Copies the saved order cache counters
+void playback_order_cache_stats(playback_order_cache_stats_t *stats);
+
+// Copies the build worker counters
+void playback_order_build_stats(playback_order_build_stats_t *stats);
+
+// Records that the host spent ns handling a DB_EV_* event
+void playback_order_record_event(uint32_t event, uint64_t ns);
+
+// Formats a JSON snapshot of the metrics: build latencies per play mode,
+// handled events, worker, saved order cache and memory counters. The
+// caller frees it. Returns NULL on failure.
+char *playback_order_metrics_json(void);
+
+// Writes the JSON snapshot to path through a temporary file.
+// Returns 0 on success, -1 on failure.
+int playback_order_metrics_write(const char *path);
+
+// Returns the active play mode
+PlayModes playback_order_get_mode(void);
+
+// Sets the active play mode without rebuilding the order
+void playback_order_set_mode(PlayModes mode);
+
+// Requests the order for the current playlist and mode; it is built in the
+// background and replaces the current order once it is complete
+void playback_order_generate(void);
+
+// Blocks until every requested order has been built or cancelled and every
+// pending playlist change has been applied
+void playback_order_wait(void);
+
+// Drops the saved order of a playlist so the next generation rebuilds it
+void playback_order_invalidate(int plt_id);
+
+// Saves the current order for a playlist
+void playback_order_save(int plt_id);
+
+// Restores the saved order of a playlist and its cursor, returns 1 if one
+// was found that still fits the tracks of the playlist
+int playback_order_load(int plt_id);
+
+// Frees the current order
+void playback_order_clear(void);
+
+// Moves the cursor to the position of the playing track
+void playback_order_sync(void);
+
+// Handles DB_EV_SONGCHANGED / DB_EV_TRACKINFOCHANGED
+void playback_order_track_changed(void);
+
+// Handles DB_EV_PLAYLISTCHANGED with its ddb_playlist_change_t; content
+// changes of the current playlist are applied once it has been quiet for
+// a while
+void playback_order_playlist_changed(int change);
+
+// Handles DB_EV_CONFIGCHANGED for the settings the engine caches
+void playback_order_config_changed(void);
+
+// Re-sorts or reshuffles the current order after the shuffle mode changed
+void playback_order_shuffle_changed(int shuffle_mode);
+
+// Handles DB_EV_NEXT / DB_EV_PREV when a custom mode is active
+void playback_order_navigate(uint32_t event);
+
+// Number of entries in the current order
+size_t playback_order_length(void);
+
+// Cursor position in the current order
+int playback_order_position(void);
+
+// Track index at a position of the current order, -1 if out of range
+int playback_order_track_at(size_t pos);
+
+#endif
@@ -0,0 +1,171 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "played_set.h"
+#include "trace.h"
+
+static size_t wordsFor(size_t count) {
+    return (count + 63) / 64;
+}
+
+// Clears the bits of the last word that lie past the range
+static void maskTail(PlayedSet *s) {
+    if (s->count % 64 && s->word_count > 0) {
+        s->words[s->word_count - 1] &= (1ULL << (s->count % 64)) - 1;
+    }
+}
+
+// Recomputes the tree and the number of members from the words in O(words)
+static void rebuildTree(PlayedSet *s) {
+    s->marked = 0;
+    s->tree[0] = 0;
+    for (size_t i = 1; i <= s->word_count; i++) {
+        s->tree[i] = (uint32_t)__builtin_popcountll(s->words[i - 1]);
+        s->marked += s->tree[i];
+    }
+    for (size_t i = 1; i <= s->word_count; i++) {
+        size_t parent = i + (i & -i);
+        if (parent <= s->word_count) s->tree[parent] += s->tree[i];
+    }
+}
+
+// Adds delta to the count of a word
+static void updateTree(PlayedSet *s, size_t word, int delta) {
+    for (size_t i = word + 1; i <= s->word_count; i += i & -i) {
+        s->tree[i] += (uint32_t)delta;
+    }
+}
+
+int played_set_init(PlayedSet *s, size_t count) {
+    memset(s, 0, sizeof(*s));
+    size_t words = wordsFor(count);
+    if (words > UINT32_MAX / 64) {
+        trace_error("Played set too large\n");
+        return -1;
+    }
+    s->words = calloc(words ? words : 1, sizeof(uint64_t));
+    s->tree = calloc(words + 1, sizeof(uint32_t));
+    if (!s->words || !s->tree) {
+        trace_error("Memory allocation failed in played_set_init\n");
+        played_set_free(s);
+        return -1;
+    }
+    s->word_count = words;
+    s->count = count;
+    return 0;
+}
+
+int played_set_load(PlayedSet *s, const uint64_t *words, size_t count) {
+    if (played_set_init(s, count) != 0) return -1;
+    if (s->word_count > 0) memcpy(s->words, words, s->word_count * sizeof(uint64_t));
+    maskTail(s);
+    rebuildTree(s);
+    return 0;
+}
+
+int played_set_resize(PlayedSet *s, size_t count) {
+    if (count == s->count) return 0;
+    size_t words = wordsFor(count);
+    if (words > UINT32_MAX / 64) {
+        trace_error("Played set too large\n");
+        return -1;
+    }
+    uint64_t *grown = realloc(s->words, (words ? words : 1) * sizeof(uint64_t));
+    if (!grown) {
+        trace_error("Memory reallocation failed in played_set_resize\n");
+        return -1;
+    }
+    s->words = grown;
+    uint32_t *tree = realloc(s->tree, (words + 1) * sizeof(uint32_t));
+    if (!tree) {
+        trace_error("Memory reallocation failed in played_set_resize\n");
+        return -1;
+    }
+    s->tree = tree;
+    if (words > s->word_count) {
+        memset(s->words + s->word_count, 0, (words - s->word_count) * sizeof(uint64_t));
+    }
+    s->word_count = words;
+    s->count = count;
+    maskTail(s);
+    rebuildTree(s);
+    return 0;
+}
+
+int played_set_test(const PlayedSet *s, size_t value) {
+    if (value >= s->count) return 0;
+    return (s->words[value / 64] >> (value % 64)) & 1;
+}
+
+int played_set_mark(PlayedSet *s, size_t value) {
+    if (value >= s->count || played_set_test(s, value)) return 0;
+    s->words[value / 64] |= 1ULL << (value % 64);
+    updateTree(s, value / 64, 1);
+    s->marked++;
+    return 1;
+}
+
+int played_set_unmark(PlayedSet *s, size_t value) {
+    if (!played_set_test(s, value)) return 0;
+    s->words[value / 64] &= ~(1ULL << (value % 64));
+    updateTree(s, value / 64, -1);
+    s->marked--;
+    return 1;
+}
+
+void played_set_clear(PlayedSet *s) {
+    if (s->word_count == 0) return;
+    memset(s->words, 0, s->word_count * sizeof(uint64_t));
+    memset(s->tree, 0, (s->word_count + 1) * sizeof(uint32_t));
+    s->marked = 0;
+}
+
+// Descends the tree to the word holding the k-th clear bit, then finds the
+// bit inside it. Bits past the range are clear too, but they come after
+// every value that can be asked for.
+size_t played_set_select_unmarked(const PlayedSet *s, size_t k) {
+    size_t word = 0;
+    size_t step = 1;
+    while (step * 2 <= s->word_count) step *= 2;
+    for (; step > 0; step /= 2) {
+        size_t next = word + step;
+        if (next > s->word_count) continue;
+        size_t clear = step * 64 - s->tree[next];
+        if (clear <= k) {
+            word = next;
+            k -= clear;
+        }
+    }
+    uint64_t bits = ~s->words[word];
+    for (; k > 0; k--) {
+        bits &= bits - 1;
+    }
+    return word * 64 + (size_t)__builtin_ctzll(bits);
+}
+
+size_t played_set_bytes(const PlayedSet *s) {
+    return s->words ? s->word_count * sizeof(uint64_t) + (s->word_count + 1) * sizeof(uint32_t) : 0;
+}
+
+void played_set_free(PlayedSet *s) {
+    free(s->words);
+    free(s->tree);
+    memset(s, 0, sizeof(*s));
+}
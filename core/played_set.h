@@ -0,0 +1,69 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    Set over [0, count) stored as a bitset with a Fenwick tree of the set
+    bits per word. Testing a member is O(1); adding, removing and finding
+    the k-th value outside the set are O(log count), so random draws that
+    skip marked tracks stay fast however few of them are left.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef PLAYED_SET_H
+#define PLAYED_SET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    uint64_t *words;        // One bit per value, bits past count stay clear
+    uint32_t *tree;         // Fenwick tree of the set bits per word, 1-based
+    size_t word_count;
+    size_t count;           // Size of the range
+    size_t marked;          // Values in the set
+} PlayedSet;
+
+// Sets up an empty set over [0, count). Returns 0 on success, -1 on failure.
+int played_set_init(PlayedSet *s, size_t count);
+
+// Sets up a set over [0, count) from a bitset of (count + 63) / 64 words.
+// Returns 0 on success, -1 on failure.
+int played_set_load(PlayedSet *s, const uint64_t *words, size_t count);
+
+// Changes the range to [0, count), keeping the values below it.
+// Returns 0 on success, -1 on failure.
+int played_set_resize(PlayedSet *s, size_t count);
+
+// Whether a value is in the set
+int played_set_test(const PlayedSet *s, size_t value);
+
+// Adds a value; returns 1 if it was not in the set yet
+int played_set_mark(PlayedSet *s, size_t value);
+
+// Removes a value; returns 1 if it was in the set
+int played_set_unmark(PlayedSet *s, size_t value);
+
+// Removes all values
+void played_set_clear(PlayedSet *s);
+
+// Returns the k-th smallest value outside the set, k below count - marked
+size_t played_set_select_unmarked(const PlayedSet *s, size_t k);
+
+// Memory held by the set
+size_t played_set_bytes(const PlayedSet *s);
+
+void played_set_free(PlayedSet *s);
+
+#endif
@@ -0,0 +1,150 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "playlist_diff.h"
+#include "trace.h"
+
+// Open-addressing slot mapping an item pointer to its new index
+typedef struct {
+    void *item;
+    int index;
+} DiffSlot;
+
+static size_t hashPointer(const void *p, size_t mask) {
+    uint64_t x = (uint64_t)(uintptr_t)p;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (size_t)x & mask;
+}
+
+// Diffs two item snapshots; only the middle between the common prefix and
+// suffix is hashed. Returns 0 on success, -1 on allocation failure.
+int playlist_diff_compute(PlaylistDiff *d, void *const *old_items, size_t old_count,
+                          void *const *new_items, size_t new_count) {
+    CHECK_NULL_RET(d, "Null diff in playlist_diff_compute", -1);
+    memset(d, 0, sizeof(*d));
+    d->old_count = old_count;
+    d->new_count = new_count;
+
+    size_t limit = old_count < new_count ? old_count : new_count;
+    while (d->prefix < limit && old_items[d->prefix] == new_items[d->prefix]) {
+        d->prefix++;
+    }
+    while (d->suffix < limit - d->prefix &&
+           old_items[old_count - 1 - d->suffix] == new_items[new_count - 1 - d->suffix]) {
+        d->suffix++;
+    }
+
+    size_t old_mid = old_count - d->prefix - d->suffix;
+    size_t new_mid = new_count - d->prefix - d->suffix;
+    if (old_mid == 0 && new_mid == 0) {
+        return 0;
+    }
+
+    size_t slots = 16;
+    while (slots < new_mid * 2) slots <<= 1;
+    size_t mask = slots - 1;
+
+    DiffSlot *table = calloc(slots, sizeof(DiffSlot));
+    unsigned char *matched = calloc(new_mid ? new_mid : 1, 1);
+    d->old_to_new = malloc((old_mid ? old_mid : 1) * sizeof(int));
+    if (!table || !matched || !d->old_to_new) {
+        trace_error("Memory allocation failed in playlist_diff_compute\n");
+        free(table);
+        free(matched);
+        playlist_diff_free(d);
+        return -1;
+    }
+
+    for (size_t i = 0; i < new_mid; i++) {
+        void *item = new_items[d->prefix + i];
+        size_t h = hashPointer(item, mask);
+        while (table[h].item) h = (h + 1) & mask;
+        table[h].item = item;
+        table[h].index = (int)(d->prefix + i);
+    }
+
+    for (size_t i = 0; i < old_mid; i++) {
+        void *item = old_items[d->prefix + i];
+        size_t h = hashPointer(item, mask);
+        int found = -1;
+        while (table[h].item) {
+            if (table[h].item == item) {
+                found = table[h].index;
+                break;
+            }
+            h = (h + 1) & mask;
+        }
+        d->old_to_new[i] = found;
+        if (found < 0) {
+            d->removed_count++;
+        } else {
+            matched[found - d->prefix] = 1;
+            d->moved_count++;
+        }
+    }
+
+    size_t inserted = new_mid - d->moved_count;
+    if (inserted > 0) {
+        d->inserted = malloc(inserted * sizeof(int));
+        if (!d->inserted) {
+            trace_error("Memory allocation failed in playlist_diff_compute\n");
+            free(table);
+            free(matched);
+            playlist_diff_free(d);
+            return -1;
+        }
+        for (size_t i = 0; i < new_mid; i++) {
+            if (!matched[i]) {
+                d->inserted[d->inserted_count++] = (int)(d->prefix + i);
+            }
+        }
+    }
+
+    free(table);
+    free(matched);
+    return 0;
+}
+
+// Maps an index of the old snapshot to the new one, -1 if the item was removed
+int playlist_diff_map(const PlaylistDiff *d, int old_index) {
+    if (old_index < 0 || (size_t)old_index >= d->old_count) return -1;
+    if ((size_t)old_index < d->prefix) return old_index;
+    if ((size_t)old_index >= d->old_count - d->suffix) {
+        return old_index + (int)d->new_count - (int)d->old_count;
+    }
+    return d->old_to_new[old_index - d->prefix];
+}
+
+// Number of old items whose position may have changed
+size_t playlist_diff_span(const PlaylistDiff *d) {
+    return d->old_count - d->prefix - d->suffix;
+}
+
+// Releases the diff tables
+void playlist_diff_free(PlaylistDiff *d) {
+    if (!d) return;
+    free(d->old_to_new);
+    free(d->inserted);
+    d->old_to_new = NULL;
+    d->inserted = NULL;
+}
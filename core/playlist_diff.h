@@ -0,0 +1,54 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    Identity diff between two snapshots of a playlist. Items are compared
+    by pointer, so the result describes inserted, removed and moved tracks
+    without looking at any metadata.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef PLAYLIST_DIFF_H
+#define PLAYLIST_DIFF_H
+
+#include <stddef.h>
+
+typedef struct {
+    size_t old_count;
+    size_t new_count;
+    size_t prefix;          // Leading items identical in both snapshots
+    size_t suffix;          // Trailing items identical in both snapshots
+    int *old_to_new;        // New index for every old item in the changed middle, -1 if removed
+    int *inserted;          // New indices of items missing from the old snapshot
+    size_t inserted_count;
+    size_t removed_count;
+    size_t moved_count;     // Middle items present in both snapshots
+} PlaylistDiff;
+
+// Diffs two item snapshots; only the middle between the common prefix and
+// suffix is hashed. Returns 0 on success, -1 on allocation failure.
+int playlist_diff_compute(PlaylistDiff *d, void *const *old_items, size_t old_count,
+                          void *const *new_items, size_t new_count);
+
+// Maps an index of the old snapshot to the new one, -1 if the item was removed
+int playlist_diff_map(const PlaylistDiff *d, int old_index);
+
+// Number of old items whose position may have changed
+size_t playlist_diff_span(const PlaylistDiff *d);
+
+// Releases the diff tables
+void playlist_diff_free(PlaylistDiff *d);
+
+#endif
@@ -0,0 +1,41 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    xoshiro256** pseudo-random generator. Each order owns its own state,
+    so shuffles are reproducible from a 64-bit seed and never touch the
+    locked global state behind libc's random().
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+typedef struct {
+    uint64_t s[4];
+} Rng;
+
+// Expands a 64-bit seed into a full generator state
+void rng_seed(Rng *rng, uint64_t seed);
+
+// Returns the next 64 random bits
+uint64_t rng_next(Rng *rng);
+
+// Returns a uniformly distributed value in [0, bound), without modulo bias
+uint64_t rng_bounded(Rng *rng, uint64_t bound);
+
+#endif
@@ -0,0 +1,104 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "string_pool.h"
+#include "trace.h"
+
+#define INITIAL_SLOTS 256
+
+static uint32_t hashString(const char *str) {
+    uint32_t h = 2166136261u;
+    while (*str) {
+        h ^= (unsigned char)*str++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Doubles the slot table once it is half full
+static int growSlots(StringPool *pool) {
+    if (pool->slot_count && (pool->count + 1) * 2 <= pool->slot_count) return 0;
+    size_t count = pool->slot_count ? pool->slot_count * 2 : INITIAL_SLOTS;
+    uint32_t *slots = calloc(count, sizeof(uint32_t));
+    if (!slots) return -1;
+    for (size_t i = 0; i < pool->count; i++) {
+        size_t s = hashString(pool->strings[i]) & (count - 1);
+        while (slots[s]) s = (s + 1) & (count - 1);
+        slots[s] = (uint32_t)i + 1;
+    }
+    free(pool->slots);
+    pool->slots = slots;
+    pool->slot_count = count;
+    return 0;
+}
+
+// Returns the id of a string, adding it on first sight. NULL and empty
+// strings, and strings that could not be stored, map to STRING_POOL_EMPTY.
+uint32_t string_pool_intern(StringPool *pool, const char *str) {
+    if (!str || str[0] == '\0') return STRING_POOL_EMPTY;
+    if (growSlots(pool) != 0) {
+        trace_error("Memory allocation failed in string_pool_intern\n");
+        return STRING_POOL_EMPTY;
+    }
+
+    size_t mask = pool->slot_count - 1;
+    size_t s = hashString(str) & mask;
+    while (pool->slots[s]) {
+        uint32_t id = pool->slots[s];
+        if (!strcmp(pool->strings[id - 1], str)) return id;
+        s = (s + 1) & mask;
+    }
+
+    if (pool->count == pool->capacity) {
+        size_t capacity = pool->capacity ? pool->capacity * 2 : INITIAL_SLOTS / 2;
+        char **strings = realloc(pool->strings, capacity * sizeof(char *));
+        if (!strings) {
+            trace_error("Memory allocation failed in string_pool_intern\n");
+            return STRING_POOL_EMPTY;
+        }
+        pool->strings = strings;
+        pool->capacity = capacity;
+    }
+    char *copy = strdup(str);
+    if (!copy) {
+        trace_error("Memory allocation failed in string_pool_intern\n");
+        return STRING_POOL_EMPTY;
+    }
+    pool->strings[pool->count++] = copy;
+    pool->slots[s] = (uint32_t)pool->count;
+    return (uint32_t)pool->count;
+}
+
+// Returns the string of an id, "" for STRING_POOL_EMPTY or unknown ids
+const char *string_pool_get(const StringPool *pool, uint32_t id) {
+    if (id == STRING_POOL_EMPTY || id > pool->count) return "";
+    return pool->strings[id - 1];
+}
+
+// Releases all strings; the pool can be reused afterwards
+void string_pool_free(StringPool *pool) {
+    if (!pool) return;
+    for (size_t i = 0; i < pool->count; i++) {
+        free(pool->strings[i]);
+    }
+    free(pool->strings);
+    free(pool->slots);
+    memset(pool, 0, sizeof(*pool));
+}
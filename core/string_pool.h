@@ -0,0 +1,50 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    Interning pool for metadata strings. Every distinct string is stored
+    once and referred to by a small integer id, so per-track columns can
+    hold ids instead of copies.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef STRING_POOL_H
+#define STRING_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Id of the empty string; a zeroed pool is ready to use
+#define STRING_POOL_EMPTY 0
+
+typedef struct {
+    char **strings;         // strings[id - 1]
+    size_t count;
+    size_t capacity;
+    uint32_t *slots;        // Open addressing over ids, 0 = empty
+    size_t slot_count;
+} StringPool;
+
+// Returns the id of a string, adding it on first sight. NULL and empty
+// strings, and strings that could not be stored, map to STRING_POOL_EMPTY.
+uint32_t string_pool_intern(StringPool *pool, const char *str);
+
+// Returns the string of an id, "" for STRING_POOL_EMPTY or unknown ids
+const char *string_pool_get(const StringPool *pool, uint32_t id);
+
+// Releases all strings; the pool can be reused afterwards
+void string_pool_free(StringPool *pool);
+
+#endif
@@ -0,0 +1,277 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "trace.h"
+
+#define TRACE_RING_RECORDS 512      // Per thread, a power of two
+#define TRACE_RECORD_TEXT 240       // Longer messages are cut to fit
+#define TRACE_TRUNCATED "... (truncated)\n"
+#define TRACE_OUTPUT_BUFFER 16384
+
+// One formatted message
+typedef struct {
+    uint64_t ns;                // Monotonic time of the message
+    int level;
+    char text[TRACE_RECORD_TEXT];
+} TraceRecord;
+
+// Messages of one thread. The owning thread only advances head and the
+// writer only advances tail, so neither side locks. Rings are never freed;
+// a ring left by an exited thread is taken over by the next new thread.
+typedef struct TraceRing {
+    struct TraceRing *next;
+    int owned;
+    uint64_t head;
+    uint64_t tail;
+    uint64_t dropped;           // Messages lost to a full ring
+    TraceRecord records[TRACE_RING_RECORDS];
+} TraceRing;
+
+int trace_level = TRACE_LEVEL_WARN;
+
+static const char level_names[] = "EWID";
+static TraceRing *rings = NULL;
+static __thread TraceRing *local_ring = NULL;
+// The key lives from trace_start to trace_stop, so no destructor is left
+// pointing into the plugin once it is unloaded. A ring cached by a thread
+// under an earlier key is registered again under the current one.
+static pthread_key_t ring_key;
+static unsigned ring_key_generation = 0;
+static __thread unsigned local_generation = 0;
+static int running = 0;
+
+// Writer thread; flush_mutex also keeps flushes on demand apart
+static pthread_t writer;
+static pthread_mutex_t flush_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_wake = PTHREAD_COND_INITIALIZER;
+static int writer_stop = 0;
+static int writer_interval_ms = 100;
+
+static uint64_t monotonicNs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+// Hands the ring of an exiting thread over to the next new thread
+static void releaseRing(void *value) {
+    TraceRing *ring = value;
+    __atomic_store_n(&ring->owned, 0, __ATOMIC_RELEASE);
+}
+
+// Ring of the calling thread, taken over or allocated on first use
+static TraceRing *localRing(void) {
+    unsigned generation = __atomic_load_n(&ring_key_generation, __ATOMIC_ACQUIRE);
+    if (local_ring) {
+        if (local_generation != generation) {
+            pthread_setspecific(ring_key, local_ring);
+            local_generation = generation;
+        }
+        return local_ring;
+    }
+
+    TraceRing *ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+    for (; ring; ring = ring->next) {
+        int unowned = 0;
+        if (__atomic_compare_exchange_n(&ring->owned, &unowned, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (!ring) {
+        ring = calloc(1, sizeof(TraceRing));
+        if (!ring) return NULL;
+        ring->owned = 1;
+        ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+    pthread_setspecific(ring_key, ring);
+    local_ring = ring;
+    local_generation = generation;
+    return ring;
+}
+
+// Writes a message to stderr right away
+static void writeDirect(const char *func, int line, const char *fmt, va_list args) {
+    flockfile(stderr);
+    fprintf(stderr, TRACE_PREFIX "%s:%d: ", func, line);
+    vfprintf(stderr, fmt, args);
+    funlockfile(stderr);
+}
+
+// Formats a message into the ring of the calling thread, or writes it to
+// stderr if the logger is not running
+void trace_write(int level, const char *func, int line, const char *fmt, ...) {
+    va_list args;
+    TraceRing *ring = __atomic_load_n(&running, __ATOMIC_ACQUIRE) ? localRing() : NULL;
+    if (!ring) {
+        va_start(args, fmt);
+        writeDirect(func, line, fmt, args);
+        va_end(args);
+        return;
+    }
+
+    uint64_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == TRACE_RING_RECORDS) {
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    TraceRecord *record = &ring->records[head & (TRACE_RING_RECORDS - 1)];
+    record->ns = monotonicNs();
+    record->level = level;
+    size_t room = sizeof(record->text);
+    int used = snprintf(record->text, room, "%s:%d: ", func, line);
+    int length = 0;
+    if (used >= 0 && (size_t)used < room) {
+        va_start(args, fmt);
+        length = vsnprintf(record->text + used, room - (size_t)used, fmt, args);
+        va_end(args);
+    }
+    if (used < 0 || length < 0) {
+        snprintf(record->text, room, "%s:%d: unformattable message\n", func, line);
+    } else if ((size_t)used + (size_t)length >= room) {
+        // Too long for a record; cut with a marker rather than written on
+        // the caller's thread, which may hold the engine's locks
+        memcpy(record->text + room - sizeof(TRACE_TRUNCATED), TRACE_TRUNCATED, sizeof(TRACE_TRUNCATED));
+    }
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Sets the run-time level, clamped to the known levels
+void trace_set_level(int level) {
+    if (level < TRACE_LEVEL_ERROR) level = TRACE_LEVEL_ERROR;
+    if (level > TRACE_LEVEL_DEBUG) level = TRACE_LEVEL_DEBUG;
+    __atomic_store_n(&trace_level, level, __ATOMIC_RELAXED);
+}
+
+// Appends to the output buffer, writing it out when it is full
+static void emit(char *out, size_t *used, const char *text, size_t length) {
+    if (*used + length > TRACE_OUTPUT_BUFFER) {
+        fwrite(out, 1, *used, stderr);
+        *used = 0;
+    }
+    if (length > TRACE_OUTPUT_BUFFER) length = TRACE_OUTPUT_BUFFER;
+    memcpy(out + *used, text, length);
+    *used += length;
+}
+
+// Writes all buffered messages now
+void trace_flush(void) {
+    static char out[TRACE_OUTPUT_BUFFER];
+    pthread_mutex_lock(&flush_mutex);
+    size_t used = 0;
+    for (TraceRing *ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t tail = ring->tail;
+        for (; tail != head; tail++) {
+            const TraceRecord *record = &ring->records[tail & (TRACE_RING_RECORDS - 1)];
+            char prefix[64];
+            int length = snprintf(prefix, sizeof(prefix), TRACE_PREFIX "%llu.%06llu %c ",
+                                  (unsigned long long)(record->ns / 1000000000ULL),
+                                  (unsigned long long)(record->ns % 1000000000ULL / 1000),
+                                  level_names[record->level & 3]);
+            emit(out, &used, prefix, (size_t)length);
+            size_t text_length = strnlen(record->text, sizeof(record->text));
+            emit(out, &used, record->text, text_length);
+            if (text_length == 0 || record->text[text_length - 1] != '\n') {
+                emit(out, &used, "\n", 1);
+            }
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+        uint64_t dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+        if (dropped) {
+            char note[96];
+            int length = snprintf(note, sizeof(note), TRACE_PREFIX "%llu messages dropped, ring full\n",
+                                  (unsigned long long)dropped);
+            emit(out, &used, note, (size_t)length);
+        }
+    }
+    if (used) {
+        fwrite(out, 1, used, stderr);
+        fflush(stderr);
+    }
+    pthread_mutex_unlock(&flush_mutex);
+}
+
+static void *writerThread(void *arg) {
+    pthread_mutex_lock(&writer_mutex);
+    while (!writer_stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long)writer_interval_ms * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&writer_wake, &writer_mutex, &deadline);
+        pthread_mutex_unlock(&writer_mutex);
+        trace_flush();
+        pthread_mutex_lock(&writer_mutex);
+    }
+    pthread_mutex_unlock(&writer_mutex);
+    return NULL;
+}
+
+// Starts the thread writing the rings every interval_ms.
+// Returns 0 on success, -1 if the thread could not be started.
+int trace_start(int interval_ms) {
+    pthread_mutex_lock(&writer_mutex);
+    if (running) {
+        pthread_mutex_unlock(&writer_mutex);
+        return 0;
+    }
+    writer_interval_ms = interval_ms > 0 ? interval_ms : 100;
+    writer_stop = 0;
+    int result = pthread_key_create(&ring_key, releaseRing);
+    if (result != 0) {
+        pthread_mutex_unlock(&writer_mutex);
+        return -1;
+    }
+    result = pthread_create(&writer, NULL, writerThread, NULL);
+    if (result == 0) {
+        __atomic_add_fetch(&ring_key_generation, 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+    } else {
+        pthread_key_delete(ring_key);
+    }
+    pthread_mutex_unlock(&writer_mutex);
+    return result == 0 ? 0 : -1;
+}
+
+// Writes all buffered messages and stops the writer thread
+void trace_stop(void) {
+    pthread_mutex_lock(&writer_mutex);
+    if (!running) {
+        pthread_mutex_unlock(&writer_mutex);
+        return;
+    }
+    // Later messages go to stderr directly
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    writer_stop = 1;
+    pthread_cond_signal(&writer_wake);
+    pthread_mutex_unlock(&writer_mutex);
+    pthread_join(writer, NULL);
+    trace_flush();
+    pthread_key_delete(ring_key);
+}
@@ -0,0 +1,81 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    Leveled logging. Messages below the compiled level are removed by the
+    compiler and messages below the run-time level cost one branch. While
+    the logger runs, every thread formats into a ring buffer of its own
+    without locking and a background thread writes the rings to stderr;
+    otherwise messages go to stderr directly.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef PLAYBACK_BUTTONS_TRACE_H
+#define PLAYBACK_BUTTONS_TRACE_H
+
+#include <stdio.h>
+
+#define TRACE_PREFIX "PlaybackButtons: "
+
+#define TRACE_LEVEL_ERROR 0
+#define TRACE_LEVEL_WARN 1
+#define TRACE_LEVEL_INFO 2
+#define TRACE_LEVEL_DEBUG 3
+
+// Highest level compiled in; e.g. -DTRACE_COMPILED_LEVEL=0 keeps errors only
+#ifndef TRACE_COMPILED_LEVEL
+#define TRACE_COMPILED_LEVEL TRACE_LEVEL_DEBUG
+#endif
+
+// Highest level logged at run time
+extern int trace_level;
+
+// Whether messages of a level are logged, so costly arguments can be skipped
+#define trace_enabled(level) \
+    ((level) <= TRACE_COMPILED_LEVEL && __builtin_expect((level) <= __atomic_load_n(&trace_level, __ATOMIC_RELAXED), 0))
+
+// Logs a message with function and line number if its level is enabled
+#define trace_at(level, fmt, ...) do { \
+        if (trace_enabled(level)) \
+            trace_write((level), __func__, __LINE__, fmt, ##__VA_ARGS__); \
+    } while (0)
+
+#define trace_error(fmt, ...) trace_at(TRACE_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#define trace_warn(fmt, ...) trace_at(TRACE_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#define trace_info(fmt, ...) trace_at(TRACE_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define trace(fmt, ...) trace_at(TRACE_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#define CHECK_NULL(ptr, msg) if (!(ptr)) { trace_error(msg "\n"); return; }
+#define CHECK_NULL_RET(ptr, msg, ret) if (!(ptr)) { trace_error(msg "\n"); return ret; }
+
+// Formats a message into the ring of the calling thread, cut to a record
+// with a marker if it is too long, or writes it to stderr if the logger is
+// not running; use the macros above instead
+void trace_write(int level, const char *func, int line, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+// Sets the run-time level, clamped to the known levels
+void trace_set_level(int level);
+
+// Starts the thread writing the rings every interval_ms.
+// Returns 0 on success, -1 if the thread could not be started.
+int trace_start(int interval_ms);
+
+// Writes all buffered messages and stops the writer thread
+void trace_stop(void);
+
+// Writes all buffered messages now
+void trace_flush(void);
+
+#endif
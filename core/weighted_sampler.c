@@ -0,0 +1,107 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "weighted_sampler.h"
+#include "trace.h"
+
+// Builds the alias table for count items; weights must be positive.
+// Returns 0 on success, -1 on allocation failure or an empty set.
+int weighted_sampler_build(WeightedSampler *s, const uint32_t *weights, size_t count) {
+    CHECK_NULL_RET(s, "Null sampler in weighted_sampler_build", -1);
+    memset(s, 0, sizeof(*s));
+    if (!weights || count == 0 || count > UINT32_MAX) return -1;
+
+    double total = 0.0;
+    for (size_t i = 0; i < count; i++) {
+        total += weights[i];
+    }
+    if (total <= 0.0) return -1;
+
+    s->threshold = malloc(count * sizeof(uint32_t));
+    s->alias = malloc(count * sizeof(uint32_t));
+    double *scaled = malloc(count * sizeof(double));
+    // Small columns are stacked from the front, large ones from the back
+    uint32_t *work = malloc(count * sizeof(uint32_t));
+    if (!s->threshold || !s->alias || !scaled || !work) {
+        trace_error("Memory allocation failed in weighted_sampler_build\n");
+        free(scaled);
+        free(work);
+        weighted_sampler_free(s);
+        return -1;
+    }
+
+    size_t small = 0;
+    size_t large = count;
+    for (size_t i = 0; i < count; i++) {
+        scaled[i] = weights[i] * (double)count / total;
+        if (scaled[i] < 1.0) {
+            work[small++] = (uint32_t)i;
+        } else {
+            work[--large] = (uint32_t)i;
+        }
+    }
+
+    while (small > 0 && large < count) {
+        uint32_t l = work[--small];
+        uint32_t g = work[large++];
+        s->threshold[l] = (uint32_t)(scaled[l] * 4294967296.0);
+        s->alias[l] = g;
+        scaled[g] -= 1.0 - scaled[l];
+        if (scaled[g] < 1.0) {
+            work[small++] = g;
+        } else {
+            work[--large] = g;
+        }
+    }
+    // Whatever is left is full up to rounding and always keeps its column
+    while (small > 0) {
+        uint32_t i = work[--small];
+        s->threshold[i] = UINT32_MAX;
+        s->alias[i] = i;
+    }
+    while (large < count) {
+        uint32_t i = work[large++];
+        s->threshold[i] = UINT32_MAX;
+        s->alias[i] = i;
+    }
+
+    free(scaled);
+    free(work);
+    s->count = count;
+    return 0;
+}
+
+// Draws an item index from a uniformly random 64-bit value
+size_t weighted_sampler_draw(const WeightedSampler *s, uint64_t random_bits) {
+    // High half picks the column without modulo bias, low half flips the coin
+    size_t column = (size_t)(((random_bits >> 32) * (uint64_t)s->count) >> 32);
+    uint32_t coin = (uint32_t)random_bits;
+    return coin < s->threshold[column] ? column : s->alias[column];
+}
+
+// Releases the alias table
+void weighted_sampler_free(WeightedSampler *s) {
+    if (!s) return;
+    free(s->threshold);
+    free(s->alias);
+    s->threshold = NULL;
+    s->alias = NULL;
+    s->count = 0;
+}
@@ -0,0 +1,45 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    Weighted sampling with Vose's alias method. Building the table is
+    linear in the number of items, every draw is O(1) and costs one
+    64-bit random value.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef WEIGHTED_SAMPLER_H
+#define WEIGHTED_SAMPLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    uint32_t *threshold;    // Chance to keep column i, scaled to 2^32
+    uint32_t *alias;        // Item drawn when column i is not kept
+    size_t count;
+} WeightedSampler;
+
+// Builds the alias table for count items; weights must be positive.
+// Returns 0 on success, -1 on allocation failure or an empty set.
+int weighted_sampler_build(WeightedSampler *s, const uint32_t *weights, size_t count);
+
+// Draws an item index from a uniformly random 64-bit value
+size_t weighted_sampler_draw(const WeightedSampler *s, uint64_t random_bits);
+
+// Releases the alias table
+void weighted_sampler_free(WeightedSampler *s);
+
+#endif
@@ -21,141 +21,32 @@
 #include <string.h>
 #include <gtk/gtk.h>
 #include <stdlib.h>
-#include <pthread.h>
-#include <time.h>
 #include "deadbeef.h"
 #include "gtkui_api.h"
-
-typedef struct {
-    GtkWidget *widget;
-    char *text;
-    int button_type; // 0 = shuffle, 1 = repeat
-    int combo_index;
-    int combo_active;
-} ui_update_data_t;
-
-static void free_ui_update_data(ui_update_data_t *data) {
-    if (data) {
-        free(data->text);
-        free(data);
-    }
-}
-
-static gboolean update_shuffle_button_ui(gpointer user_data) {
-    ui_update_data_t *data = (ui_update_data_t *)user_data;
-    
-    if (data && data->widget && data->text) {
-        const char *old = gtk_button_get_label(GTK_BUTTON(data->widget));
-        if (strcmp(data->text, old) != 0) {
-            gtk_button_set_label(GTK_BUTTON(data->widget), data->text);
-        }
-    }
-    
-    free_ui_update_data(data);
-    return G_SOURCE_REMOVE;
-}
-
-static gboolean update_repeat_button_ui(gpointer user_data) {
-    ui_update_data_t *data = (ui_update_data_t *)user_data;
-    
-    if (data && data->widget && data->text) {
-        const char *old = gtk_button_get_label(GTK_BUTTON(data->widget));
-        if (strcmp(data->text, old) != 0) {
-            gtk_button_set_label(GTK_BUTTON(data->widget), data->text);
-        }
-    }
-    
-    free_ui_update_data(data);
-    return G_SOURCE_REMOVE;
-}
-
-static gboolean update_combobox_ui(gpointer user_data) {
-    ui_update_data_t *data = (ui_update_data_t *)user_data;
-    
-    if (data && data->widget) {
-        gtk_combo_box_set_active(GTK_COMBO_BOX(data->widget), data->combo_active);
-    }
-    
-    free_ui_update_data(data);
-    return G_SOURCE_REMOVE;
-}
-
-static void safe_shuffle_button_set_text(GtkWidget *widget, const char *text) {
-    if (!widget || !text) return;
-    
-    ui_update_data_t *data = malloc(sizeof(ui_update_data_t));
-    if (!data) return;
-    
-    data->widget = widget;
-    data->text = malloc(strlen(text) + 1);
-    if (!data->text) {
-        free(data);
-        return;
-    }
-    strcpy(data->text, text);
-    data->button_type = 0;
-    
-    g_idle_add(update_shuffle_button_ui, data);
-}
-
-static void safe_repeat_button_set_text(GtkWidget *widget, const char *text) {
-    if (!widget || !text) return;
-    
-    ui_update_data_t *data = malloc(sizeof(ui_update_data_t));
-    if (!data) return;
-    
-    data->widget = widget;
-    data->text = malloc(strlen(text) + 1);
-    if (!data->text) {
-        free(data);
-        return;
-    }
-    strcpy(data->text, text);
-    data->button_type = 1; // Repeat
-    
-    g_idle_add(update_repeat_button_ui, data);
-}
-
-static void safe_combo_box_set_active(GtkWidget *widget, int active) {
-    if (!widget) return;
-    
-    ui_update_data_t *data = malloc(sizeof(ui_update_data_t));
-    if (!data) return;
-    
-    data->widget = widget;
-    data->text = NULL;
-    data->combo_active = active;
-    
-    g_idle_add(update_combobox_ui, data);
-}
+#include "core/metrics.h"
+#include "core/playback_order.h"
+#include "core/trace.h"
 
 // Constants
-#define INITIAL_ARRAY_SIZE 1
-#define MAX_METADATA_LENGTH 2048
 #define BUTTON_WIDTH 110
 #define COMBOBOX_WIDTH 140
-#define TRACE_PREFIX "PlaybackButtons: "
-
-static pthread_mutex_t playlist_mutex;
+#define CONF_METRICS_LOG_INTERVAL "Metrics_Log_Interval_S"
+#define METRICS_FILE_NAME "playback_buttons_metrics.json"
 
-// Enhanced trace macro with function and line number
-#define trace(fmt, ...) fprintf(stderr, TRACE_PREFIX "%s:%d: " fmt, __func__, __LINE__, ##__VA_ARGS__)
-#define CHECK_NULL(ptr, msg) if (!(ptr)) { trace(msg "\n"); return; }
-#define CHECK_NULL_RET(ptr, msg, ret) if (!(ptr)) { trace(msg "\n"); return ret; }
+// Fields of the pending widget state
+#define UI_DIRTY_SHUFFLE 0x1
+#define UI_DIRTY_REPEAT 0x2
+#define UI_DIRTY_COMBO 0x4
 
-
-static void safe_strncpy(char *dest, const char *src, size_t dest_size) {
-    if (!dest || dest_size == 0) {
-        return;
-    }
-    
-    dest[0] = '\0';
-    
-    if (src) {
-        strncpy(dest, src, dest_size - 1);
-        dest[dest_size - 1] = '\0';
-    }
-}
+// Widget state requested from any thread and applied on the GTK main loop
+// by a single idle source, which only sees the latest values. Labels are
+// static strings, so posting an update never allocates.
+typedef struct {
+    const char *shuffle_label;
+    const char *repeat_label;
+    int combo_active;
+    int dirty;                  // UI_DIRTY_* fields not applied yet, accessed atomically
+} ui_pending_t;
 
 // Data structures
 typedef struct {
@@ -163,304 +54,80 @@ typedef struct {
     GtkWidget *shuffle_button;
     GtkWidget *repeat_button;
     GtkWidget *play_combobox;
+    ui_pending_t pending;
 } w_playback_buttons_t;
 
-typedef struct {
-    int *array;
-    size_t used;
-    size_t size;
-} Array;
-
-typedef enum {
-    PLAYLIST = 0,       // Plays tracks in original playlist order
-    KEEP_ALBUM,         // Restricts playback to current album
-    KEEP_ARTIST,        // Restricts playback to current artist
-    TOP_RATED_SONGS,    // Plays tracks with high ratings
-    SELECTION,          // Plays currently selected tracks
-    PURE_RANDOM,        // Completely random track selection
-    SMART_RANDOM        // Random selection weighted by ratings
-} PlayModes;
-
-typedef struct {
-    Array playlist;
-    int current_played_item;
-    PlayModes play_mode;
-    int is_enabled;
-} PluginState;
-
-typedef struct {
-    int plt_id;
-    Array playlist;
-    PlayModes play_mode;
-} SavedPlaylist;
-
 static DB_misc_t plugin;
 static DB_functions_t *deadbeef        = NULL;
 static ddb_gtkui_t *gtkui_plugin       = NULL;
 static w_playback_buttons_t *p_buttons = NULL;
-static PluginState state = { .current_played_item = 0, .play_mode = PLAYLIST, .is_enabled = 0 };
-static SavedPlaylist *saved_playlists = NULL;
-static size_t saved_playlists_count = 0;
-
-// Thread-lokale Variable für Race-Condition-Prävention
-static __thread DB_playItem_t *thread_last_played = NULL;
-
-// Locks mutex with error handling
-static int lock_mutex(pthread_mutex_t *mutex, const char *func_name) {
-    if (!mutex) {
-        trace("NULL mutex in %s\n", func_name);
-        return EINVAL;
-    }
-    
-    int result = pthread_mutex_lock(mutex);
-    if (result != 0) {
-        const char *error_str = "Unknown error";
-        switch (result) {
-            case EINVAL: error_str = "Invalid mutex"; break;
-            case EDEADLK: error_str = "Deadlock detected"; break;
-            case EAGAIN: error_str = "Maximum recursion exceeded"; break;
-        }
-        trace("Failed to lock mutex in %s: %s (%d)\n", func_name, error_str, result);
-    }
-    return result;
-}
-
-// Unlocks mutex with error handling
-static int unlock_mutex(pthread_mutex_t *mutex, const char *func_name) {
-    if (!mutex) {
-        trace("NULL mutex in %s\n", func_name);
-        return EINVAL;
-    }
-    
-    int result = pthread_mutex_unlock(mutex);
-    if (result != 0) {
-        const char *error_str = "Unknown error";
-        switch (result) {
-            case EINVAL: error_str = "Invalid mutex"; break;
-            case EPERM: error_str = "Thread doesn't own mutex"; break;
-        }
-        trace("Failed to unlock mutex in %s: %s (%d)\n", func_name, error_str, result);
-    }
-    return result;
-}
-
-// Frees the array memory in a thread-safe manner
-static int freeArray(Array *a) {
-    CHECK_NULL_RET(a, "Null pointer passed to freeArray", -1);
-    if (lock_mutex(&playlist_mutex, "freeArray") != 0) {
-        return -1;
-    }
-    if (a->array) {
-        free(a->array);
-        a->array = NULL;
-        a->used = a->size = 0;
-    }
-    return unlock_mutex(&playlist_mutex, "freeArray");
-}
-
-// Initializes a dynamic array with thread-safe memory allocation
-static int initArray(Array *a, size_t initialSize) {
-    CHECK_NULL_RET(a, "Null pointer passed to initArray", -1);
-    if (lock_mutex(&playlist_mutex, "initArray") != 0) {
-        return -1;
-    }
-    a->array = malloc(initialSize * sizeof(int));
-    if (!a->array) {
-        trace("Memory allocation failed in initArray\n");
-        unlock_mutex(&playlist_mutex, "initArray");
-        return -1;
-    }
-    memset(a->array, 0, initialSize * sizeof(int));
-    a->used = 0;
-    a->size = initialSize;
-    return unlock_mutex(&playlist_mutex, "initArray");
-}
-
-// Inserts an element into the dynamic array with optimized resizing
-static int insertArray(Array *a, int element) {
-    CHECK_NULL_RET(a, "Null pointer passed to insertArray", -1);
-    
-    if (lock_mutex(&playlist_mutex, "insertArray") != 0) {
-        return -1;
-    }
-    
-    int result = 0;
-    if (a->used == a->size) {
-        size_t growth_factor = (a->size < 1000) ? 2 : 1.5;
-        size_t new_size = a->size * growth_factor + 1;
-        if (new_size > SIZE_MAX / sizeof(int)) {
-            trace("Array size overflow in insertArray\n");
-            result = -1;
-        } else {
-            int *newArray = realloc(a->array, new_size * sizeof(int));
-            if (!newArray) {
-                trace("Memory reallocation failed in insertArray\n");
-                result = -1;
-            } else {
-                a->array = newArray;
-                a->size = new_size;
-            }
-        }
-    }
-    
-    if (result == 0) {
-        a->array[a->used++] = element;
-    }
-    
-    unlock_mutex(&playlist_mutex, "insertArray");
-    return result;
-}
+static guint metrics_timer             = 0;
+static int metrics_interval            = 0;
+static int is_enabled                  = 0;
 
-// Performs a playlist operation in a single critical section
-static int performPlaylistOperation(Array *a, int (*operation)(Array *, void *), void *data) {
-    CHECK_NULL_RET(a, "Null array in performPlaylistOperation", -1);
-    if (lock_mutex(&playlist_mutex, "performPlaylistOperation") != 0) {
-        return -1;
+// Sets a button label unless it is already shown
+static void set_button_label(GtkWidget *button, const char *text) {
+    if (!button || !text) return;
+    const char *old = gtk_button_get_label(GTK_BUTTON(button));
+    if (!old || strcmp(text, old) != 0) {
+        gtk_button_set_label(GTK_BUTTON(button), text);
     }
-    int result = operation(a, data);
-    unlock_mutex(&playlist_mutex, "performPlaylistOperation");
-    return result;
 }
 
-// Shuffles the array using Fisher-Yates algorithm
-static int shuffleArrayOperation(Array *a, void *unused) {
-    if (!a->array || a->used == 0) {
-        trace("Empty or invalid array in shuffleArray\n");
-        return -1;
-    }
-    if (a->used > a->size) {
-        trace("Array inconsistency detected: used (%zu) > size (%zu)\n", a->used, a->size);
-        return -1;
-    }
-    if (a->used <= 1) return 0;
+// Applies the pending widget state on the GTK main loop
+static gboolean apply_pending_ui(gpointer user_data) {
+    w_playback_buttons_t *w = p_buttons;
+    if (!w) return G_SOURCE_REMOVE;
 
-    for (size_t i = a->used - 1; i > 0; i--) {
-#ifdef _POSIX_C_SOURCE
-        size_t j = random() % (i + 1);
-#else
-        size_t j = rand() % (i + 1);
-#endif
-        int temp = a->array[i];
-        a->array[i] = a->array[j];
-        a->array[j] = temp;
+    // Fields posted from here on schedule the next idle source
+    int dirty = __atomic_exchange_n(&w->pending.dirty, 0, __ATOMIC_ACQ_REL);
+    if (dirty & UI_DIRTY_SHUFFLE) {
+        set_button_label(w->shuffle_button, __atomic_load_n(&w->pending.shuffle_label, __ATOMIC_ACQUIRE));
     }
-    return 0;
-}
-
-// Resets the playlist to initial state with pre-allocation
-static int resetPlaylist(Array *a) {
-    if (freeArray(a) != 0) {
-        trace("Failed to free playlist array\n");
-        return -1;
-    }
-    size_t initialSize = INITIAL_ARRAY_SIZE;
-    if (deadbeef) {
-        int count = deadbeef->pl_getcount(PL_MAIN);
-        initialSize = (count > 0) ? count : INITIAL_ARRAY_SIZE;
-    }
-    return initArray(a, initialSize);
-}
-
-// Applies shuffle based on mode
-static void applyShuffle(Array *a, int shuffle_mode, PlayModes play_mode, int *currentItem) {
-    CHECK_NULL(a, "Invalid array in applyShuffle");
-    CHECK_NULL(currentItem, "Invalid currentItem in applyShuffle");
-    
-    if (a->used <= 1) return;
-    
-    if (*currentItem < 0 || *currentItem >= (int)a->used) {
-        trace("Invalid currentItem index %d in applyShuffle\n", *currentItem);
-        *currentItem = 0;
-        return;
+    if (dirty & UI_DIRTY_REPEAT) {
+        set_button_label(w->repeat_button, __atomic_load_n(&w->pending.repeat_label, __ATOMIC_ACQUIRE));
     }
-    
-    if (shuffle_mode != DDB_SHUFFLE_OFF || play_mode == PURE_RANDOM || play_mode == SMART_RANDOM) {
-        int value = a->array[*currentItem];
-        performPlaylistOperation(a, shuffleArrayOperation, NULL);
-        for (size_t i = 0; i < a->used; ++i) {
-            if (a->array[i] == value) {
-                *currentItem = i;
-                break;
-            }
+    if ((dirty & UI_DIRTY_COMBO) && w->play_combobox) {
+        int active = __atomic_load_n(&w->pending.combo_active, __ATOMIC_ACQUIRE);
+        if (gtk_combo_box_get_active(GTK_COMBO_BOX(w->play_combobox)) != active) {
+            gtk_combo_box_set_active(GTK_COMBO_BOX(w->play_combobox), active);
         }
     }
+    return G_SOURCE_REMOVE;
 }
 
-// Seeds the random number generator once
-static void init_random_seed(void) {
-    static int initialized = 0;
-    if (!initialized) {
-#ifdef _POSIX_C_SOURCE
-        srandom(time(NULL));
-#else
-        srand(time(NULL));
-#endif
-        initialized = 1;
+// Marks a field of the pending state dirty; only the first field of a
+// burst wakes the main loop
+static void post_ui_update(w_playback_buttons_t *w, int field) {
+    if (__atomic_fetch_or(&w->pending.dirty, field, __ATOMIC_ACQ_REL) == 0) {
+        g_idle_add(apply_pending_ui, NULL);
     }
 }
 
-// Cleans up global resources
-static void cleanup(void) {
-    int lock_result = pthread_mutex_trylock(&playlist_mutex);
-    int was_locked = (lock_result == 0);
-    
-    // Free saved playlists
-    for (size_t i = 0; i < saved_playlists_count; i++) {
-        freeArray(&saved_playlists[i].playlist);
-    }
-    free(saved_playlists);
-    saved_playlists = NULL;
-    saved_playlists_count = 0;
-    
-    // State cleanup
-    freeArray(&state.playlist);
-    
-    if (was_locked) {
-        unlock_mutex(&playlist_mutex, "cleanup");
-    }
-    
-    pthread_mutex_destroy(&playlist_mutex);
-    
-    trace("Cleanup completed (mutex %s)\n", was_locked ? "locked" : "not locked");
+// Requests a shuffle button label
+static void safe_shuffle_button_set_text(w_playback_buttons_t *w, const char *text) {
+    if (!w || !text) return;
+    __atomic_store_n(&w->pending.shuffle_label, text, __ATOMIC_RELEASE);
+    post_ui_update(w, UI_DIRTY_SHUFFLE);
 }
 
-// Comparison function for sorting array
-static int sortArray(const void *a, const void *b) {
-    int int_a = *(const int *)a;
-    int int_b = *(const int *)b;
-    return (int_a > int_b) - (int_a < int_b);
+// Requests a repeat button label
+static void safe_repeat_button_set_text(w_playback_buttons_t *w, const char *text) {
+    if (!w || !text) return;
+    __atomic_store_n(&w->pending.repeat_label, text, __ATOMIC_RELEASE);
+    post_ui_update(w, UI_DIRTY_REPEAT);
 }
 
-// Sets the currentPlayedItem based on the currently playing or marked track
-static void syncCurrentPlayedItem(void) {
-    DB_playItem_t *playing = deadbeef->streamer_get_playing_track_safe();
-    if (!playing) {
-        trace("No track currently playing\n");
-        return;
-    }
-
-    int idx = deadbeef->pl_get_idx_of(playing);
-    deadbeef->pl_item_unref(playing);
-
-    for (size_t i = 0; i < state.playlist.used; i++) {
-        if (state.playlist.array[i] == idx) {
-            state.current_played_item = i;
-            trace("Current position updated to: %zu (track index %d)\n", i, idx);
-            return;
-        }
-    }
-
-    if (state.playlist.used > 0) {
-        state.current_played_item = 0;
-        trace("Track not found, resetting to first position\n");
-    } else {
-        trace("Playlist empty, can't sync position\n");
-    }
+// Requests the active play mode entry of the combobox
+static void safe_combo_box_set_active(w_playback_buttons_t *w, int active) {
+    if (!w) return;
+    __atomic_store_n(&w->pending.combo_active, active, __ATOMIC_RELEASE);
+    post_ui_update(w, UI_DIRTY_COMBO);
 }
 
 // Updates shuffle button text based on current mode
-static void shuffle_button_set_text(GtkWidget *widget) {
-    CHECK_NULL(widget, "Invalid widget in shuffle_button_set_text");
+static void shuffle_button_set_text(w_playback_buttons_t *w) {
+    CHECK_NULL(w, "Invalid widget in shuffle_button_set_text");
     CHECK_NULL(deadbeef, "Deadbeef API not initialized in shuffle_button_set_text");
 
     const char *text;
@@ -473,30 +140,17 @@ static void shuffle_button_set_text(GtkWidget *widget) {
         default: return;
     }
 
-    const char *old = gtk_button_get_label(GTK_BUTTON(widget));
-    if (strcmp(text, old) != 0) {
-        safe_shuffle_button_set_text(widget, text);
-        
-        if (state.playlist.used > 1) {
-            int value = state.playlist.array[state.current_played_item];
-            if (shuffle_mode == DDB_SHUFFLE_OFF) {
-                qsort(state.playlist.array, state.playlist.used, sizeof(int), sortArray);
-            } else {
-                performPlaylistOperation(&state.playlist, shuffleArrayOperation, NULL);
-            }
-            for (size_t i = 0; i < state.playlist.used; i++) {
-                if (state.playlist.array[i] == value) {
-                    state.current_played_item = i;
-                    break;
-                }
-            }
-        }
+    // Compared with the last requested label, which the main loop may not show yet
+    const char *old = __atomic_load_n(&w->pending.shuffle_label, __ATOMIC_ACQUIRE);
+    if (!old || strcmp(text, old) != 0) {
+        safe_shuffle_button_set_text(w, text);
+        playback_order_shuffle_changed(shuffle_mode);
     }
 }
 
 // Updates repeat button text based on current mode
-static void repeat_button_set_text(GtkWidget *widget) {
-    CHECK_NULL(widget, "Invalid widget in repeat_button_set_text");
+static void repeat_button_set_text(w_playback_buttons_t *w) {
+    CHECK_NULL(w, "Invalid widget in repeat_button_set_text");
     CHECK_NULL(deadbeef, "Deadbeef API not initialized in repeat_button_set_text");
 
     const char *text;
@@ -508,509 +162,28 @@ static void repeat_button_set_text(GtkWidget *widget) {
         default: return;
     }
 
-    const char *old = gtk_button_get_label(GTK_BUTTON(widget));
-    if (strcmp(text, old) != 0) {
-        safe_repeat_button_set_text(widget, text);
-    }
-}
-
-// Checks if playback is active
-static int isPlaybackActive(void) {
-    CHECK_NULL_RET(deadbeef, "Deadbeef API not initialized in isPlaybackActive", 0);
-    return (deadbeef->pl_getcount(PL_MAIN) > 0 && 
-            deadbeef->get_output() != NULL && 
-            deadbeef->get_output()->state() == DDB_PLAYBACK_STATE_PLAYING);
-}
-
-// Updates combobox to default state if playlist is empty
-static void updateComboboxOnEmpty(w_playback_buttons_t *w) {
-    if (state.playlist.used <= 0 && w && w->play_combobox) {
-        state.play_mode = PLAYLIST;
-        safe_combo_box_set_active(w->play_combobox, PLAYLIST);
-    }
-}
-
-// Adds top-rated songs to playlist based on rating
-static void createTopRatedSongs(DB_playItem_t *it, int index) {
-    CHECK_NULL(it, "Invalid play item in createTopRatedSongs");
-    CHECK_NULL(deadbeef, "Deadbeef API not initialized in createTopRatedSongs");
-    int rating = deadbeef->pl_find_meta_int(it, "rating", 0);
-    if (rating >= 4) {
-        insertArray(&state.playlist, index);
-    }
-}
-
-// Adds songs by the same artist to playlist
-static void createKeepArtistSongs(const char *artist, DB_playItem_t *it, int index) {
-    CHECK_NULL(artist, "Invalid artist in createKeepArtistSongs");
-    CHECK_NULL(it, "Invalid play item in createKeepArtistSongs");
-    CHECK_NULL(deadbeef, "Deadbeef API not initialized in createKeepArtistSongs");
-    
-    const char *track_artist = deadbeef->pl_find_meta_raw(it, "artist");
-    if (!track_artist) {
-        return;
-    }
-    
-    if (strstr(track_artist, artist) != NULL) {
-        insertArray(&state.playlist, index);
-    }
-}
-
-// Adds songs from the same album to playlist
-static void createKeepAlbumSongs(const char *folder_uri, DB_playItem_t *it, int index) {
-    CHECK_NULL(folder_uri, "Invalid folder URI in createKeepAlbumSongs");
-    CHECK_NULL(it, "Invalid play item in createKeepAlbumSongs");
-    CHECK_NULL(deadbeef, "Deadbeef API not initialized in createKeepAlbumSongs");
-    
-    const char *track_uri = deadbeef->pl_find_meta(it, ":URI");
-    if (!track_uri) {
-        return;
-    }
-    
-    if (strstr(track_uri, folder_uri) != NULL) {
-        insertArray(&state.playlist, index);
-    }
-}
-
-// Adds selected songs to playlist
-static void createSelectionSongs(DB_playItem_t *it, int index) {
-    CHECK_NULL(it, "Invalid play item in createSelectionSongs");
-    CHECK_NULL(deadbeef, "Deadbeef API not initialized in createSelectionSongs");
-    if (deadbeef->pl_is_selected(it)) {
-        insertArray(&state.playlist, index);
-    }
-}
-
-// Extracts artist name from track metadata (sicher)
-static void extractArtistFromTrack(DB_playItem_t *track, char *artist, size_t size) {
-    CHECK_NULL(track, "Invalid track in extractArtistFromTrack");
-    CHECK_NULL(artist, "Invalid artist buffer in extractArtistFromTrack");
-    CHECK_NULL(deadbeef, "Deadbeef API not initialized in extractArtistFromTrack");
-    
-    artist[0] = '\0';
-    
-    const char *meta = deadbeef->pl_find_meta_raw(track, "artist");
-    if (meta) {
-        safe_strncpy(artist, meta, size);
-        
-        char *feat_ptr = strstr(artist, " feat");
-        if (!feat_ptr) feat_ptr = strstr(artist, " feat.");
-        if (!feat_ptr) feat_ptr = strstr(artist, " featuring");
-        
-        if (feat_ptr) {
-            *feat_ptr = '\0';
-            
-            size_t len = strlen(artist);
-            while (len > 0 && artist[len-1] == ' ') {
-                artist[len-1] = '\0';
-                len--;
-            }
-        }
-    }
-}
-
-// Extracts folder URI from track metadata
-static void extractFolderUriFromTrack(DB_playItem_t *track, char *folder_uri, size_t size) {
-    CHECK_NULL(track, "Invalid track in extractFolderUriFromTrack");
-    CHECK_NULL(folder_uri, "Invalid folder URI buffer in extractFolderUriFromTrack");
-    CHECK_NULL(deadbeef, "Deadbeef API not initialized in extractFolderUriFromTrack");
-    
-    folder_uri[0] = '\0';
-    
-    const char *uri = deadbeef->pl_find_meta(track, ":URI");
-    if (uri) {
-        safe_strncpy(folder_uri, uri, size);
-        
-        char *last_slash = strrchr(folder_uri, '/');
-        if (last_slash) {
-            *last_slash = '\0';
-            
-            char *cd_dir = strstr(folder_uri, "/CD");
-            if (cd_dir) {
-                *cd_dir = '\0';
-                
-                size_t len = strlen(folder_uri);
-                if (len > 0 && folder_uri[len-1] == '/') {
-                    folder_uri[len-1] = '\0';
-                }
-            }
-        }
-    }
-}
-
-// Processes tracks based on specified criteria (mit Parameter-Validierung)
-static void processTrackForCriteria(int criteria, DB_playItem_t *it, int index, const char *artist, const char *folder_uri) {
-    CHECK_NULL(it, "Invalid play item in processTrackForCriteria");
-    
-    if ((criteria == KEEP_ARTIST && (!artist || artist[0] == '\0')) ||
-        (criteria == KEEP_ALBUM && (!folder_uri || folder_uri[0] == '\0'))) {
-        trace("Invalid parameters for criteria %d\n", criteria);
-        return;
-    }
-    
-    switch (criteria) {
-        case TOP_RATED_SONGS: 
-            createTopRatedSongs(it, index); 
-            break;
-        case KEEP_ARTIST:     
-            if (artist && artist[0] != '\0') {
-                createKeepArtistSongs(artist, it, index); 
-            }
-            break;
-        case KEEP_ALBUM:      
-            if (folder_uri && folder_uri[0] != '\0') {
-                createKeepAlbumSongs(folder_uri, it, index); 
-            }
-            break;
-        case SELECTION:       
-            createSelectionSongs(it, index); 
-            break;
-        default:
-            trace("Unknown criteria type: %d\n", criteria);
-            break;
-    }
-}
-
-// Creates a playlist based on specified criteria
-static void createPlaylistByCriteria(int criteriaType) {
-    CHECK_NULL(deadbeef, "Deadbeef API not initialized in createPlaylistByCriteria");
-    
-    ddb_playlist_t *plt = deadbeef->plt_get_curr();
-    if (!plt) {
-        trace("No current playlist found\n");
-        return;
-    }
-    
-    DB_playItem_t *playedSong = deadbeef->streamer_get_playing_track_safe();
-    if (!playedSong) {
-        trace("No playing track found\n");
-        deadbeef->plt_unref(plt);
-        return;
-    }
-    
-    deadbeef->pl_lock();
-    
-    char artist[MAX_METADATA_LENGTH] = {0};
-    char folder_uri[MAX_METADATA_LENGTH] = {0};
-    
-    if (criteriaType == KEEP_ARTIST) {
-        extractArtistFromTrack(playedSong, artist, sizeof(artist));
-    } else if (criteriaType == KEEP_ALBUM) {
-        extractFolderUriFromTrack(playedSong, folder_uri, sizeof(folder_uri));
-    }
-    
-    state.current_played_item = 0;
-    int index = 0;
-    DB_playItem_t *it = deadbeef->plt_get_first(plt, PL_MAIN);
-    
-    while (it) {
-        DB_playItem_t *next = deadbeef->pl_get_next(it, PL_MAIN);
-        processTrackForCriteria(criteriaType, it, index, artist, folder_uri);
-        
-        if (it == playedSong) {
-            state.current_played_item = state.playlist.used - 1;
-        }
-        
-        deadbeef->pl_item_unref(it);
-        it = next;
-        ++index;
-    }
-    
-    deadbeef->pl_item_unref(playedSong);
-    deadbeef->plt_unref(plt);
-    deadbeef->pl_unlock();
-}
-
-// Creates a pure random playlist
-static void createPureRandomList(void) {
-    CHECK_NULL(deadbeef, "Deadbeef API not initialized in createPureRandomList");
-    
-    ddb_playlist_t *plt = deadbeef->plt_get_curr();
-    if (!plt) {
-        trace("No current playlist found\n");
-        return;
-    }
-    
-    DB_playItem_t *playedSong = deadbeef->streamer_get_playing_track_safe();
-    
-    deadbeef->pl_lock();
-    
-    state.current_played_item = 0;
-    int index = 0;
-    
-    DB_playItem_t *it = deadbeef->plt_get_first(plt, PL_MAIN);
-    
-    while (it) {
-        DB_playItem_t *next = deadbeef->pl_get_next(it, PL_MAIN);
-        
-        if (playedSong && it == playedSong) {
-            state.current_played_item = index;
-        }
-        
-        if (insertArray(&state.playlist, index) != 0) {
-            trace("Failed to insert index into playlist\n");
-            deadbeef->pl_item_unref(it);
-            if (next) deadbeef->pl_item_unref(next);
-            break;
-        }
-        
-        deadbeef->pl_item_unref(it);
-        it = next;
-        ++index;
-    }
-    
-    if (playedSong) {
-        deadbeef->pl_item_unref(playedSong);
-    }
-    deadbeef->plt_unref(plt);
-    deadbeef->pl_unlock();
-    
-    if (state.playlist.used > 1) {
-        performPlaylistOperation(&state.playlist, shuffleArrayOperation, NULL);
-    }
-}
-
-// Creates a smart random playlist with rating-based weighting
-static void createSmartRandomList(void) {
-    CHECK_NULL(deadbeef, "Deadbeef API not initialized in createSmartRandomList");
-    
-    ddb_playlist_t *plt = deadbeef->plt_get_curr();
-    if (!plt) {
-        trace("No current playlist found\n");
-        return;
-    }
-    
-    if (resetPlaylist(&state.playlist) != 0) {
-        deadbeef->plt_unref(plt);
-        return;
-    }
-    
-    DB_playItem_t *playedSong = deadbeef->streamer_get_playing_track_safe();
-    if (!playedSong) {
-        trace("No currently playing track found\n");
-        deadbeef->plt_unref(plt);
-        return;
-    }
-    
-    deadbeef->pl_lock();
-    
-    Array tempList;
-    if (initArray(&tempList, deadbeef->pl_getcount(PL_MAIN)) != 0) {
-        deadbeef->pl_item_unref(playedSong);
-        deadbeef->plt_unref(plt);
-        deadbeef->pl_unlock();
-        return;
-    }
-    
-    int index = 0;
-    DB_playItem_t *it = deadbeef->plt_get_first(plt, PL_MAIN);
-    
-    while (it) {
-        int rating = deadbeef->pl_find_meta_int(it, "rating", 0);
-        int weight = rating + 1;
-        
-        for (int i = 0; i < weight; i++) {
-            if (insertArray(&tempList, index) != 0) {
-                trace("Failed to insert weighted index into temp playlist\n");
-                freeArray(&tempList);
-                deadbeef->pl_item_unref(it);
-                deadbeef->pl_item_unref(playedSong);
-                deadbeef->plt_unref(plt);
-                deadbeef->pl_unlock();
-                return;
-            }
-        }
-        
-        if (it == playedSong) {
-            state.current_played_item = tempList.used - 1;
-        }
-        
-        DB_playItem_t *next = deadbeef->pl_get_next(it, PL_MAIN);
-        deadbeef->pl_item_unref(it);
-        it = next;
-        ++index;
-    }
-    
-    for (size_t i = 0; i < tempList.used; i++) {
-        if (insertArray(&state.playlist, tempList.array[i]) != 0) {
-            trace("Failed to copy index to main playlist\n");
-            break;
-        }
-    }
-    
-    freeArray(&tempList);
-    
-    if (state.playlist.used > 1) {
-        performPlaylistOperation(&state.playlist, shuffleArrayOperation, NULL);
-    }
-    
-    deadbeef->pl_item_unref(playedSong);
-    deadbeef->plt_unref(plt);
-    deadbeef->pl_unlock();
-}
-
-// Creates a default playlist
-static void createDefaultList(void) {
-    CHECK_NULL(deadbeef, "Deadbeef API not initialized in createDefaultList");
-    
-    ddb_playlist_t *plt = deadbeef->plt_get_curr();
-    if (!plt) {
-        trace("No current playlist found\n");
-        return;
-    }
-    
-    deadbeef->pl_lock();
-    
-    state.current_played_item = 0;
-    int index = 0;
-    
-    DB_playItem_t *playedSong = deadbeef->streamer_get_playing_track_safe();
-    DB_playItem_t *it = deadbeef->plt_get_first(plt, PL_MAIN);
-    
-    while (it) {
-        DB_playItem_t *next = deadbeef->pl_get_next(it, PL_MAIN);
-        
-        if (playedSong && it == playedSong) {
-            state.current_played_item = index;
-        }
-        
-        if (insertArray(&state.playlist, index) != 0) {
-            trace("Failed to insert index into playlist\n");
-            deadbeef->pl_item_unref(it);
-            if (next) deadbeef->pl_item_unref(next);
-            break;
-        }
-        
-        deadbeef->pl_item_unref(it);
-        it = next;
-        ++index;
-    }
-    
-    if (playedSong) {
-        deadbeef->pl_item_unref(playedSong);
-    }
-    deadbeef->plt_unref(plt);
-    deadbeef->pl_unlock();
-}
-
-// Finds a saved playlist by ID
-static SavedPlaylist* find_saved_playlist(int plt_id) {
-    for (size_t i = 0; i < saved_playlists_count; i++) {
-        if (saved_playlists[i].plt_id == plt_id) {
-            return &saved_playlists[i];
-        }
+    const char *old = __atomic_load_n(&w->pending.repeat_label, __ATOMIC_ACQUIRE);
+    if (!old || strcmp(text, old) != 0) {
+        safe_repeat_button_set_text(w, text);
     }
-    return NULL;
 }
 
-// Saves the current playlist state
-static void save_current_playlist(int plt_id) {
-    SavedPlaylist *sp = find_saved_playlist(plt_id);
-    if (!sp) {
-        // Create new saved playlist
-        saved_playlists = realloc(saved_playlists, (saved_playlists_count + 1) * sizeof(SavedPlaylist));
-        sp = &saved_playlists[saved_playlists_count++];
-        sp->plt_id = plt_id;
-        initArray(&sp->playlist, state.playlist.size);
-    }
-    
-    // Copy current playlist
-    freeArray(&sp->playlist);
-    initArray(&sp->playlist, state.playlist.size);
-    for (size_t i = 0; i < state.playlist.used; i++) {
-        insertArray(&sp->playlist, state.playlist.array[i]);
+// Updates combobox to default state if the generated order is empty
+static void updateComboboxOnEmpty(void) {
+    w_playback_buttons_t *w = p_buttons;
+    if (w && w->play_combobox) {
+        playback_order_set_mode(PLAYLIST);
+        safe_combo_box_set_active(w, PLAYLIST);
     }
-    sp->play_mode = state.play_mode;
 }
 
-// Loads a saved playlist
-static int load_saved_playlist(int plt_id) {
-    SavedPlaylist *sp = find_saved_playlist(plt_id);
-    if (!sp) return 0;
-    
-    freeArray(&state.playlist);
-    initArray(&state.playlist, sp->playlist.size);
-    for (size_t i = 0; i < sp->playlist.used; i++) {
-        insertArray(&state.playlist, sp->playlist.array[i]);
-    }
-    state.play_mode = sp->play_mode;
-    return 1;
-}
-
-// Generates the current playlist based on selected mode
-static void createSongList(void) {
-    static time_t last_generation = 0;
-    time_t now = time(NULL);
-
-    // Rate-Limiting
-    if ((now - last_generation) < 2) {
-        trace("Playlist generation throttled (last: %ld, now: %ld)\n", last_generation, now);
-        return;
-    }
-    last_generation = now;
-
-    if (!isPlaybackActive()) {
-        updateComboboxOnEmpty(p_buttons);
-        return;
-    }
-
-    int plt_id = deadbeef->plt_get_curr_idx();
-    SavedPlaylist *sp = find_saved_playlist(plt_id);
-
-    if (!sp || sp->play_mode != state.play_mode) {
-        trace("Generating new playlist for mode: %d\n", state.play_mode);
-        
-        if (resetPlaylist(&state.playlist) != 0) {
-            trace("Failed to reset playlist array\n");
-            return;
-        }
-
-        switch (state.play_mode) {
-            case PLAYLIST:
-                createDefaultList();
-                break;
-            case KEEP_ALBUM:
-                createPlaylistByCriteria(KEEP_ALBUM);
-                break;
-            case KEEP_ARTIST:
-                createPlaylistByCriteria(KEEP_ARTIST);
-                break;
-            case TOP_RATED_SONGS:
-                createPlaylistByCriteria(TOP_RATED_SONGS);
-                break;
-            case SELECTION:
-                createPlaylistByCriteria(SELECTION);
-                break;
-            case PURE_RANDOM:
-                createPureRandomList();
-                break;
-            case SMART_RANDOM:
-                createSmartRandomList();
-                break;
-        }
-
-        int shuffle_mode = deadbeef->streamer_get_shuffle();
-        applyShuffle(&state.playlist, shuffle_mode, state.play_mode, &state.current_played_item);
-
-        if (lock_mutex(&playlist_mutex, "createSongList_sync") == 0) {
-            syncCurrentPlayedItem();
-            unlock_mutex(&playlist_mutex, "createSongList_sync");
-        }
-        
-        save_current_playlist(plt_id);
-        
-        trace("Generated playlist with %zu items\n", state.playlist.used);
-    }
-
-    updateComboboxOnEmpty(p_buttons);
-}
 
 // Saves the current playback button state
 static void save_playback_button_state(void) {
     CHECK_NULL(deadbeef, "Deadbeef API not initialized in save_playback_button_state");
     char key[64];
     snprintf(key, sizeof(key), "Playback_Buttons_State_playlist_%i", deadbeef->plt_get_curr_idx());
-    deadbeef->conf_set_int(key, state.play_mode);
+    deadbeef->conf_set_int(key, playback_order_get_mode());
 }
 
 // Restores the saved playback button state
@@ -1024,19 +197,15 @@ static void restore_playback_button_state(void) {
     int mode = deadbeef->conf_get_int(key, PLAYLIST);
     
     // Only update if mode changed
-    if (mode != state.play_mode) {
-        state.play_mode = mode;
+    if (mode != playback_order_get_mode()) {
+        playback_order_set_mode(mode);
         
         // Update combobox
-        safe_combo_box_set_active(p_buttons->play_combobox, mode);
+        safe_combo_box_set_active(p_buttons, mode);
         
         // Force playlist regeneration
-        int plt_id = deadbeef->plt_get_curr_idx();
-        SavedPlaylist *sp = find_saved_playlist(plt_id);
-        if (sp) {
-            freeArray(&sp->playlist);
-        }
-        createSongList();
+        playback_order_invalidate(deadbeef->plt_get_curr_idx());
+        playback_order_generate();
     }
 }
 
@@ -1049,28 +218,24 @@ static void play_ComboBox_changed(GtkWidget *widget, gpointer user_data) {
     PlayModes new_mode = gtk_combo_box_get_active(GTK_COMBO_BOX(widget));
     
     // Only proceed if mode actually changed
-    if (new_mode == state.play_mode) {
+    if (new_mode == playback_order_get_mode()) {
         return;
     }
     
-    state.play_mode = new_mode;
+    playback_order_set_mode(new_mode);
 
     // Handle special cases for random modes
-    if ((state.play_mode == PURE_RANDOM || state.play_mode == SMART_RANDOM) 
+    if ((new_mode == PURE_RANDOM || new_mode == SMART_RANDOM) 
         && deadbeef->streamer_get_shuffle() != DDB_SHUFFLE_TRACKS) {
         deadbeef->streamer_set_shuffle(DDB_SHUFFLE_TRACKS);
         deadbeef->sendmessage(DB_EV_CONFIGCHANGED, 0, 0, 0);
     }
 
     // Force new playlist generation
-    int plt_id = deadbeef->plt_get_curr_idx();
-    SavedPlaylist *sp = find_saved_playlist(plt_id);
-    if (sp) {
-        freeArray(&sp->playlist);
-    }
+    playback_order_invalidate(deadbeef->plt_get_curr_idx());
     
     // Create new playlist for current mode
-    createSongList();
+    playback_order_generate();
     
     // Save the new state
     save_playback_button_state();
@@ -1083,16 +248,17 @@ static int playback_buttons_message(ddb_gtkui_widget_t *widget, uint32_t id, uin
     w_playback_buttons_t *w = (w_playback_buttons_t *)widget;
 
     if (id == DB_EV_CONFIGCHANGED) {
-        if ((state.play_mode == PURE_RANDOM || state.play_mode == SMART_RANDOM) 
+        PlayModes mode = playback_order_get_mode();
+        if ((mode == PURE_RANDOM || mode == SMART_RANDOM) 
             && deadbeef->streamer_get_shuffle() != DDB_SHUFFLE_TRACKS) {
-            state.play_mode = PLAYLIST;
+            playback_order_set_mode(PLAYLIST);
             if (w->play_combobox) {
-                safe_combo_box_set_active(w->play_combobox, PLAYLIST);
+                safe_combo_box_set_active(w, PLAYLIST);
                 trace("Reset play mode to PLAYLIST due to incompatible shuffle mode\n");
             }
         }
-        shuffle_button_set_text(w->shuffle_button);
-        repeat_button_set_text(w->repeat_button);
+        shuffle_button_set_text(w);
+        repeat_button_set_text(w);
     }
     return 0;
 }
@@ -1130,7 +296,10 @@ static GtkWidget *create_combobox(w_playback_buttons_t *w) {
     gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(combobox), "Selection");
     gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(combobox), "Pure Random");
     gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(combobox), "Smart Random");
-    gtk_combo_box_set_active(GTK_COMBO_BOX(combobox), 0);
+    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(combobox), "Keep Genre");
+    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(combobox), "Keep Year");
+    // The engine may have restored the mode of the last session
+    gtk_combo_box_set_active(GTK_COMBO_BOX(combobox), playback_order_get_mode());
     gtk_widget_show(combobox);
     gtk_widget_set_size_request(combobox, COMBOBOX_WIDTH, 32);
     g_signal_connect((gpointer)combobox, "changed", G_CALLBACK(play_ComboBox_changed), w);
@@ -1153,39 +322,62 @@ static int __attribute__((used)) playback_buttons_disconnect(void) {
     return 0;
 }
 
+// Logs the metrics snapshot; runs on the GTK main loop
+static gboolean log_metrics(gpointer data) {
+    if (!trace_enabled(TRACE_LEVEL_INFO)) return TRUE;
+    char *json = playback_order_metrics_json();
+    if (json) {
+        trace_info("Metrics %s\n", json);
+        free(json);
+    }
+    return TRUE;
+}
+
+// Starts, changes or stops periodic metrics logging from the configuration;
+// without Info logging there is nothing to log
+static void schedule_metrics_log(void) {
+    int interval = deadbeef->conf_get_int(CONF_METRICS_LOG_INTERVAL, 0);
+    if (interval < 0 || !trace_enabled(TRACE_LEVEL_INFO)) interval = 0;
+    if (interval == metrics_interval) return;
+    if (metrics_timer) {
+        g_source_remove(metrics_timer);
+        metrics_timer = 0;
+    }
+    metrics_interval = interval;
+    if (interval > 0) {
+        metrics_timer = g_timeout_add_seconds((guint)interval, log_metrics, NULL);
+    }
+}
+
 // Initializes the plugin
 static int playback_buttons_start(void) {
-    pthread_mutexattr_t attr;
-    pthread_mutexattr_init(&attr);
-    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-    
-    if (pthread_mutex_init(&playlist_mutex, &attr) != 0) {
-        pthread_mutexattr_destroy(&attr);
-        trace("Failed to initialize recursive mutex\n");
-        return -1;
-    }
-    pthread_mutexattr_destroy(&attr);
-    
-    init_random_seed();
-    if (initArray(&state.playlist, INITIAL_ARRAY_SIZE) != 0) {
-        cleanup();
+    static const playback_order_hooks_t hooks = {
+        .order_empty = updateComboboxOnEmpty,
+    };
+
+    if (playback_order_init(deadbeef, &hooks) != 0) {
         return -1;
     }
 
-    createSongList();
-    
-    if (lock_mutex(&playlist_mutex, "playback_buttons_start") == 0) {
-        syncCurrentPlayedItem();
-        unlock_mutex(&playlist_mutex, "playback_buttons_start");
+    // Resume the order of the last session unless the playlist changed since
+    if (!playback_order_load(deadbeef->plt_get_curr_idx())) {
+        playback_order_generate();
     }
+    playback_order_sync();
+    schedule_metrics_log();
     
-    trace("Player started with song index: %d\n", state.current_played_item);
+    trace_info("Player started with song index: %d\n", playback_order_position());
     return 0;
 }
 
 // Stops the plugin and cleans up
 static int __attribute__((used)) playback_buttons_stop(void) {
-    cleanup();
+    if (metrics_timer) {
+        g_source_remove(metrics_timer);
+        metrics_timer = 0;
+        metrics_interval = 0;
+    }
+    playback_order_cleanup();
     return 0;
 }
 
@@ -1218,8 +410,8 @@ static void playback_buttons_init(ddb_gtkui_widget_t *ww) {
     gtk_box_pack_start(GTK_BOX(hbox), w->repeat_button, FALSE, TRUE, 0);
 
     // Update button labels
-    shuffle_button_set_text(w->shuffle_button);
-    repeat_button_set_text(w->repeat_button);
+    shuffle_button_set_text(w);
+    repeat_button_set_text(w);
 
     // Register widget signals (avoid overriding tray signals)
     gtkui_plugin->w_override_signals(w->base.widget, w);
@@ -1230,9 +422,11 @@ static void playback_buttons_init(ddb_gtkui_widget_t *ww) {
 
 // Destroys the playback buttons widget
 static void playback_buttons_destroy(ddb_gtkui_widget_t *w) {
-    if (freeArray(&state.playlist) != 0) {
-        trace("Failed to free playlist array during destroy\n");
+    // A pending idle source finds no widget to update
+    if (p_buttons == (w_playback_buttons_t *)w) {
+        p_buttons = NULL;
     }
+    playback_order_clear();
 }
 
 // Creates a new playback buttons widget instance
@@ -1255,13 +449,13 @@ static int __attribute__((used)) playback_buttons_connect(void) {
     CHECK_NULL_RET(deadbeef, "Deadbeef API not initialized in playback_buttons_connect", -1);
     gtkui_plugin = (ddb_gtkui_t *)deadbeef->plug_get_for_id(DDB_GTKUI_PLUGIN_ID);
     if (!gtkui_plugin) {
-        trace("Failed to get gtkui_plugin in playback_buttons_connect\n");
+        trace_error("Failed to get gtkui_plugin in playback_buttons_connect\n");
         return -1;
     }
 
     // Register widget (void return, no error checking possible)
     gtkui_plugin->w_reg_widget("Playback Buttons", DDB_WF_SINGLE_INSTANCE, w_playback_buttons_create, "shuffle_mode", NULL);
-    trace("Successfully registered Playback Buttons widget\n");
+    trace_info("Successfully registered Playback Buttons widget\n");
     return 0;
 }
 
@@ -1317,57 +511,38 @@ static void change_repeat_mode(void) {
     }
 }
 
-// Handles DeaDBeeF events
-static int handle_event(uint32_t current_event, uintptr_t ctx, uint32_t p1, uint32_t p2) {
-    CHECK_NULL_RET(deadbeef, "Deadbeef API not initialized in handle_event", -1);
+// Dispatches DeaDBeeF events
+static int dispatch_event(uint32_t current_event, uintptr_t ctx, uint32_t p1, uint32_t p2) {
+    CHECK_NULL_RET(deadbeef, "Deadbeef API not initialized in dispatch_event", -1);
     
     if (current_event == DB_EV_PLAYLISTSWITCHED) {
         int plt_id = deadbeef->plt_get_curr_idx();
-        if (!load_saved_playlist(plt_id)) {
-            if (state.is_enabled) {
+        if (!playback_order_load(plt_id)) {
+            if (is_enabled) {
                 change_playback_mode();
                 change_repeat_mode();
                 restore_playback_button_state();
             }
-            createSongList();
+            playback_order_generate();
         }
         
-        if (lock_mutex(&playlist_mutex, "handle_event_playlistswitched") == 0) {
-            syncCurrentPlayedItem();
-            unlock_mutex(&playlist_mutex, "handle_event_playlistswitched");
-        }
+        playback_order_sync();
         return 0;
     }
     else if (current_event == DB_EV_PLAYLISTCHANGED) {
-        int plt_id = deadbeef->plt_get_curr_idx();
-        if ((int)p1 == plt_id) {
-            save_current_playlist(plt_id);
-            createSongList();
-        }
+        playback_order_playlist_changed((int)p1);
         return 0;
     }
-   else if (current_event == DB_EV_SONGCHANGED || current_event == DB_EV_TRACKINFOCHANGED) {
-    DB_playItem_t *playing = deadbeef->streamer_get_playing_track_safe();
-    if (!playing) return 0;
-
-    if (playing != thread_last_played) {
-        if (lock_mutex(&playlist_mutex, "handle_event_songchanged") == 0) {
-            syncCurrentPlayedItem();
-            unlock_mutex(&playlist_mutex, "handle_event_songchanged");
-        }
-        
-        if (thread_last_played) {
-            deadbeef->pl_item_unref(thread_last_played);
-        }
-        thread_last_played = playing;
-    } else {
-        deadbeef->pl_item_unref(playing);
+    else if (current_event == DB_EV_SONGCHANGED || current_event == DB_EV_TRACKINFOCHANGED) {
+        playback_order_track_changed();
+        return 0;
     }
-    return 0;
-}
     else if (current_event == DB_EV_CONFIGCHANGED) {
-        state.is_enabled = deadbeef->conf_get_int("Remember_Playback_Mode_Enabled", 0);
-        if (!state.is_enabled) return 0;
+        trace_set_level(deadbeef->conf_get_int("Trace_Level", TRACE_LEVEL_WARN));
+        schedule_metrics_log();
+        playback_order_config_changed();
+        is_enabled = deadbeef->conf_get_int("Remember_Playback_Mode_Enabled", 0);
+        if (!is_enabled) return 0;
 
         int old_mode = get_playback_mode();
         int shuffle_mode = deadbeef->streamer_get_shuffle();
@@ -1388,47 +563,29 @@ static int handle_event(uint32_t current_event, uintptr_t ctx, uint32_t p1, uint
         return 0;
     }
 
-    if (state.play_mode == PLAYLIST || deadbeef->playqueue_get_count() != 0) return 0;
-
+    // DeaDBeeF ignores what message() returns and takes its own step after
+    // every plugin saw the event, so NEXT/PREV cannot be swallowed here
     if (current_event == DB_EV_NEXT || current_event == DB_EV_PREV) {
-        if (state.playlist.used == 0) {
-            createSongList();
-            if (lock_mutex(&playlist_mutex, "handle_event_navigation") == 0) {
-                syncCurrentPlayedItem();
-                unlock_mutex(&playlist_mutex, "handle_event_navigation");
-            }
-        }
-
-        if (state.playlist.used == 0) {
-            trace("Playlist still empty after generation, aborting navigation\n");
-            return 0;
-        }
-
-        deadbeef->sendmessage(DB_EV_STOP, 0, 0, 0);
-
-        if (deadbeef->streamer_get_shuffle() == DDB_SHUFFLE_RANDOM) {
-            deadbeef->sendmessage(DB_EV_PLAY_NUM, 0, state.playlist.array[rand() % state.playlist.used], 0);
-        } else {
-            if (current_event == DB_EV_NEXT) {
-                state.current_played_item++;
-                if (state.current_played_item >= (int)state.playlist.used) state.current_played_item = 0;
-            } else {
-                state.current_played_item--;
-                if (state.current_played_item < 0) state.current_played_item = state.playlist.used - 1;
-            }
-            deadbeef->sendmessage(DB_EV_PLAY_NUM, 0, state.playlist.array[state.current_played_item], 0);
-        }
+        playback_order_navigate(current_event);
     }
     return 0;
 }
 
+// Handles DeaDBeeF events and records how long each one took
+static int handle_event(uint32_t current_event, uintptr_t ctx, uint32_t p1, uint32_t p2) {
+    uint64_t started = metrics_now_ns();
+    int result = dispatch_event(current_event, ctx, p1, p2);
+    playback_order_record_event(current_event, metrics_now_ns() - started);
+    return result;
+}
+
 // Helper for context menu actions
 static int context_action_helper(PlayModes new_play_mode) {
-    state.play_mode = new_play_mode;
+    playback_order_set_mode(new_play_mode);
     if (p_buttons && p_buttons->play_combobox) {
-        safe_combo_box_set_active(p_buttons->play_combobox, state.play_mode);
+        safe_combo_box_set_active(p_buttons, new_play_mode);
     }
-    createSongList();
+    playback_order_generate();
     return 0;
 }
 
@@ -1439,14 +596,54 @@ static int setSelection_action(DB_plugin_action_t *action, ddb_action_context_t
 static int TopRated_action(DB_plugin_action_t *action, ddb_action_context_t ctx) { return context_action_helper(TOP_RATED_SONGS); }
 static int setAlbum_action(DB_plugin_action_t *action, ddb_action_context_t ctx) { return context_action_helper(KEEP_ALBUM); }
 static int setArtist_action(DB_plugin_action_t *action, ddb_action_context_t ctx) { return context_action_helper(KEEP_ARTIST); }
+static int setGenre_action(DB_plugin_action_t *action, ddb_action_context_t ctx) { return context_action_helper(KEEP_GENRE); }
+static int setYear_action(DB_plugin_action_t *action, ddb_action_context_t ctx) { return context_action_helper(KEEP_YEAR); }
 static int setDisabled(DB_plugin_action_t *action, ddb_action_context_t ctx) { return context_action_helper(PLAYLIST); }
 
+// Writes the metrics snapshot to the configuration directory
+static int writeMetrics_action(DB_plugin_action_t *action, ddb_action_context_t ctx) {
+    CHECK_NULL_RET(deadbeef, "Deadbeef API not initialized in writeMetrics_action", -1);
+    const char *dir = deadbeef->get_system_dir(DDB_SYS_DIR_CONFIG);
+    CHECK_NULL_RET(dir, "No configuration directory in writeMetrics_action", -1);
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, METRICS_FILE_NAME);
+    if (playback_order_metrics_write(path) != 0) {
+        return -1;
+    }
+    trace_info("Metrics written to %s\n", path);
+    return 0;
+}
+
+static DB_plugin_action_t metrics_action = {
+    .title = "Help/Write Playback Buttons Diagnostics",
+    .name = "playback_buttons_metrics",
+    .flags = DB_ACTION_COMMON | DB_ACTION_ADD_MENU,
+    .callback2 = writeMetrics_action,
+    .next = NULL
+};
+
+static DB_plugin_action_t context9_action = {
+    .title = "Custom Playlist/Set Year",
+    .name = "custom_playlist9",
+    .flags = DB_ACTION_SINGLE_TRACK | DB_ACTION_MULTIPLE_TRACKS | DB_ACTION_ADD_MENU,
+    .callback2 = setYear_action,
+    .next = &metrics_action
+};
+
+static DB_plugin_action_t context8_action = {
+    .title = "Custom Playlist/Set Genre",
+    .name = "custom_playlist8",
+    .flags = DB_ACTION_SINGLE_TRACK | DB_ACTION_MULTIPLE_TRACKS | DB_ACTION_ADD_MENU,
+    .callback2 = setGenre_action,
+    .next = &context9_action
+};
+
 static DB_plugin_action_t context7_action = {
     .title = "Custom Playlist/Set Smart Random",
     .name = "custom_playlist7",
     .flags = DB_ACTION_MULTIPLE_TRACKS | DB_ACTION_ADD_MENU,
     .callback2 = setSmartRandom_action,
-    .next = NULL
+    .next = &context8_action
 };
 
 static DB_plugin_action_t context6_action = {
@@ -1537,7 +734,18 @@ static DB_misc_t plugin = {
     .plugin.connect = playback_buttons_connect,
     .plugin.disconnect = playback_buttons_disconnect,
     .plugin.message = handle_event,
-    .plugin.configdialog = "property \"Enable saving play modes per playlist.\" checkbox Remember_Playback_Mode_Enabled 0 ;\n",
+    .plugin.configdialog =
+        "property \"Enable saving play modes per playlist.\" checkbox Remember_Playback_Mode_Enabled 0 ;\n"
+        "property \"Update orders incrementally when a playlist changes.\" checkbox Incremental_Order_Updates_Enabled 1 ;\n"
+        "property \"Compute random orders on demand instead of storing them.\" checkbox Lazy_Random_Order_Enabled 1 ;\n"
+        "property \"Memory for saved orders of other playlists (KB, 0 = unlimited).\" entry Saved_Orders_Cache_KB 65536 ;\n"
+        "property \"Wait for playlist changes to settle before updating the order (ms).\" entry Playlist_Change_Quiet_Ms 250 ;\n"
+        "property \"Keep orders and positions across restarts.\" checkbox Persist_Orders_Enabled 1 ;\n"
+        "property \"Tracks of the order kept in the play queue ahead (0 = none).\" entry Lookahead_Tracks 1 ;\n"
+        "property \"Random draws skip tracks already played in the playlist.\" checkbox Skip_Played_Tracks_Enabled 0 ;\n"
+        "property \"Memory for the played tracks of all playlists (KB, 0 = unlimited).\" entry Played_Sets_Cache_KB 1024 ;\n"
+        "property \"Log level\" select[4] Trace_Level 1 Errors Warnings Info Debug ;\n"
+        "property \"Log metrics every n seconds at level Info (0 = never).\" entry Metrics_Log_Interval_S 0 ;\n",
     .plugin.get_actions = context_actions,
 };
 
@@ -0,0 +1,324 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    Benchmark for the ordering engine, run against the headless fake host.
+    Every case runs in its own child process so that peak RSS, the engine's
+    static state and the build worker start out clean.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "core/playback_order.h"
+#include "fakehost.h"
+#include "verify.h"
+
+#define MAX_SIZES 16
+#define DEFAULT_NAV_STEPS 1000
+#define DEFAULT_EDIT_SIZE 10
+
+// Allocation counters, fed by the --wrap'ed allocator entry points
+typedef struct {
+    uint64_t mallocs;
+    uint64_t reallocs;
+    uint64_t frees;
+    uint64_t bytes;
+} alloc_stats_t;
+
+static alloc_stats_t allocs;
+static int counting = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size) {
+    if (counting) { allocs.mallocs++; allocs.bytes += size; }
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+    if (counting) { allocs.mallocs++; allocs.bytes += n * size; }
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    if (counting) { allocs.reallocs++; allocs.bytes += size; }
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr) {
+    if (counting && ptr) allocs.frees++;
+    __real_free(ptr);
+}
+
+typedef struct {
+    fakehost_config_t host;
+    int sizes[MAX_SIZES];
+    int size_count;
+    int nav_steps;
+    int edit_size;
+    int lookahead;
+    int verbose;
+} bench_options_t;
+
+static const char *mode_names[] = {
+    "playlist", "keep_album", "keep_artist", "top_rated", "selection", "pure_random", "smart_random",
+    "keep_genre", "keep_year"
+};
+
+static uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static long peak_rss_kb(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+// Runs one navigation event followed by the song change it triggers
+static uint64_t time_navigation(uint32_t event, int steps) {
+    if (steps <= 0) return 0;
+    uint64_t start = bench_now_ns();
+    for (int i = 0; i < steps; i++) {
+        playback_order_navigate(event);
+        // The host acts on the event after the plugin did
+        fakehost_native_event(event);
+        playback_order_track_changed();
+    }
+    return (bench_now_ns() - start) / (uint64_t)steps;
+}
+
+// Lets tracks end the way the streamer continues gaplessly: it takes the
+// next track from the queue while the current one still plays, and an
+// event of that track arrives before the song changes. Returns the number
+// of tracks that played again right after themselves.
+static int count_preload_repeats(int steps) {
+    int repeats = 0;
+    for (int i = 0; i < steps; i++) {
+        int before = fakehost_playing_index();
+        fakehost_preload_track();
+        // DB_EV_TRACKINFOCHANGED of the track that still plays
+        playback_order_track_changed();
+        fakehost_finish_track();
+        playback_order_track_changed();
+        if (fakehost_playing_index() == before) repeats++;
+    }
+    return repeats;
+}
+
+// Applies a drag-and-drop style edit to the fake playlist and times the
+// DB_EV_PLAYLISTCHANGED handling that follows it
+static uint64_t time_playlist_edit(int edit_size, uint64_t *meta_lookups) {
+    int count = fakehost_track_count();
+    if (edit_size <= 0 || count < edit_size * 4) {
+        *meta_lookups = 0;
+        return 0;
+    }
+    fakehost_move(0, edit_size, count / 2);
+    fakehost_insert(count / 3, edit_size);
+    fakehost_remove(2 * count / 3, edit_size);
+
+    fakehost_reset_stats();
+    uint64_t start = bench_now_ns();
+    playback_order_playlist_changed(DDB_PLAYLIST_CHANGE_CONTENT);
+    // A change that cannot be patched is rebuilt in the background
+    playback_order_wait();
+    uint64_t elapsed = bench_now_ns() - start;
+    *meta_lookups = fakehost_stats()->meta_lookups;
+    return elapsed;
+}
+
+// Measures one mode/shuffle/size combination inside a child process
+static int run_case(const bench_options_t *opt, int tracks, PlayModes mode, int shuffle) {
+    fakehost_config_t cfg = opt->host;
+    cfg.tracks = tracks;
+    cfg.shuffle = shuffle;
+    if (fakehost_init(&cfg) != 0) {
+        fprintf(stdout, "%-13s %-7s %9d  host setup failed\n", mode_names[mode], shuffle ? "on" : "off", tracks);
+        return -1;
+    }
+
+    // The patch is timed, not the quiet period that precedes it
+    fakehost_api()->conf_set_int("Playlist_Change_Quiet_Ms", 0);
+    fakehost_api()->conf_set_int("Lookahead_Tracks", opt->lookahead);
+    if (playback_order_init(fakehost_api(), NULL) != 0) {
+        fakehost_free();
+        return -1;
+    }
+    playback_order_set_mode(mode);
+
+    long rss_before = peak_rss_kb();
+    fakehost_reset_stats();
+    memset(&allocs, 0, sizeof(allocs));
+
+    counting = 1;
+    uint64_t start = bench_now_ns();
+    playback_order_generate();
+    playback_order_wait();
+    uint64_t build_ns = bench_now_ns() - start;
+    counting = 0;
+
+    alloc_stats_t build_allocs = allocs;
+    fakehost_stats_t host = *fakehost_stats();
+    long rss_after = peak_rss_kb();
+    size_t order_len = playback_order_length();
+    playback_order_cache_stats_t cache;
+    playback_order_cache_stats(&cache);
+
+    // Output stops and track switches per skip; a gapless skip has one
+    // switch and no stop
+    fakehost_reset_stats();
+    uint64_t next_ns = time_navigation(DB_EV_NEXT, opt->nav_steps);
+    uint64_t prev_ns = time_navigation(DB_EV_PREV, opt->nav_steps);
+    fakehost_stats_t skips = *fakehost_stats();
+    double skip_steps = opt->nav_steps > 0 ? 2.0 * opt->nav_steps : 1.0;
+    int repeats = count_preload_repeats(opt->nav_steps);
+    uint64_t patch_meta = 0;
+    uint64_t patch_ns = time_playlist_edit(opt->edit_size, &patch_meta);
+
+    fprintf(stdout, "%-13s %-7s %9d %9zu %11.3f %10ld %9llu %9llu %9llu %11llu %10.3f %9.3f %9.3f %10.3f %10llu %9.1f %10.2f %11.2f %11d\n",
+            mode_names[mode], shuffle ? "on" : "off", tracks, order_len,
+            build_ns / 1e6,
+            rss_after - rss_before,
+            (unsigned long long)build_allocs.mallocs,
+            (unsigned long long)build_allocs.reallocs,
+            (unsigned long long)build_allocs.frees,
+            (unsigned long long)host.meta_lookups,
+            host.lock_ns / 1e6,
+            next_ns / 1e3, prev_ns / 1e3,
+            patch_ns / 1e6, (unsigned long long)patch_meta, cache.bytes / 1024.0,
+            skips.stops / skip_steps, skips.track_switches / skip_steps, repeats);
+    fflush(stdout);
+
+    playback_order_cleanup();
+    fakehost_free();
+    return 0;
+}
+
+static void print_header(void) {
+    fprintf(stdout, "%-13s %-7s %9s %9s %11s %10s %9s %9s %9s %11s %10s %9s %9s %10s %10s %9s %10s %11s %11s\n",
+            "mode", "shuffle", "tracks", "order", "build_ms", "rss_kb", "mallocs", "reallocs",
+            "frees", "meta_calls", "lock_ms", "next_us", "prev_us", "patch_ms", "patch_meta", "saved_kb",
+            "skip_stops", "skip_switch", "preload_rep");
+    fflush(stdout);
+}
+
+static int parse_sizes(bench_options_t *opt, char *list) {
+    opt->size_count = 0;
+    for (char *tok = strtok(list, ","); tok && opt->size_count < MAX_SIZES; tok = strtok(NULL, ",")) {
+        int n = atoi(tok);
+        if (n <= 0) return -1;
+        opt->sizes[opt->size_count++] = n;
+    }
+    return opt->size_count > 0 ? 0 : -1;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -n LIST   comma separated playlist sizes (default 1000,100000,1000000)\n"
+            "  -k N      navigation steps per direction (default %d)\n"
+            "  -e N      tracks moved, inserted and removed by the playlist edit (default %d)\n"
+            "  -q N      tracks of the order kept in the play queue ahead (default 1)\n"
+            "  -r N      fixed rating for every track, -1 for uniform 0..5 (default -1)\n"
+            "  -a N      number of artists (default 500)\n"
+            "  -t N      tracks per album (default 12)\n"
+            "  -s N      selected tracks in percent (default 10)\n"
+            "  -p N      index of the playing track (default: middle)\n"
+            "  -v        keep the engine's trace output\n"
+            "  -V N      run N rounds of the encoding checks instead and exit\n"
+            "  -S N      seed for the encoding checks (default: the time)\n",
+            argv0, DEFAULT_NAV_STEPS, DEFAULT_EDIT_SIZE);
+}
+
+int main(int argc, char **argv) {
+    bench_options_t opt;
+    memset(&opt, 0, sizeof(opt));
+    fakehost_default_config(&opt.host);
+    opt.nav_steps = DEFAULT_NAV_STEPS;
+    opt.edit_size = DEFAULT_EDIT_SIZE;
+    opt.lookahead = 1;
+    opt.sizes[0] = 1000;
+    opt.sizes[1] = 100000;
+    opt.sizes[2] = 1000000;
+    opt.size_count = 3;
+    int verify_rounds = 0;
+    uint64_t verify_seed = (uint64_t)time(NULL);
+
+    int c;
+    while ((c = getopt(argc, argv, "n:k:e:q:r:a:t:s:p:vV:S:h")) != -1) {
+        switch (c) {
+            case 'n':
+                if (parse_sizes(&opt, optarg) != 0) { usage(argv[0]); return 1; }
+                break;
+            case 'k': opt.nav_steps = atoi(optarg); break;
+            case 'e': opt.edit_size = atoi(optarg); break;
+            case 'q': opt.lookahead = atoi(optarg); break;
+            case 'r': opt.host.rating = atoi(optarg); break;
+            case 'a': opt.host.artists = atoi(optarg); break;
+            case 't': opt.host.tracks_per_album = atoi(optarg); break;
+            case 's': opt.host.selected_percent = atoi(optarg); break;
+            case 'p': opt.host.playing = atoi(optarg); break;
+            case 'v': opt.verbose = 1; break;
+            case 'V': verify_rounds = atoi(optarg); break;
+            case 'S': verify_seed = strtoull(optarg, NULL, 0); break;
+            default: usage(argv[0]); return c == 'h' ? 0 : 1;
+        }
+    }
+
+    if (verify_rounds > 0) {
+        return verify_run(verify_seed, verify_rounds) == 0 ? 0 : 1;
+    }
+
+    print_header();
+    for (int s = 0; s < opt.size_count; s++) {
+        for (int mode = PLAYLIST; mode <= KEEP_YEAR; mode++) {
+            for (int shuffle = 0; shuffle <= 1; shuffle++) {
+                pid_t pid = fork();
+                if (pid < 0) {
+                    perror("fork");
+                    return 1;
+                }
+                if (pid == 0) {
+                    if (!opt.verbose) {
+                        int devnull = open("/dev/null", O_WRONLY);
+                        if (devnull >= 0) dup2(devnull, STDERR_FILENO);
+                    }
+                    int shuffle_mode = shuffle ? DDB_SHUFFLE_TRACKS : DDB_SHUFFLE_OFF;
+                    _exit(run_case(&opt, opt.sizes[s], (PlayModes)mode, shuffle_mode) == 0 ? 0 : 1);
+                }
+                int status = 0;
+                waitpid(pid, &status, 0);
+                if (!WIFEXITED(status)) {
+                    fprintf(stdout, "%-13s %-7s %9d  crashed\n", mode_names[mode], shuffle ? "on" : "off", opt.sizes[s]);
+                    fflush(stdout);
+                }
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,684 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    Headless stand-in for the DeaDBeeF host, serving synthetic playlists
+    to the ordering engine for benchmarks and command-line tools.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "fakehost.h"
+
+#define META_RING_SIZE 8
+#define META_BUFFER_SIZE 256
+#define MAX_CONF_KEYS 64
+#define GENRE_COUNT 16
+#define MAX_PLAYQUEUE 4096
+
+// Synthetic track; the DeaDBeeF item header must stay first for casting
+typedef struct {
+    DB_playItem_t base;
+    int idx;
+    int rating;
+    int artist;
+    int album;
+    int number;
+    int selected;
+    int feat;
+    int owned;               // Allocated by fakehost_insert, not part of the pool
+} fake_track_t;
+
+typedef struct {
+    char key[64];
+    int value;
+} fake_conf_t;
+
+static fakehost_config_t config;
+static fakehost_stats_t stats;
+static fake_track_t *tracks = NULL;
+static fake_track_t **items = NULL;
+static int item_count = 0;
+static int item_capacity = 0;
+static int next_track_id = 0;
+static char **artist_names = NULL;
+static char **album_names = NULL;
+static int album_count = 0;
+static fake_track_t *playing_track = NULL;
+static fake_track_t *streaming_track = NULL;    // Next track decoded ahead for gapless playback
+// pl_lock is recursive like the host's; the engine builds on its own thread
+static pthread_mutex_t pl_mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static int lock_depth = 0;
+static uint64_t lock_started = 0;
+static ddb_playlist_t fake_playlist;
+static fake_conf_t conf_values[MAX_CONF_KEYS];
+static int conf_count = 0;
+static fake_conf_t playlist_meta[MAX_CONF_KEYS];
+static int playlist_meta_count = 0;
+static fake_track_t *playqueue[MAX_PLAYQUEUE];
+static int playqueue_count = 0;
+static int posted_play = -1;         // DB_EV_PLAY_NUM waiting for the message loop
+
+static const char *genres[GENRE_COUNT] = {
+    "Rock", "Pop", "Jazz", "Blues", "Classical", "Electronic", "Hip-Hop", "Folk",
+    "Metal", "Punk", "Reggae", "Soul", "Country", "Ambient", "Soundtrack", "Latin"
+};
+
+// Returns a monotonic timestamp in nanoseconds
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Small deterministic generator for the synthetic metadata
+static uint32_t next_random(uint32_t *s) {
+    uint32_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *s = x;
+}
+
+// Returns one of several rotating buffers for generated metadata strings.
+// Values stay valid for the next META_RING_SIZE lookups, which is enough for
+// callers that copy or compare the value right away.
+static char *meta_buffer(void) {
+    static __thread char ring[META_RING_SIZE][META_BUFFER_SIZE];
+    static __thread int slot = 0;
+    slot = (slot + 1) % META_RING_SIZE;
+    return ring[slot];
+}
+
+static fake_track_t *to_track(DB_playItem_t *it) {
+    return (fake_track_t *)it;
+}
+
+static DB_playItem_t *track_ref(int idx) {
+    if (idx < 0 || idx >= item_count) return NULL;
+    stats.item_refs++;
+    return &items[idx]->base;
+}
+
+// Renumbers the tracks in [from, to) after a playlist mutation
+static void reindex(int from, int to) {
+    for (int i = from; i < to && i < item_count; i++) {
+        items[i]->idx = i;
+    }
+}
+
+// Fake playback output that is always playing
+static ddb_playback_state_t fake_output_state(void) {
+    return DDB_PLAYBACK_STATE_PLAYING;
+}
+
+static DB_output_t fake_output = {
+    .state = fake_output_state,
+};
+
+static DB_output_t *fake_get_output(void) {
+    return &fake_output;
+}
+
+// Starts playing a track; the output keeps running unless it was stopped
+static void play_track(fake_track_t *t) {
+    playing_track = t;
+    streaming_track = NULL;
+    stats.track_switches++;
+}
+
+static int fake_sendmessage(uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
+    stats.messages++;
+    if (id == DB_EV_STOP) {
+        stats.stops++;
+    }
+    if (id == DB_EV_PLAY_NUM && (int)p1 >= 0 && (int)p1 < item_count) {
+        // Messages are handled after the one being dispatched
+        posted_play = (int)p1;
+    }
+    return 0;
+}
+
+static DB_playItem_t *fake_streamer_get_playing_track_safe(void) {
+    return playing_track ? track_ref(playing_track->idx) : NULL;
+}
+
+static ddb_shuffle_t fake_streamer_get_shuffle(void) {
+    return (ddb_shuffle_t)config.shuffle;
+}
+
+static void fake_streamer_set_shuffle(ddb_shuffle_t shuffle) {
+    config.shuffle = shuffle;
+}
+
+static ddb_repeat_t fake_streamer_get_repeat(void) {
+    return DDB_REPEAT_ALL;
+}
+
+static void fake_streamer_set_repeat(ddb_repeat_t repeat) {
+}
+
+static ddb_playlist_t *fake_plt_get_curr(void) {
+    return &fake_playlist;
+}
+
+static int fake_plt_get_curr_idx(void) {
+    return 0;
+}
+
+static ddb_playlist_t *fake_plt_get_for_idx(int idx) {
+    return idx == 0 ? &fake_playlist : NULL;
+}
+
+static void fake_plt_unref(ddb_playlist_t *plt) {
+}
+
+static DB_playItem_t *fake_plt_get_first(ddb_playlist_t *plt, int iter) {
+    return track_ref(0);
+}
+
+static void fake_pl_lock(void) {
+    pthread_mutex_lock(&pl_mutex);
+    if (lock_depth++ == 0) {
+        lock_started = now_ns();
+        stats.lock_count++;
+    }
+}
+
+static void fake_pl_unlock(void) {
+    if (lock_depth > 0 && --lock_depth == 0) {
+        uint64_t held = now_ns() - lock_started;
+        stats.lock_ns += held;
+        if (held > stats.lock_max_ns) stats.lock_max_ns = held;
+    }
+    pthread_mutex_unlock(&pl_mutex);
+}
+
+static void fake_pl_item_ref(DB_playItem_t *it) {
+    stats.item_refs++;
+}
+
+static void fake_pl_item_unref(DB_playItem_t *it) {
+}
+
+static int fake_pl_getcount(int iter) {
+    return item_count;
+}
+
+static int fake_pl_get_idx_of(DB_playItem_t *it) {
+    return it ? to_track(it)->idx : -1;
+}
+
+static DB_playItem_t *fake_pl_get_for_idx(int idx) {
+    return track_ref(idx);
+}
+
+static DB_playItem_t *fake_pl_get_first(int iter) {
+    return track_ref(0);
+}
+
+static DB_playItem_t *fake_pl_get_last(int iter) {
+    return track_ref(item_count - 1);
+}
+
+static DB_playItem_t *fake_pl_get_next(DB_playItem_t *it, int iter) {
+    return it ? track_ref(to_track(it)->idx + 1) : NULL;
+}
+
+static DB_playItem_t *fake_pl_get_prev(DB_playItem_t *it, int iter) {
+    return it ? track_ref(to_track(it)->idx - 1) : NULL;
+}
+
+static int fake_pl_is_selected(DB_playItem_t *it) {
+    return it ? to_track(it)->selected : 0;
+}
+
+static float fake_pl_get_item_duration(DB_playItem_t *it) {
+    return it ? 120.0f + (float)(to_track(it)->idx % 240) : 0.0f;
+}
+
+static const char *fake_pl_find_meta_raw(DB_playItem_t *it, const char *key) {
+    stats.meta_lookups++;
+    if (!it || !key) return NULL;
+    fake_track_t *t = to_track(it);
+    char *buf;
+
+    if (!strcmp(key, "artist")) {
+        if (!t->feat) return artist_names[t->artist];
+        buf = meta_buffer();
+        snprintf(buf, META_BUFFER_SIZE, "%s feat. Guest %d", artist_names[t->artist], t->idx % 97);
+        return buf;
+    }
+    if (!strcmp(key, "album")) {
+        return album_names[t->album];
+    }
+    if (!strcmp(key, "genre")) {
+        return genres[t->album % GENRE_COUNT];
+    }
+    if (!strcmp(key, "year") || !strcmp(key, "date")) {
+        buf = meta_buffer();
+        snprintf(buf, META_BUFFER_SIZE, "%d", 1960 + t->album % 64);
+        return buf;
+    }
+    if (!strcmp(key, "title")) {
+        buf = meta_buffer();
+        snprintf(buf, META_BUFFER_SIZE, "Track %d", t->idx);
+        return buf;
+    }
+    if (!strcmp(key, "rating")) {
+        buf = meta_buffer();
+        snprintf(buf, META_BUFFER_SIZE, "%d", t->rating);
+        return buf;
+    }
+    if (!strcmp(key, ":URI")) {
+        buf = meta_buffer();
+        if (config.cd_every > 0 && t->album % config.cd_every == 0) {
+            snprintf(buf, META_BUFFER_SIZE, "/music/%s/%s/CD%d/%02d - Track %d.flac",
+                     artist_names[t->artist], album_names[t->album], 1 + t->number % 2, t->number, t->idx);
+        } else {
+            snprintf(buf, META_BUFFER_SIZE, "/music/%s/%s/%02d - Track %d.flac",
+                     artist_names[t->artist], album_names[t->album], t->number, t->idx);
+        }
+        return buf;
+    }
+    return NULL;
+}
+
+static const char *fake_pl_find_meta(DB_playItem_t *it, const char *key) {
+    return fake_pl_find_meta_raw(it, key);
+}
+
+static int fake_pl_find_meta_int(DB_playItem_t *it, const char *key, int def) {
+    stats.meta_lookups++;
+    if (!it || !key) return def;
+    if (!strcmp(key, "rating")) return to_track(it)->rating;
+    if (!strcmp(key, "year")) return 1960 + to_track(it)->album % 64;
+    return def;
+}
+
+static int fake_playqueue_get_count(void) {
+    return playqueue_count;
+}
+
+static void fake_playqueue_insert_at(int n, DB_playItem_t *it) {
+    if (!it || playqueue_count == MAX_PLAYQUEUE) return;
+    if (n < 0 || n > playqueue_count) n = playqueue_count;
+    memmove(&playqueue[n + 1], &playqueue[n], (size_t)(playqueue_count - n) * sizeof(fake_track_t *));
+    playqueue[n] = to_track(it);
+    playqueue_count++;
+}
+
+static int fake_playqueue_push(DB_playItem_t *it) {
+    if (!it || playqueue_count == MAX_PLAYQUEUE) return -1;
+    fake_playqueue_insert_at(playqueue_count, it);
+    return 0;
+}
+
+static DB_playItem_t *fake_playqueue_get_item(int n) {
+    if (n < 0 || n >= playqueue_count) return NULL;
+    stats.item_refs++;
+    return &playqueue[n]->base;
+}
+
+static void fake_playqueue_remove_nth(int n) {
+    if (n < 0 || n >= playqueue_count) return;
+    memmove(&playqueue[n], &playqueue[n + 1], (size_t)(playqueue_count - n - 1) * sizeof(fake_track_t *));
+    playqueue_count--;
+}
+
+static void fake_playqueue_clear(void) {
+    playqueue_count = 0;
+}
+
+static fake_conf_t *find_value(fake_conf_t *table, int count, const char *key) {
+    for (int i = 0; i < count; i++) {
+        if (!strcmp(table[i].key, key)) return &table[i];
+    }
+    return NULL;
+}
+
+static void set_value(fake_conf_t *table, int *count, const char *key, int val) {
+    fake_conf_t *c = find_value(table, *count, key);
+    if (!c) {
+        if (*count == MAX_CONF_KEYS) return;
+        c = &table[(*count)++];
+        snprintf(c->key, sizeof(c->key), "%s", key);
+    }
+    c->value = val;
+}
+
+static int fake_conf_get_int(const char *key, int def) {
+    fake_conf_t *c = find_value(conf_values, conf_count, key);
+    return c ? c->value : def;
+}
+
+static void fake_conf_set_int(const char *key, int val) {
+    set_value(conf_values, &conf_count, key, val);
+}
+
+static int fake_plt_find_meta_int(ddb_playlist_t *plt, const char *key, int def) {
+    fake_conf_t *c = find_value(playlist_meta, playlist_meta_count, key);
+    return c ? c->value : def;
+}
+
+static void fake_plt_set_meta_int(ddb_playlist_t *plt, const char *key, int value) {
+    set_value(playlist_meta, &playlist_meta_count, key, value);
+}
+
+static const char *fake_get_system_dir(int dir_id) {
+    return dir_id == DDB_SYS_DIR_CONFIG ? config.config_dir : NULL;
+}
+
+static DB_plugin_t *fake_plug_get_for_id(const char *id) {
+    return NULL;
+}
+
+static DB_functions_t fake_api = {
+    .vmajor = 1,
+    .vminor = 10,
+    .get_output = fake_get_output,
+    .sendmessage = fake_sendmessage,
+    .streamer_get_playing_track_safe = fake_streamer_get_playing_track_safe,
+    .streamer_get_shuffle = fake_streamer_get_shuffle,
+    .streamer_set_shuffle = fake_streamer_set_shuffle,
+    .streamer_get_repeat = fake_streamer_get_repeat,
+    .streamer_set_repeat = fake_streamer_set_repeat,
+    .plt_get_curr = fake_plt_get_curr,
+    .plt_get_curr_idx = fake_plt_get_curr_idx,
+    .plt_get_for_idx = fake_plt_get_for_idx,
+    .plt_unref = fake_plt_unref,
+    .plt_get_first = fake_plt_get_first,
+    .plt_find_meta_int = fake_plt_find_meta_int,
+    .plt_set_meta_int = fake_plt_set_meta_int,
+    .pl_lock = fake_pl_lock,
+    .pl_unlock = fake_pl_unlock,
+    .pl_item_ref = fake_pl_item_ref,
+    .pl_item_unref = fake_pl_item_unref,
+    .pl_getcount = fake_pl_getcount,
+    .pl_get_idx_of = fake_pl_get_idx_of,
+    .pl_get_for_idx = fake_pl_get_for_idx,
+    .pl_get_first = fake_pl_get_first,
+    .pl_get_last = fake_pl_get_last,
+    .pl_get_next = fake_pl_get_next,
+    .pl_get_prev = fake_pl_get_prev,
+    .pl_is_selected = fake_pl_is_selected,
+    .pl_get_item_duration = fake_pl_get_item_duration,
+    .pl_find_meta = fake_pl_find_meta,
+    .pl_find_meta_raw = fake_pl_find_meta_raw,
+    .pl_find_meta_int = fake_pl_find_meta_int,
+    .playqueue_get_count = fake_playqueue_get_count,
+    .playqueue_push = fake_playqueue_push,
+    .playqueue_insert_at = fake_playqueue_insert_at,
+    .playqueue_get_item = fake_playqueue_get_item,
+    .playqueue_remove_nth = fake_playqueue_remove_nth,
+    .playqueue_clear = fake_playqueue_clear,
+    .conf_get_int = fake_conf_get_int,
+    .conf_set_int = fake_conf_set_int,
+    .plug_get_for_id = fake_plug_get_for_id,
+    .get_system_dir = fake_get_system_dir,
+};
+
+// Fills a config with the defaults used by the benchmark
+void fakehost_default_config(fakehost_config_t *cfg) {
+    if (!cfg) return;
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->tracks = 1000;
+    cfg->rating = -1;
+    cfg->artists = 500;
+    cfg->tracks_per_album = 12;
+    cfg->feat_every = 7;
+    cfg->cd_every = 10;
+    cfg->selected_percent = 10;
+    cfg->playing = -1;
+    cfg->shuffle = DDB_SHUFFLE_OFF;
+    cfg->seed = 0x9e3779b9u;
+}
+
+// Fills in the synthetic metadata of a track with the given id
+static void fill_track(fake_track_t *t, int id, uint32_t *seed) {
+    t->idx = id;
+    t->album = (id / config.tracks_per_album) % album_count;
+    t->artist = t->album % config.artists;
+    t->number = 1 + id % config.tracks_per_album;
+    t->rating = config.rating >= 0 ? config.rating : (int)(next_random(seed) % 6);
+    t->selected = (int)(next_random(seed) % 100) < config.selected_percent;
+    t->feat = config.feat_every > 0 && id % config.feat_every == 0;
+    t->owned = 0;
+}
+
+static int alloc_names(char ***names, int count, const char *fmt) {
+    *names = calloc((size_t)count, sizeof(char *));
+    if (!*names) return -1;
+    for (int i = 0; i < count; i++) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), fmt, i);
+        (*names)[i] = strdup(buf);
+        if (!(*names)[i]) return -1;
+    }
+    return 0;
+}
+
+// Builds the synthetic playlist, returns 0 on success
+int fakehost_init(const fakehost_config_t *cfg) {
+    fakehost_free();
+    if (!cfg || cfg->tracks <= 0) return -1;
+
+    config = *cfg;
+    if (config.artists <= 0) config.artists = 1;
+    if (config.tracks_per_album <= 0) config.tracks_per_album = 1;
+    album_count = (config.tracks + config.tracks_per_album - 1) / config.tracks_per_album;
+
+    item_capacity = config.tracks;
+    tracks = calloc((size_t)config.tracks, sizeof(fake_track_t));
+    items = calloc((size_t)item_capacity, sizeof(fake_track_t *));
+    if (!tracks || !items ||
+        alloc_names(&artist_names, config.artists, "Artist %d") != 0 ||
+        alloc_names(&album_names, album_count, "Album %d")  != 0) {
+        fakehost_free();
+        return -1;
+    }
+
+    uint32_t seed = config.seed ? config.seed : 1;
+    for (int i = 0; i < config.tracks; i++) {
+        fill_track(&tracks[i], i, &seed);
+        items[i] = &tracks[i];
+    }
+    item_count = config.tracks;
+    next_track_id = config.tracks;
+
+    int playing = (config.playing >= 0 && config.playing < config.tracks) ? config.playing : config.tracks / 2;
+    playing_track = items[playing];
+    streaming_track = NULL;
+    conf_count = 0;
+    playlist_meta_count = 0;
+    playqueue_count = 0;
+    posted_play = -1;
+    fakehost_reset_stats();
+    return 0;
+}
+
+static void free_names(char ***names, int count) {
+    if (!*names) return;
+    for (int i = 0; i < count; i++) {
+        free((*names)[i]);
+    }
+    free(*names);
+    *names = NULL;
+}
+
+// Releases the synthetic playlist
+void fakehost_free(void) {
+    for (int i = 0; items && i < item_count; i++) {
+        if (items[i]->owned) free(items[i]);
+    }
+    free_names(&artist_names, config.artists);
+    free_names(&album_names, album_count);
+    free(items);
+    free(tracks);
+    items = NULL;
+    tracks = NULL;
+    playing_track = NULL;
+    streaming_track = NULL;
+    playqueue_count = 0;
+    posted_play = -1;
+    item_count = item_capacity = 0;
+    album_count = 0;
+}
+
+// Returns the fake API table to hand to the plugin
+DB_functions_t *fakehost_api(void) {
+    return &fake_api;
+}
+
+// Changes the shuffle mode reported by the fake streamer
+void fakehost_set_shuffle(int shuffle) {
+    config.shuffle = shuffle;
+}
+
+// Starts decoding the next track like the streamer does for gapless
+// playback, before the current one ends: the head of the playqueue or else
+// the following track. The head leaves the queue now, the song changes
+// only in fakehost_finish_track.
+void fakehost_preload_track(void) {
+    if (streaming_track) return;
+    if (playqueue_count > 0) {
+        streaming_track = playqueue[0];
+        fake_playqueue_remove_nth(0);
+    } else if (item_count > 0) {
+        streaming_track = items[playing_track ? (playing_track->idx + 1) % item_count : 0];
+    }
+}
+
+// Continues like the streamer at the end of a track: with the track
+// decoded ahead, the head of the playqueue or else the following track
+void fakehost_finish_track(void) {
+    if (streaming_track) {
+        play_track(streaming_track);
+    } else if (playqueue_count > 0) {
+        fake_track_t *t = playqueue[0];
+        fake_playqueue_remove_nth(0);
+        play_track(t);
+    } else if (item_count > 0) {
+        play_track(items[playing_track ? (playing_track->idx + 1) % item_count : 0]);
+    }
+}
+
+// Does what the host does with an event after the plugins saw it: NEXT
+// plays the head of the playqueue or else the following track, PREV the
+// preceding track. A DB_EV_PLAY_NUM posted meanwhile is handled next and,
+// like in the host, drops the queue.
+void fakehost_native_event(uint32_t event) {
+    int playing = playing_track ? playing_track->idx : -1;
+    if (event == DB_EV_NEXT) {
+        // A skip discards the track decoded ahead
+        streaming_track = NULL;
+        fakehost_finish_track();
+    } else if (event == DB_EV_PREV && item_count > 0) {
+        play_track(items[playing > 0 ? playing - 1 : item_count - 1]);
+    }
+    if (posted_play >= 0 && posted_play < item_count) {
+        playqueue_count = 0;
+        play_track(items[posted_play]);
+    }
+    posted_play = -1;
+}
+
+// Returns the index of the track the fake streamer is playing
+int fakehost_playing_index(void) {
+    return playing_track ? playing_track->idx : -1;
+}
+
+// Returns the number of tracks currently in the playlist
+int fakehost_track_count(void) {
+    return item_count;
+}
+
+// Inserts count new synthetic tracks before position at
+int fakehost_insert(int at, int count) {
+    if (at < 0 || at > item_count || count <= 0) return -1;
+    if (item_count + count > item_capacity) {
+        int capacity = (item_count + count) * 2;
+        fake_track_t **grown = realloc(items, (size_t)capacity * sizeof(fake_track_t *));
+        if (!grown) return -1;
+        items = grown;
+        item_capacity = capacity;
+    }
+    memmove(&items[at + count], &items[at], (size_t)(item_count - at) * sizeof(fake_track_t *));
+    uint32_t seed = config.seed ^ (uint32_t)next_track_id;
+    if (!seed) seed = 1;
+    for (int i = 0; i < count; i++) {
+        fake_track_t *t = calloc(1, sizeof(fake_track_t));
+        if (!t) return -1;
+        fill_track(t, next_track_id++, &seed);
+        t->owned = 1;
+        items[at + i] = t;
+    }
+    item_count += count;
+    reindex(at, item_count);
+    return 0;
+}
+
+// Removes count tracks starting at position at
+int fakehost_remove(int at, int count) {
+    if (at < 0 || count <= 0 || at + count > item_count) return -1;
+    for (int i = at; i < at + count; i++) {
+        if (items[i] == playing_track) playing_track = NULL;
+        if (items[i] == streaming_track) streaming_track = NULL;
+        // Removed tracks leave the queue as well
+        for (int q = playqueue_count - 1; q >= 0; q--) {
+            if (playqueue[q] == items[i]) fake_playqueue_remove_nth(q);
+        }
+        if (items[i]->owned) free(items[i]);
+    }
+    memmove(&items[at], &items[at + count], (size_t)(item_count - at - count) * sizeof(fake_track_t *));
+    item_count -= count;
+    reindex(at, item_count);
+    return 0;
+}
+
+// Moves count tracks starting at from so that they start at position to afterwards
+int fakehost_move(int from, int count, int to) {
+    if (from < 0 || count <= 0 || from + count > item_count || to < 0 || to + count > item_count) return -1;
+    fake_track_t **block = malloc((size_t)count * sizeof(fake_track_t *));
+    if (!block) return -1;
+    memcpy(block, &items[from], (size_t)count * sizeof(fake_track_t *));
+    memmove(&items[from], &items[from + count], (size_t)(item_count - from - count) * sizeof(fake_track_t *));
+    memmove(&items[to + count], &items[to], (size_t)(item_count - count - to) * sizeof(fake_track_t *));
+    memcpy(&items[to], block, (size_t)count * sizeof(fake_track_t *));
+    free(block);
+    reindex(from < to ? from : to, item_count);
+    return 0;
+}
+
+// Changes the rating of the track at position at, as a tag edit would
+int fakehost_set_rating(int at, int rating) {
+    if (at < 0 || at >= item_count) return -1;
+    items[at]->rating = rating;
+    return 0;
+}
+
+// Returns the counters collected since the last reset
+const fakehost_stats_t *fakehost_stats(void) {
+    return &stats;
+}
+
+// Resets the collected counters
+void fakehost_reset_stats(void) {
+    memset(&stats, 0, sizeof(stats));
+}
@@ -0,0 +1,108 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    Headless stand-in for the DeaDBeeF host, serving synthetic playlists
+    to the ordering engine for benchmarks and command-line tools.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef FAKEHOST_H
+#define FAKEHOST_H
+
+#include <stdint.h>
+#include "deadbeef.h"
+
+// Shape of the synthetic playlist served by the fake host
+typedef struct {
+    int tracks;              // Number of tracks in the playlist
+    int rating;              // Fixed rating for every track, -1 = uniform 0..5
+    int artists;             // Number of distinct artists
+    int tracks_per_album;    // Tracks sharing one album folder
+    int feat_every;          // Every n-th track gets a " feat." artist, 0 = never
+    int cd_every;            // Every n-th album is split into /CD1 folders, 0 = never
+    int selected_percent;    // Share of selected tracks in percent
+    int playing;             // Index of the playing track, -1 = middle of the playlist
+    int shuffle;             // Value reported by streamer_get_shuffle
+    uint32_t seed;           // Seed for ratings and selection
+    const char *config_dir;  // Reported by get_system_dir, NULL = none; not copied
+} fakehost_config_t;
+
+// Counters collected by the fake host
+typedef struct {
+    uint64_t meta_lookups;   // pl_find_meta* calls
+    uint64_t item_refs;      // pl_item_ref calls and references handed out
+    uint64_t lock_count;     // Outermost pl_lock calls
+    uint64_t lock_ns;        // Total time spent holding pl_lock
+    uint64_t lock_max_ns;    // Longest single pl_lock hold
+    uint64_t messages;       // sendmessage calls
+    uint64_t stops;          // DB_EV_STOP messages, each tearing down the output
+    uint64_t track_switches; // Times the fake streamer changed the playing track
+} fakehost_stats_t;
+
+// Fills a config with the defaults used by the benchmark
+void fakehost_default_config(fakehost_config_t *cfg);
+
+// Builds the synthetic playlist, returns 0 on success
+int fakehost_init(const fakehost_config_t *cfg);
+
+// Releases the synthetic playlist
+void fakehost_free(void);
+
+// Returns the fake API table to hand to the plugin
+DB_functions_t *fakehost_api(void);
+
+// Changes the shuffle mode reported by the fake streamer
+void fakehost_set_shuffle(int shuffle);
+
+// Takes the next track ahead of the end of the current one, as the
+// streamer does when it starts decoding it for gapless playback
+void fakehost_preload_track(void);
+
+// Continues like the streamer at the end of a track: with the track
+// decoded ahead, the head of the playqueue or else the following track
+void fakehost_finish_track(void);
+
+// Does what the host does with an event after the plugins saw it: NEXT
+// plays the head of the playqueue or else the following track, PREV the
+// preceding track. A DB_EV_PLAY_NUM posted meanwhile is handled next and,
+// like in the host, drops the queue.
+void fakehost_native_event(uint32_t event);
+
+// Returns the index of the track the fake streamer is playing
+int fakehost_playing_index(void);
+
+// Returns the number of tracks currently in the playlist
+int fakehost_track_count(void);
+
+// Inserts count new synthetic tracks before position at
+int fakehost_insert(int at, int count);
+
+// Removes count tracks starting at position at
+int fakehost_remove(int at, int count);
+
+// Moves count tracks starting at from so that they start at position to afterwards
+int fakehost_move(int from, int count, int to);
+
+// Changes the rating of the track at position at, as a tag edit would
+int fakehost_set_rating(int at, int rating);
+
+// Returns the counters collected since the last reset
+const fakehost_stats_t *fakehost_stats(void);
+
+// Resets the collected counters
+void fakehost_reset_stats(void);
+
+#endif
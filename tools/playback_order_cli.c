@@ -0,0 +1,193 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    Command-line driver for the ordering engine. Builds the order for a
+    synthetic playlist served by the fake host, optionally walks it with
+    DB_EV_NEXT/DB_EV_PREV, and writes the resulting track indices.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "core/playback_order.h"
+#include "fakehost.h"
+
+static const char *mode_names[] = {
+    "playlist", "keep_album", "keep_artist", "top_rated", "selection", "pure_random", "smart_random",
+    "keep_genre", "keep_year"
+};
+
+static const char *shuffle_names[] = {
+    "off", "tracks", "random", "albums"
+};
+
+static int parse_name(const char *value, const char **names, int count) {
+    for (int i = 0; i < count; i++) {
+        if (!strcmp(value, names[i])) return i;
+    }
+    char *end = NULL;
+    long n = strtol(value, &end, 10);
+    if (end && *end == '\0' && n >= 0 && n < count) return (int)n;
+    return -1;
+}
+
+static double elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -n N      playlist size (default 1000)\n"
+            "  -m MODE   playlist, keep_album, keep_artist, top_rated, selection,\n"
+            "            pure_random, smart_random, keep_genre or keep_year\n"
+            "            (default playlist)\n"
+            "  -S MODE   shuffle: off, tracks, random or albums (default off)\n"
+            "  -k N      walk N DB_EV_NEXT steps and print the played tracks\n"
+            "  -b N      walk N DB_EV_PREV steps and print the played tracks\n"
+            "  -e N      let N tracks end and print the played tracks\n"
+            "  -q N      tracks of the order kept in the play queue ahead (default 1)\n"
+            "  -o FILE   write the generated order, one index per line ('-' for stdout)\n"
+            "  -r N      fixed rating for every track, -1 for uniform 0..5 (default -1)\n"
+            "  -a N      number of artists (default 500)\n"
+            "  -t N      tracks per album (default 12)\n"
+            "  -s N      selected tracks in percent (default 10)\n"
+            "  -p N      index of the playing track (default: middle)\n"
+            "  -x SEED   seed the engine's generator to reproduce an order\n"
+            "  -v        keep the engine's trace output\n",
+            argv0);
+}
+
+static int write_order(const char *path) {
+    FILE *out = strcmp(path, "-") ? fopen(path, "w") : stdout;
+    if (!out) {
+        perror(path);
+        return -1;
+    }
+    size_t len = playback_order_length();
+    for (size_t i = 0; i < len; i++) {
+        fprintf(out, "%d\n", playback_order_track_at(i));
+    }
+    if (out != stdout) fclose(out);
+    return 0;
+}
+
+static void walk(uint32_t event, int steps) {
+    for (int i = 0; i < steps; i++) {
+        playback_order_navigate(event);
+        fakehost_native_event(event);
+        playback_order_track_changed();
+        printf("%s %d %d\n", event == DB_EV_NEXT ? "next" : "prev",
+               playback_order_position(), fakehost_playing_index());
+    }
+}
+
+// Lets tracks end and prints what the streamer continued with
+static void play_through(int steps) {
+    for (int i = 0; i < steps; i++) {
+        fakehost_finish_track();
+        playback_order_track_changed();
+        printf("end %d %d\n", playback_order_position(), fakehost_playing_index());
+    }
+}
+
+int main(int argc, char **argv) {
+    fakehost_config_t cfg;
+    fakehost_default_config(&cfg);
+    int mode = PLAYLIST;
+    int next_steps = 0;
+    int prev_steps = 0;
+    int end_steps = 0;
+    int lookahead = 1;
+    int verbose = 0;
+    const char *out_path = NULL;
+    const char *seed = NULL;
+
+    int c;
+    while ((c = getopt(argc, argv, "n:m:S:k:b:e:q:o:r:a:t:s:p:x:vh")) != -1) {
+        switch (c) {
+            case 'n': cfg.tracks = atoi(optarg); break;
+            case 'm':
+                mode = parse_name(optarg, mode_names, KEEP_YEAR + 1);
+                if (mode < 0) { usage(argv[0]); return 1; }
+                break;
+            case 'S':
+                cfg.shuffle = parse_name(optarg, shuffle_names, 4);
+                if (cfg.shuffle < 0) { usage(argv[0]); return 1; }
+                break;
+            case 'k': next_steps = atoi(optarg); break;
+            case 'b': prev_steps = atoi(optarg); break;
+            case 'e': end_steps = atoi(optarg); break;
+            case 'q': lookahead = atoi(optarg); break;
+            case 'o': out_path = optarg; break;
+            case 'r': cfg.rating = atoi(optarg); break;
+            case 'a': cfg.artists = atoi(optarg); break;
+            case 't': cfg.tracks_per_album = atoi(optarg); break;
+            case 's': cfg.selected_percent = atoi(optarg); break;
+            case 'p': cfg.playing = atoi(optarg); break;
+            case 'x': seed = optarg; break;
+            case 'v': verbose = 1; break;
+            default: usage(argv[0]); return c == 'h' ? 0 : 1;
+        }
+    }
+
+    if (!verbose) {
+        freopen("/dev/null", "w", stderr);
+    }
+
+    if (fakehost_init(&cfg) != 0) {
+        fprintf(stdout, "Failed to set up a playlist with %d tracks\n", cfg.tracks);
+        return 1;
+    }
+    fakehost_api()->conf_set_int("Lookahead_Tracks", lookahead);
+    if (playback_order_init(fakehost_api(), NULL) != 0) {
+        fakehost_free();
+        return 1;
+    }
+    playback_order_set_mode((PlayModes)mode);
+    if (seed) {
+        playback_order_set_seed(strtoull(seed, NULL, 0));
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    playback_order_generate();
+    playback_order_wait();
+    playback_order_sync();
+    double build_ms = elapsed_ms(&start);
+
+    printf("mode %s shuffle %s tracks %d order %zu position %d seed %llu build_ms %.3f\n",
+           mode_names[mode], shuffle_names[cfg.shuffle], cfg.tracks,
+           playback_order_length(), playback_order_position(),
+           (unsigned long long)playback_order_seed(), build_ms);
+
+    int result = 0;
+    if (out_path && write_order(out_path) != 0) {
+        result = 1;
+    }
+    walk(DB_EV_NEXT, next_steps);
+    walk(DB_EV_PREV, prev_steps);
+    play_through(end_steps);
+
+    playback_order_cleanup();
+    fakehost_free();
+    return result;
+}
@@ -0,0 +1,311 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "core/packed_order.h"
+#include "core/permutation.h"
+#include "core/played_set.h"
+#include "core/rng.h"
+#include "core/weighted_sampler.h"
+#include "verify.h"
+
+#define MAX_REPORTS 20          // Failures printed before the rest are only counted
+#define MAX_ORDER 20000         // Entries of the largest random order
+#define MAX_SET 5000            // Values of the largest random played set
+
+static int failures;
+
+// Counts a failed check and prints the first ones
+static void fail(const char *check, const char *detail, long long a, long long b) {
+    if (failures++ < MAX_REPORTS) {
+        fprintf(stderr, "verify: %s: %s (%lld, %lld)\n", check, detail, a, b);
+    }
+}
+
+// Random entries in one of the shapes the engine stores: strictly
+// ascending subsets, ascending runs with repeats, arbitrary orders and
+// sparse orders whose gaps need the longest varints
+static size_t randomEntries(Rng *rng, int *entries, uint32_t *universe) {
+    size_t count = (size_t)rng_bounded(rng, MAX_ORDER + 1);
+    uint32_t u = (uint32_t)rng_bounded(rng, 4 * MAX_ORDER) + 1;
+    switch (rng_bounded(rng, 4)) {
+        case 0: {
+            size_t n = 0;
+            uint64_t keep = rng_bounded(rng, 100) + 1;
+            for (uint32_t v = 0; v < u && n < count; v++) {
+                if (rng_bounded(rng, 100) < keep) entries[n++] = (int)v;
+            }
+            count = n;
+            break;
+        }
+        case 1: {
+            int value = 0;
+            for (size_t i = 0; i < count; i++) {
+                value += (int)rng_bounded(rng, 3);
+                entries[i] = value;
+            }
+            break;
+        }
+        case 2:
+            for (size_t i = 0; i < count; i++) {
+                entries[i] = (int)rng_bounded(rng, u);
+            }
+            break;
+        default: {
+            count = count % 64 + 1;
+            uint32_t value = 0;
+            for (size_t i = 0; i < count; i++) {
+                value += (uint32_t)rng_bounded(rng, (INT32_MAX - value) / (count - i) + 1);
+                entries[i] = (int)value;
+            }
+            u = value + 1;
+            break;
+        }
+    }
+    *universe = u;
+    return count;
+}
+
+// Encodes random orders and reads them back every way the engine does:
+// decoding, access by position and lookup of every entry's first position
+static void verifyPackedOrders(Rng *rng, int rounds) {
+    int *entries = malloc(MAX_ORDER * sizeof(int));
+    int *decoded = malloc(MAX_ORDER * sizeof(int));
+    if (!entries || !decoded) {
+        fail("packed", "allocation failed", 0, 0);
+        free(entries);
+        free(decoded);
+        return;
+    }
+    for (int round = 0; round < rounds; round++) {
+        uint32_t universe;
+        size_t count = randomEntries(rng, entries, &universe);
+        PackedOrder p, copy;
+        if (packed_order_encode(&p, entries, count, universe) != 0) {
+            fail("packed", "encode failed", (long long)count, universe);
+            continue;
+        }
+        if (packed_order_check(&p) != 0) {
+            fail(packed_order_kind_name(&p), "check rejects a fresh encoding", (long long)count, universe);
+        }
+        if (packed_order_length(&p) != count) {
+            fail(packed_order_kind_name(&p), "length", (long long)packed_order_length(&p), (long long)count);
+        }
+        packed_order_decode(&p, decoded);
+        for (size_t i = 0; i < count; i++) {
+            if (decoded[i] != entries[i]) {
+                fail(packed_order_kind_name(&p), "decode", (long long)i, decoded[i]);
+                break;
+            }
+            if (packed_order_at(&p, i) != entries[i]) {
+                fail(packed_order_kind_name(&p), "at", (long long)i, packed_order_at(&p, i));
+                break;
+            }
+            // Repeated entries are found at their first position
+            int pos = packed_order_position_of(&p, packed_order_at(&p, i));
+            if (pos < 0 || (size_t)pos > i || entries[pos] != entries[i] || (pos > 0 && pos == (int)i && entries[pos - 1] == entries[i])) {
+                fail(packed_order_kind_name(&p), "position_of(at(i)) != first i", (long long)i, pos);
+                break;
+            }
+        }
+        if (packed_order_at(&p, count) != -1) {
+            fail(packed_order_kind_name(&p), "at past the end", (long long)count, packed_order_at(&p, count));
+        }
+        if (packed_order_copy(&copy, &p) == 0) {
+            for (size_t i = 0; i < count; i++) {
+                if (packed_order_at(&copy, i) != entries[i]) {
+                    fail(packed_order_kind_name(&p), "copy", (long long)i, packed_order_at(&copy, i));
+                    break;
+                }
+            }
+            packed_order_free(&copy);
+        }
+        packed_order_free(&p);
+    }
+    free(entries);
+    free(decoded);
+}
+
+// Checks that the Feistel permutation maps [0, count) onto itself once
+// each and that the inverse undoes it
+static void verifyPermutations(Rng *rng, int rounds) {
+    uint8_t *seen = malloc(MAX_ORDER);
+    if (!seen) {
+        fail("permutation", "allocation failed", 0, 0);
+        return;
+    }
+    for (int round = 0; round < rounds; round++) {
+        uint64_t count = rng_bounded(rng, MAX_ORDER) + 1;
+        Permutation perm;
+        permutation_init(&perm, count, rng_next(rng));
+        memset(seen, 0, (size_t)count);
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t value = permutation_forward(&perm, i);
+            if (value >= count || seen[value]) {
+                fail("permutation", "not a bijection", (long long)count, (long long)value);
+                break;
+            }
+            seen[value] = 1;
+            if (permutation_inverse(&perm, value) != i) {
+                fail("permutation", "inverse", (long long)i, (long long)permutation_inverse(&perm, value));
+                break;
+            }
+        }
+    }
+    free(seen);
+}
+
+// Compares the Fenwick select of the played set with a scan of a plain
+// bitmap after random marks, unmarks and resizes
+static void verifyPlayedSets(Rng *rng, int rounds) {
+    uint8_t *marked = calloc(MAX_SET, 1);
+    size_t *unmarked = malloc(MAX_SET * sizeof(size_t));
+    if (!marked || !unmarked) {
+        fail("played_set", "allocation failed", 0, 0);
+        free(marked);
+        free(unmarked);
+        return;
+    }
+    for (int round = 0; round < rounds; round++) {
+        size_t count = (size_t)rng_bounded(rng, MAX_SET) + 1;
+        PlayedSet set;
+        if (played_set_init(&set, count) != 0) {
+            fail("played_set", "init failed", (long long)count, 0);
+            continue;
+        }
+        memset(marked, 0, MAX_SET);
+        size_t ops = (size_t)rng_bounded(rng, 2 * count) + 1;
+        for (size_t op = 0; op < ops; op++) {
+            size_t value = (size_t)rng_bounded(rng, count);
+            if (rng_bounded(rng, 4) == 0) {
+                played_set_unmark(&set, value);
+                marked[value] = 0;
+            } else {
+                played_set_mark(&set, value);
+                marked[value] = 1;
+            }
+        }
+        if (rng_bounded(rng, 4) == 0) {
+            size_t resized = (size_t)rng_bounded(rng, MAX_SET) + 1;
+            if (played_set_resize(&set, resized) != 0) {
+                fail("played_set", "resize failed", (long long)resized, 0);
+                played_set_free(&set);
+                continue;
+            }
+            for (size_t v = resized; v < count; v++) marked[v] = 0;
+            count = resized;
+        }
+        size_t free_count = 0;
+        for (size_t v = 0; v < count; v++) {
+            if (played_set_test(&set, v) != marked[v]) {
+                fail("played_set", "test", (long long)v, played_set_test(&set, v));
+                break;
+            }
+            if (!marked[v]) unmarked[free_count++] = v;
+        }
+        if (set.marked != count - free_count) {
+            fail("played_set", "marked count", (long long)set.marked, (long long)(count - free_count));
+        }
+        for (size_t k = 0; k < free_count; k++) {
+            size_t value = played_set_select_unmarked(&set, k);
+            if (value != unmarked[k]) {
+                fail("played_set", "select", (long long)k, (long long)value);
+                break;
+            }
+        }
+        played_set_free(&set);
+    }
+    free(marked);
+    free(unmarked);
+}
+
+// Adds up the chance of every item from the alias table, which a column
+// keeps with its threshold and passes to its alias otherwise, and compares
+// it with the item's share of the total weight
+static void verifyAliasTables(Rng *rng, int rounds) {
+    uint32_t *weights = malloc(MAX_SET * sizeof(uint32_t));
+    double *chance = malloc(MAX_SET * sizeof(double));
+    if (!weights || !chance) {
+        fail("alias", "allocation failed", 0, 0);
+        free(weights);
+        free(chance);
+        return;
+    }
+    for (int round = 0; round < rounds; round++) {
+        size_t count = (size_t)rng_bounded(rng, MAX_SET) + 1;
+        uint32_t top = rng_bounded(rng, 2) ? 6 : 1000000;
+        double total = 0.0;
+        for (size_t i = 0; i < count; i++) {
+            weights[i] = (uint32_t)rng_bounded(rng, top) + 1;
+            total += weights[i];
+        }
+        WeightedSampler sampler;
+        if (weighted_sampler_build(&sampler, weights, count) != 0) {
+            fail("alias", "build failed", (long long)count, 0);
+            continue;
+        }
+        memset(chance, 0, count * sizeof(double));
+        int broken = 0;
+        for (size_t c = 0; c < count && !broken; c++) {
+            if (sampler.alias[c] >= count) {
+                fail("alias", "alias out of range", (long long)c, sampler.alias[c]);
+                broken = 1;
+                break;
+            }
+            // A draw keeps column c when its coin is below the threshold
+            double keep = sampler.threshold[c] / 4294967296.0;
+            chance[c] += keep / (double)count;
+            chance[sampler.alias[c]] += (1.0 - keep) / (double)count;
+        }
+        for (size_t i = 0; i < count && !broken; i++) {
+            double expected = weights[i] / total;
+            if (fabs(chance[i] - expected) > 1e-6 * (expected + 1.0 / (double)count)) {
+                fail("alias", "chance differs from weight share", (long long)i, (long long)(chance[i] * 1e9));
+                break;
+            }
+        }
+        for (int d = 0; d < 64 && !broken; d++) {
+            size_t drawn = weighted_sampler_draw(&sampler, rng_next(rng));
+            if (drawn >= count) {
+                fail("alias", "draw out of range", (long long)drawn, (long long)count);
+                break;
+            }
+        }
+        weighted_sampler_free(&sampler);
+    }
+    free(weights);
+    free(chance);
+}
+
+// Runs every check for the given number of random rounds and reports
+// failures on stderr. Returns the number of failed checks.
+int verify_run(uint64_t seed, int rounds) {
+    Rng rng;
+    rng_seed(&rng, seed);
+    failures = 0;
+    verifyPackedOrders(&rng, rounds);
+    verifyPermutations(&rng, rounds);
+    verifyPlayedSets(&rng, rounds);
+    verifyAliasTables(&rng, rounds);
+    fprintf(stdout, "verify: %d rounds per check, seed %llu, %d failures\n",
+            rounds, (unsigned long long)seed, failures);
+    return failures;
+}
@@ -0,0 +1,31 @@
+/*
+    Playback Buttons, a plugin for the DeaDBeeF audio player
+
+    Correctness checks for the encodings and samplers of the ordering
+    engine, run against random inputs by the benchmark's -V option.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdint.h>
+
+// Runs every check for the given number of random rounds and reports
+// failures on stderr. Returns the number of failed checks.
+int verify_run(uint64_t seed, int rounds);
+
+#endif